@@ -0,0 +1,285 @@
+'use strict';
+
+const { existsSync, renameSync, unlinkSync } = require('fs');
+const { tmpdir } = require('os');
+const { join } = require('path');
+
+const { Database } = require(join(__dirname, '..', 'lib'));
+
+const DEFAULT_SEED = 0x5eed;
+const DEFAULT_KEY = 'esqlite benchmark passphrase';
+
+// Small, fast, seedable PRNG (mulberry32) so that generated datasets are
+// byte-for-byte reproducible across runs and machines
+function makeRandom(seed) {
+  let state = (seed >>> 0);
+  return () => {
+    state = ((state + 0x6D2B79F5) >>> 0);
+    let t = state;
+    t = Math.imul(t ^ (t >>> 15), t | 1);
+    t ^= t + Math.imul(t ^ (t >>> 7), t | 61);
+    return (((t ^ (t >>> 14)) >>> 0) / 4294967296);
+  };
+}
+
+function randomInt(rand, min, max) {
+  return min + Math.floor(rand() * (max - min + 1));
+}
+
+function randomString(rand, len) {
+  const chars = 'abcdefghijklmnopqrstuvwxyz0123456789';
+  let str = '';
+  for (let i = 0; i < len; ++i)
+    str += chars[Math.floor(rand() * chars.length)];
+  return str;
+}
+
+function randomBuffer(rand, len) {
+  const buf = Buffer.allocUnsafe(len);
+  let i = 0;
+  for (; i + 4 <= len; i += 4)
+    buf.writeUInt32LE((rand() * 4294967296) >>> 0, i);
+  for (; i < len; ++i)
+    buf[i] = (rand() * 256) >>> 0;
+  return buf;
+}
+
+function query(db, sql, opts, vals) {
+  return new Promise((resolve, reject) => {
+    db.query(sql, opts || {}, vals, (err, rows) => {
+      if (err)
+        reject(Array.isArray(err) ? err.find((e) => !!e) : err);
+      else
+        resolve(rows);
+    });
+  });
+}
+
+const WIDE_COLUMNS = 64;
+
+const SCHEMA = `
+  CREATE TABLE data (
+    id INTEGER PRIMARY KEY,
+    emailAddress VARCHAR(500),
+    firstName VARCHAR(500),
+    lastName VARCHAR(500),
+    ipAddress VARCHAR(500),
+    age INT
+  );
+  CREATE TABLE wide (
+    id INTEGER PRIMARY KEY,
+    ${Array.from({ length: WIDE_COLUMNS }, (_, i) => `c${i} TEXT`).join(',')}
+  );
+  CREATE TABLE blobs (
+    id INTEGER PRIMARY KEY,
+    data BLOB
+  );
+`;
+
+// Generates (if needed) a dataset database and returns its path. The same
+// `opts` always produce the same database contents.
+async function createDataset(opts) {
+  const {
+    rows = 100000,
+    wideRows = 5000,
+    blobs = 64,
+    blobSize = 1024 * 1024,
+    seed = DEFAULT_SEED,
+    key,
+    dir = tmpdir(),
+  } = (opts || {});
+
+  const name = [
+    'esqlite-bench',
+    seed.toString(16),
+    rows,
+    wideRows,
+    `${blobs}x${blobSize}`,
+    (key ? 'enc' : 'plain'),
+  ].join('-');
+  const path = join(dir, `${name}.db`);
+  if (existsSync(path))
+    return path;
+
+  // Build into a temporary file first so that an interrupted run never
+  // leaves a partial dataset behind that would be reused later
+  const tmpPath = `${path}.tmp-${process.pid}`;
+  const db = new Database(tmpPath);
+  db.open();
+  try {
+    if (key)
+      await query(db, `PRAGMA key = '${key.replace(/'/g, `''`)}'`);
+    await query(db, 'PRAGMA journal_mode = WAL');
+    await query(db, SCHEMA, { single: false });
+
+    const rand = makeRandom(seed);
+    const BATCH = 100;
+
+    await query(db, 'BEGIN');
+    {
+      const insertSQL = (count) => {
+        const rowsSQL = new Array(count).fill('(?, ?, ?, ?, ?, ?)').join(',');
+        return `INSERT INTO data VALUES ${rowsSQL}`;
+      };
+      for (let id = 1; id <= rows; id += BATCH) {
+        const count = Math.min(BATCH, rows - id + 1);
+        const vals = [];
+        for (let i = 0; i < count; ++i) {
+          const first = randomString(rand, randomInt(rand, 3, 12));
+          const last = randomString(rand, randomInt(rand, 3, 16));
+          vals.push(
+            id + i,
+            `${first}.${last}@example.org`,
+            first,
+            last,
+            [0, 0, 0, 0].map(() => randomInt(rand, 0, 255)).join('.'),
+            randomInt(rand, 18, 99)
+          );
+        }
+        await query(db, insertSQL(count), null, vals);
+      }
+    }
+    {
+      const placeholders =
+        Array.from({ length: WIDE_COLUMNS + 1 }, () => '?').join(',');
+      const insertSQL = `INSERT INTO wide VALUES (${placeholders})`;
+      for (let id = 1; id <= wideRows; ++id) {
+        const vals = [id];
+        for (let c = 0; c < WIDE_COLUMNS; ++c)
+          vals.push(randomString(rand, randomInt(rand, 1, 24)));
+        await query(db, insertSQL, null, vals);
+      }
+    }
+    for (let id = 1; id <= blobs; ++id) {
+      await query(
+        db,
+        'INSERT INTO blobs VALUES (?, ?)',
+        null,
+        [id, randomBuffer(rand, blobSize)]
+      );
+    }
+    await query(db, 'COMMIT');
+    await query(db, 'PRAGMA wal_checkpoint(TRUNCATE)');
+    await query(db, 'PRAGMA journal_mode = DELETE');
+  } catch (ex) {
+    db.close();
+    unlinkSync(tmpPath);
+    throw ex;
+  }
+  db.close();
+  renameSync(tmpPath, path);
+  return path;
+}
+
+function percentile(sorted, p) {
+  if (sorted.length === 0)
+    return 0;
+  const idx = Math.ceil((p / 100) * sorted.length) - 1;
+  return sorted[Math.min(sorted.length - 1, Math.max(0, idx))];
+}
+
+function summarizeLatencies(latenciesNs) {
+  const sorted = Float64Array.from(latenciesNs).sort();
+  let total = 0;
+  for (let i = 0; i < sorted.length; ++i)
+    total += sorted[i];
+  const toMs = (ns) => (ns / 1e6);
+  return {
+    min: toMs(sorted.length ? sorted[0] : 0),
+    mean: toMs(sorted.length ? total / sorted.length : 0),
+    p50: toMs(percentile(sorted, 50)),
+    p90: toMs(percentile(sorted, 90)),
+    p99: toMs(percentile(sorted, 99)),
+    max: toMs(sorted.length ? sorted[sorted.length - 1] : 0),
+  };
+}
+
+function maxRSS() {
+  // `resourceUsage()` is only available in node v12.6.0+ and reports KiB
+  if (typeof process.resourceUsage === 'function')
+    return process.resourceUsage().maxRSS * 1024;
+  return undefined;
+}
+
+// Runs `fn` (which should perform a single operation and resolve to the
+// number of rows it processed) repeatedly and returns a JSON-friendly summary
+async function measure(name, fn, opts) {
+  const {
+    iterations = 1000,
+    warmup = Math.min(100, Math.ceil(iterations / 10)),
+    meta,
+  } = (opts || {});
+
+  for (let i = 0; i < warmup; ++i)
+    await fn(i);
+
+  if (typeof global.gc === 'function')
+    global.gc();
+
+  const rssStart = process.memoryUsage().rss;
+  const latencies = new Array(iterations);
+  let rows = 0;
+  let rssPeak = rssStart;
+  const rssSampleInterval = Math.max(1, Math.floor(iterations / 100));
+  const start = process.hrtime.bigint();
+  for (let i = 0; i < iterations; ++i) {
+    const opStart = process.hrtime.bigint();
+    rows += ((await fn(i)) || 0);
+    latencies[i] = Number(process.hrtime.bigint() - opStart);
+    if ((i % rssSampleInterval) === 0) {
+      const rss = process.memoryUsage().rss;
+      if (rss > rssPeak)
+        rssPeak = rss;
+    }
+  }
+  const elapsedNs = Number(process.hrtime.bigint() - start);
+  const rssEnd = process.memoryUsage().rss;
+  const seconds = (elapsedNs / 1e9);
+
+  return {
+    name,
+    ...meta,
+    ops: iterations,
+    rows,
+    durationMs: (elapsedNs / 1e6),
+    opsPerSec: (iterations / seconds),
+    rowsPerSec: (rows / seconds),
+    latencyMs: summarizeLatencies(latencies),
+    rss: {
+      start: rssStart,
+      end: rssEnd,
+      peak: Math.max(rssPeak, rssEnd),
+      processMax: maxRSS(),
+    },
+  };
+}
+
+function parseArgs(argv, defaults) {
+  const opts = { ...defaults };
+  for (let i = 0; i < argv.length; ++i) {
+    const m = /^--([^=]+)(?:=(.*))?$/.exec(argv[i]);
+    if (!m)
+      throw new Error(`Unexpected argument: ${argv[i]}`);
+    const key = m[1].replace(/-([a-z])/g, (_, c) => c.toUpperCase());
+    let val = (m[2] === undefined ? true : m[2]);
+    if (typeof defaults[key] === 'number')
+      val = +val;
+    opts[key] = val;
+  }
+  return opts;
+}
+
+module.exports = {
+  DEFAULT_KEY,
+  DEFAULT_SEED,
+  createDataset,
+  makeRandom,
+  maxRSS,
+  measure,
+  parseArgs,
+  query,
+  randomBuffer,
+  randomInt,
+  randomString,
+  summarizeLatencies,
+};
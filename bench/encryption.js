@@ -0,0 +1,191 @@
+'use strict';
+
+// Measures the overhead of page encryption/decryption by comparing page I/O on
+// unencrypted and encrypted databases. The page cache is kept deliberately
+// small so that scans have to read (and decrypt) pages instead of being served
+// from SQLite's cache. The OS page cache is left warm so that the cipher cost
+// dominates rather than disk I/O.
+//
+// The ciphers measured are the (scalar) implementations of the bundled
+// SQLite3MultipleCiphers amalgamation. Vectorized ChaCha20/Poly1305 kernels
+// are not part of this tree yet; this is the baseline for evaluating them.
+//
+// Usage: node bench/encryption.js [--rows=N] [--row-size=<bytes>]
+//                                 [--iterations=N] [--cipher=<regexp>]
+//                                 [--out=<path>]
+
+const { existsSync, unlinkSync, writeFileSync } = require('fs');
+const { tmpdir } = require('os');
+const { join } = require('path');
+
+const {
+  AES_HARDWARE,
+  Database,
+  version,
+} = require(join(__dirname, '..', 'lib'));
+const {
+  DEFAULT_KEY,
+  makeRandom,
+  measure,
+  parseArgs,
+  query,
+  randomBuffer,
+} = require('./common.js');
+
+const opts = parseArgs(process.argv.slice(2), {
+  rows: 20000,
+  rowSize: 1024,
+  iterations: 5,
+  cipher: '',
+  out: '',
+});
+
+// Each entry describes how a connection is configured before use
+const CIPHERS = [
+  { name: 'plain', pragmas: [] },
+  {
+    name: 'chacha20',
+    pragmas: [
+      `PRAGMA cipher = 'chacha20'`,
+      `PRAGMA key = '${DEFAULT_KEY}'`,
+    ],
+  },
+  // AEGIS is only competitive (and only allowed) with AES instructions
+  ...(AES_HARDWARE ? [{
+    name: 'aegis',
+    pragmas: [
+      `PRAGMA cipher = 'aegis'`,
+      `PRAGMA key = '${DEFAULT_KEY}'`,
+    ],
+  }] : []),
+];
+
+async function openDB(path, cipher) {
+  const db = new Database(path);
+  db.open();
+  for (const sql of cipher.pragmas)
+    await query(db, sql);
+  return db;
+}
+
+function removeDB(path) {
+  for (const suffix of ['', '-wal', '-shm']) {
+    if (existsSync(`${path}${suffix}`))
+      unlinkSync(`${path}${suffix}`);
+  }
+}
+
+async function runCipher(cipher) {
+  const path = join(tmpdir(), `esqlite-bench-cipher-${cipher.name}.db`);
+  const results = [];
+  const pragmaInt = async (db, name) => {
+    const [row] = await query(db, `PRAGMA ${name}`);
+    return +row[name];
+  };
+
+  // Write path: fill the database and checkpoint the WAL (which encrypts
+  // every page once more when it is copied back into the database file)
+  removeDB(path);
+  {
+    const rand = makeRandom(opts.rows);
+    const payloads = [];
+    for (let i = 0; i < 64; ++i)
+      payloads.push(randomBuffer(rand, opts.rowSize));
+    let db;
+    const name = `${cipher.name}: insert+checkpoint`;
+    const result = await measure(name, async () => {
+      removeDB(path);
+      db = await openDB(path, cipher);
+      await query(db, 'PRAGMA journal_mode = WAL');
+      await query(db, 'CREATE TABLE t (id INTEGER PRIMARY KEY, data BLOB)');
+      await query(db, 'BEGIN');
+      for (let i = 0; i < opts.rows; ++i) {
+        await query(
+          db, 'INSERT INTO t (data) VALUES (?)', null, [payloads[i & 63]]
+        );
+      }
+      await query(db, 'COMMIT');
+      await query(db, 'PRAGMA wal_checkpoint(TRUNCATE)');
+      const pages = await pragmaInt(db, 'page_count');
+      db.close();
+      return pages;
+    }, {
+      iterations: opts.iterations,
+      warmup: 1,
+      meta: { cipher: cipher.name, operation: 'write' },
+    });
+    db = await openDB(path, cipher);
+    const bytes = result.rows * (await pragmaInt(db, 'page_size'));
+    db.close();
+    result.pagesPerSec = result.rowsPerSec;
+    result.mbPerSec = (bytes / (1024 * 1024)) / (result.durationMs / 1000);
+    results.push(result);
+  }
+
+  // Read path: cold (SQLite cache-wise) full scans
+  {
+    const db = await openDB(path, cipher);
+    await query(db, 'PRAGMA cache_size = 16');
+    const pages = await pragmaInt(db, 'page_count');
+    const bytes = pages * (await pragmaInt(db, 'page_size'));
+    const result = await measure(`${cipher.name}: cold scan`, async () => {
+      await query(db, 'SELECT sum(length(data)) AS n FROM t');
+      return pages;
+    }, {
+      iterations: opts.iterations * 4,
+      warmup: 1,
+      meta: { cipher: cipher.name, operation: 'read' },
+    });
+    db.close();
+    result.pagesPerSec = result.rowsPerSec;
+    result.mbPerSec = (bytes * result.ops / (1024 * 1024))
+                      / (result.durationMs / 1000);
+    results.push(result);
+  }
+
+  removeDB(path);
+  return results;
+}
+
+(async () => {
+  const filter = (opts.cipher ? new RegExp(opts.cipher) : null);
+  const results = [];
+  for (const cipher of CIPHERS) {
+    if (cipher.name !== 'plain' && filter && !filter.test(cipher.name))
+      continue;
+    results.push(...await runCipher(cipher));
+  }
+
+  // Express each cipher's throughput relative to the unencrypted baseline
+  const baseline = {};
+  for (const result of results) {
+    if (result.cipher === 'plain')
+      baseline[result.operation] = result.mbPerSec;
+  }
+  for (const result of results) {
+    const base = baseline[result.operation];
+    if (base)
+      result.relativeToPlain = (result.mbPerSec / base);
+  }
+
+  const output = JSON.stringify({
+    meta: {
+      version,
+      node: process.version,
+      platform: process.platform,
+      arch: process.arch,
+      aesHardware: AES_HARDWARE,
+      rows: opts.rows,
+      rowSize: opts.rowSize,
+      date: new Date().toISOString(),
+    },
+    results,
+  }, null, 2);
+  if (opts.out)
+    writeFileSync(opts.out, `${output}\n`);
+  else
+    process.stdout.write(`${output}\n`);
+})().catch((err) => {
+  console.error(err);
+  process.exitCode = 1;
+});
@@ -0,0 +1,107 @@
+'use strict';
+
+// Micro-benchmarks for the binding's per-value hot paths (parameter binding and
+// result value materialization). These loops run entirely in native code, so
+// the addon must be built with the benchmark entry points enabled:
+//
+//   node-gyp rebuild -- -Desqlite_benchmarks=1
+//
+// Usage: node bench/micro.js [--iterations=N] [--out=<path>]
+
+const { writeFileSync } = require('fs');
+const { join } = require('path');
+
+const { parseArgs } = require('./common.js');
+
+const binding = require(join(__dirname, '..', 'build', 'Release', 'esqlite3'));
+
+const opts = parseArgs(process.argv.slice(2), {
+  iterations: 200000,
+  out: '',
+});
+
+if (typeof binding.benchBind !== 'function') {
+  console.error(
+    'Native benchmarks are not available, rebuild with: '
+      + 'node-gyp rebuild -- -Desqlite_benchmarks=1'
+  );
+  process.exit(1);
+}
+
+// Keep in sync with `BenchMaterialize()`
+const MATERIALIZE_NULL = 0;
+const MATERIALIZE_STRING = 1;
+const MATERIALIZE_BLOB = 2;
+
+// Keep in sync with `EXTERN_APEX` in src/binding.cc
+const EXTERN_APEX = 0xFBEE9;
+
+const bindCases = [
+  ['null', null],
+  ['int32', 42],
+  ['uint32 > 2^31', 2 ** 31 + 7],
+  ['double', 1234.5678],
+  ['bigint (int32 range)', 42n],
+  ['bigint (int64 range)', 2n ** 40n],
+  ['string (empty)', ''],
+  ['string (16)', 'x'.repeat(16)],
+  ['string (4096)', 'x'.repeat(4096)],
+  ['buffer (empty)', Buffer.alloc(0)],
+  ['buffer (16)', Buffer.alloc(16, 1)],
+  ['buffer (65536)', Buffer.alloc(65536, 1)],
+];
+
+const materializeCases = [
+  ['null', MATERIALIZE_NULL, 0, 1],
+  ['string (empty)', MATERIALIZE_STRING, 0, 1],
+  ['string (16)', MATERIALIZE_STRING, 16, 1],
+  ['string (4096)', MATERIALIZE_STRING, 4096, 1],
+  // Largest string still copied onto the V8 heap
+  ['string (EXTERN_APEX - 1)', MATERIALIZE_STRING, EXTERN_APEX - 1, 1 / 1000],
+  // Smallest string using an external string resource
+  ['string (EXTERN_APEX)', MATERIALIZE_STRING, EXTERN_APEX, 1 / 1000],
+  ['blob (empty)', MATERIALIZE_BLOB, 0, 1],
+  ['blob (16)', MATERIALIZE_BLOB, 16, 1],
+  ['blob (65536)', MATERIALIZE_BLOB, 65536, 1 / 10],
+];
+
+const results = [];
+
+{
+  const timings = binding.benchBind(
+    bindCases.map(([, value]) => value),
+    opts.iterations
+  );
+  for (let i = 0; i < bindCases.length; ++i) {
+    results.push({
+      name: `bind: ${bindCases[i][0]}`,
+      iterations: opts.iterations,
+      setBindValueNs: timings[i][0],
+      bindValueNs: timings[i][1],
+    });
+  }
+}
+
+for (const [name, type, len, scale] of materializeCases) {
+  const iterations = Math.max(1, Math.floor(opts.iterations * scale));
+  results.push({
+    name: `materialize: ${name}`,
+    iterations,
+    ns: binding.benchMaterialize(type, len, iterations),
+  });
+}
+
+const output = JSON.stringify({
+  meta: {
+    version: binding.version(),
+    node: process.version,
+    platform: process.platform,
+    arch: process.arch,
+    date: new Date().toISOString(),
+  },
+  results,
+}, null, 2);
+if (opts.out)
+  writeFileSync(opts.out, `${output}\n`);
+else
+  process.stdout.write(`${output}\n`);
@@ -0,0 +1,125 @@
+'use strict';
+
+// Measures how a full-table aggregation scales when it is split into rowid
+// ranges with `parallelQuery()` and run on multiple reader connections. The
+// threadpool is sized for the largest worker count, so the number of workers
+// is the only thing limiting concurrency.
+//
+// Usage: node bench/parallel.js [--rows=N] [--iterations=N]
+//                               [--workers=1,2,4,...] [--out=<path>]
+
+const { existsSync, unlinkSync, writeFileSync } = require('fs');
+const { cpus, tmpdir } = require('os');
+const { join } = require('path');
+
+const { Database, version } = require(join(__dirname, '..', 'lib'));
+const { measure, parseArgs } = require('./common.js');
+
+const opts = parseArgs(process.argv.slice(2), {
+  rows: 2000000,
+  iterations: 5,
+  workers: '',
+  out: '',
+});
+
+const workerCounts = [];
+if (opts.workers) {
+  for (const count of String(opts.workers).split(','))
+    workerCounts.push(+count);
+} else {
+  for (let count = 1; count < cpus().length; count *= 2)
+    workerCounts.push(count);
+  workerCounts.push(cpus().length);
+}
+
+// The threadpool size can only be set before the threadpool is first used,
+// which happens with the first query
+process.env.UV_THREADPOOL_SIZE = `${Math.max(4, ...workerCounts)}`;
+
+const AGGREGATE_SQL = `
+  SELECT grp,
+         count(*) AS n,
+         sum(val) AS total,
+         min(val) AS lo,
+         max(val) AS hi
+  FROM t
+  WHERE rowid >= :start AND rowid < :end
+  GROUP BY grp
+`;
+const COMBINE = { n: 'count', total: 'sum', lo: 'min', hi: 'max' };
+
+function removeDB(path) {
+  for (const suffix of ['', '-wal', '-shm']) {
+    if (existsSync(`${path}${suffix}`))
+      unlinkSync(`${path}${suffix}`);
+  }
+}
+
+(async () => {
+  const path = join(tmpdir(), 'esqlite-bench-parallel.db');
+  removeDB(path);
+  const db = new Database(path);
+  db.open();
+  await db.exec(`
+    PRAGMA journal_mode = WAL;
+    CREATE TABLE t (id INTEGER PRIMARY KEY, grp INT, val INT, data TEXT);
+    INSERT INTO t
+      SELECT value, value % 16, (value * 7919) % 100000, hex(randomblob(32))
+      FROM generate_series(1, ${opts.rows});
+    PRAGMA wal_checkpoint(TRUNCATE);
+  `);
+
+  const results = [];
+  let expected;
+  for (const workers of workerCounts) {
+    const name = `aggregate: ${workers} worker(s)`;
+    const result = await measure(name, async () => {
+      const rows = await db.parallelQuery(AGGREGATE_SQL, {
+        table: 't',
+        workers,
+        combine: COMBINE,
+      });
+      // Every worker count must produce the same (combined) result
+      const json = JSON.stringify(rows.sort((a, b) => a.grp - b.grp));
+      if (expected === undefined)
+        expected = json;
+      else if (json !== expected)
+        throw new Error(`Mismatched results with ${workers} worker(s)`);
+      return opts.rows;
+    }, {
+      iterations: opts.iterations,
+      warmup: 1,
+      meta: { workers },
+    });
+    results.push(result);
+  }
+
+  db.close();
+  removeDB(path);
+
+  // Express each worker count's throughput relative to a single worker
+  const base = results[0].rowsPerSec;
+  for (const result of results)
+    result.speedup = (result.rowsPerSec / base);
+
+  const output = JSON.stringify({
+    meta: {
+      version,
+      node: process.version,
+      platform: process.platform,
+      arch: process.arch,
+      cpus: cpus().length,
+      threadpoolSize: +process.env.UV_THREADPOOL_SIZE,
+      rows: opts.rows,
+      date: new Date().toISOString(),
+    },
+    results,
+  }, null, 2);
+  if (opts.out)
+    writeFileSync(opts.out, `${output}\n`);
+  else
+    process.stdout.write(`${output}\n`);
+})().catch((err) => {
+  console.error(err);
+  process.exitCode = 1;
+});
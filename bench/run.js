@@ -0,0 +1,289 @@
+'use strict';
+
+// End-to-end benchmark scenarios. Results are written as JSON to stdout (or to
+// the file given by `--out=<path>`) so that runs can be compared by tooling.
+//
+// Usage: node bench/run.js [--rows=N] [--iterations=N] [--scenario=<regex>]
+//                          [--seed=N] [--out=<path>]
+
+const { writeFileSync } = require('fs');
+const { cpus } = require('os');
+const { join } = require('path');
+
+const { Database, OPEN_FLAGS, version } = require(join(__dirname, '..', 'lib'));
+const {
+  DEFAULT_KEY,
+  DEFAULT_SEED,
+  createDataset,
+  makeRandom,
+  measure,
+  parseArgs,
+  query,
+  randomInt,
+} = require('./common.js');
+
+const opts = parseArgs(process.argv.slice(2), {
+  rows: 100000,
+  iterations: 2000,
+  scenario: '',
+  seed: DEFAULT_SEED,
+  out: '',
+});
+
+function openDB(path, key) {
+  const db = new Database(path);
+  db.open(OPEN_FLAGS.READWRITE);
+  if (!key)
+    return Promise.resolve(db);
+  return query(db, `PRAGMA key = '${key.replace(/'/g, `''`)}'`).then(() => db);
+}
+
+function queryAsync(db, sql, qopts) {
+  return db.queryAsync(sql, qopts).execute();
+}
+
+const scenarios = [
+  {
+    name: 'point-select',
+    async run(ctx) {
+      const rand = makeRandom(opts.seed);
+      return measure(this.name, async () => {
+        const id = randomInt(rand, 1, opts.rows);
+        const rows =
+          await query(ctx.db, 'SELECT * FROM data WHERE id = ?', null, [id]);
+        return rows.length;
+      }, { iterations: opts.iterations });
+    },
+  },
+  {
+    name: 'range-scan',
+    async run(ctx) {
+      const rand = makeRandom(opts.seed);
+      const span = 1000;
+      return measure(this.name, async () => {
+        const start = randomInt(rand, 1, Math.max(1, opts.rows - span));
+        const rows = await query(
+          ctx.db,
+          'SELECT * FROM data WHERE id >= ? AND id < ?',
+          null,
+          [start, start + span]
+        );
+        return rows.length;
+      }, {
+        iterations: Math.ceil(opts.iterations / 10),
+        meta: { rowsPerOp: span },
+      });
+    },
+  },
+  {
+    name: 'full-scan',
+    async run(ctx) {
+      return measure(this.name, async () => {
+        const rows = await query(ctx.db, 'SELECT * FROM data');
+        return rows.length;
+      }, { iterations: 10, warmup: 1 });
+    },
+  },
+  {
+    name: 'wide-rows',
+    async run(ctx) {
+      return measure(this.name, async () => {
+        const rows = await query(ctx.db, 'SELECT * FROM wide LIMIT 1000');
+        return rows.length;
+      }, { iterations: Math.ceil(opts.iterations / 20) });
+    },
+  },
+  {
+    name: 'large-blobs',
+    async run(ctx) {
+      const rand = makeRandom(opts.seed);
+      const [{ n }] = await query(ctx.db, 'SELECT count(*) AS n FROM blobs');
+      return measure(this.name, async () => {
+        const id = randomInt(rand, 1, +n);
+        const rows = await query(
+          ctx.db, 'SELECT data FROM blobs WHERE id = ?', null, [id]
+        );
+        return rows.length;
+      }, { iterations: Math.ceil(opts.iterations / 10) });
+    },
+  },
+  {
+    name: 'bulk-insert',
+    async run(ctx) {
+      const db = new Database(':memory:');
+      db.open();
+      await query(db, 'CREATE TABLE t (id INTEGER PRIMARY KEY, a TEXT, b INT)');
+      const batch = 1000;
+      const result = await measure(this.name, async (i) => {
+        await query(db, 'BEGIN');
+        for (let j = 0; j < batch; ++j) {
+          await query(
+            db, 'INSERT INTO t (a, b) VALUES (?, ?)', null, [`row ${j}`, i]
+          );
+        }
+        await query(db, 'COMMIT');
+        return batch;
+      }, { iterations: 20, warmup: 2, meta: { rowsPerOp: batch } });
+      db.close();
+      return result;
+    },
+  },
+  {
+    name: 'params-positional',
+    async run(ctx) {
+      const rand = makeRandom(opts.seed);
+      return measure(this.name, async () => {
+        const vals = [randomInt(rand, 1, opts.rows), 50];
+        const rows = await query(
+          ctx.db, 'SELECT * FROM data WHERE id = ? AND age > ?', null, vals
+        );
+        return rows.length;
+      }, { iterations: opts.iterations });
+    },
+  },
+  {
+    name: 'params-named',
+    async run(ctx) {
+      const rand = makeRandom(opts.seed);
+      return measure(this.name, async () => {
+        const values = { id: randomInt(rand, 1, opts.rows), age: 50 };
+        const rows = await query(
+          ctx.db, 'SELECT * FROM data WHERE id = :id AND age > :age', { values }
+        );
+        return rows.length;
+      }, { iterations: opts.iterations });
+    },
+  },
+  {
+    name: 'rows-objects',
+    async run(ctx) {
+      return measure(this.name, async () => {
+        const rows = await query(ctx.db, 'SELECT * FROM data LIMIT 10000');
+        return rows.length;
+      }, { iterations: 20, warmup: 2 });
+    },
+  },
+  {
+    name: 'rows-arrays',
+    async run(ctx) {
+      return measure(this.name, async () => {
+        const rows = await query(
+          ctx.db, 'SELECT * FROM data LIMIT 10000', { rowsAsArray: true }
+        );
+        return rows.length;
+      }, { iterations: 20, warmup: 2 });
+    },
+  },
+  {
+    // Unlike `point-select`, which wraps each query in a promise, this chains
+    // the queries of an operation through plain `db.query()` callbacks. Since
+    // each query returns one row, `rowsPerSec` is comparable to the queries per
+    // second of `point-select` and `api-async`.
+    name: 'api-callback',
+    async run(ctx) {
+      const rand = makeRandom(opts.seed);
+      const perOp = 10;
+      const sql = 'SELECT * FROM data WHERE id = ?';
+      return measure(this.name, () => new Promise((resolve, reject) => {
+        let remaining = perOp;
+        let rowCount = 0;
+        const next = (err, rows) => {
+          if (err)
+            return reject(Array.isArray(err) ? err.find((e) => !!e) : err);
+          if (rows)
+            rowCount += rows.length;
+          if (remaining-- === 0)
+            return resolve(rowCount);
+          ctx.db.query(sql, [randomInt(rand, 1, opts.rows)], next);
+        };
+        next();
+      }), {
+        iterations: Math.ceil(opts.iterations / perOp),
+        meta: { queriesPerOp: perOp },
+      });
+    },
+  },
+  {
+    name: 'api-async',
+    async run(ctx) {
+      const rand = makeRandom(opts.seed);
+      return measure(this.name, async () => {
+        const id = randomInt(rand, 1, opts.rows);
+        const rows = await queryAsync(
+          ctx.db, 'SELECT * FROM data WHERE id = ?', [id]
+        );
+        return (rows ? rows.length : 0);
+      }, { iterations: opts.iterations });
+    },
+  },
+  {
+    name: 'scan-plain',
+    async run(ctx) {
+      const db = await openDB(ctx.plainPath);
+      const result = await measure(this.name, async () => {
+        const rows =
+          await query(db, 'SELECT * FROM data', { rowsAsArray: true });
+        return rows.length;
+      }, { iterations: 5, warmup: 1, meta: { encrypted: false } });
+      db.close();
+      return result;
+    },
+  },
+  {
+    name: 'scan-encrypted',
+    async run(ctx) {
+      const path = await createDataset({
+        rows: opts.rows,
+        wideRows: 0,
+        blobs: 0,
+        seed: opts.seed,
+        key: DEFAULT_KEY,
+      });
+      const db = await openDB(path, DEFAULT_KEY);
+      const result = await measure(this.name, async () => {
+        const rows =
+          await query(db, 'SELECT * FROM data', { rowsAsArray: true });
+        return rows.length;
+      }, { iterations: 5, warmup: 1, meta: { encrypted: true } });
+      db.close();
+      return result;
+    },
+  },
+];
+
+(async () => {
+  const filter = (opts.scenario ? new RegExp(opts.scenario) : null);
+  const plainPath = await createDataset({ rows: opts.rows, seed: opts.seed });
+  const db = await openDB(plainPath);
+  const ctx = { db, plainPath };
+
+  const results = [];
+  for (const scenario of scenarios) {
+    if (filter && !filter.test(scenario.name))
+      continue;
+    results.push(await scenario.run(ctx));
+  }
+  db.close();
+
+  const output = JSON.stringify({
+    meta: {
+      version,
+      node: process.version,
+      platform: process.platform,
+      arch: process.arch,
+      cpus: cpus().length,
+      threadpoolSize: +(process.env.UV_THREADPOOL_SIZE || 4),
+      rows: opts.rows,
+      seed: opts.seed,
+      date: new Date().toISOString(),
+    },
+    results,
+  }, null, 2);
+  if (opts.out)
+    writeFileSync(opts.out, `${output}\n`);
+  else
+    process.stdout.write(`${output}\n`);
+})().catch((err) => {
+  console.error(err);
+  process.exitCode = 1;
+});
@@ -0,0 +1,427 @@
+'use strict';
+
+// YCSB-style workload driver for measuring how throughput and latency scale
+// with the libuv threadpool size, the number of `Database` objects sharing a
+// single WAL-mode database file, and the number of worker threads.
+//
+// Each combination of `--threadpool`, `--workers`, and `--connections` is run
+// in a fresh child process (the threadpool size can only be set before the
+// threadpool is first used) and the results for all combinations are written
+// as JSON to stdout (or to the file given by `--out=<path>`).
+//
+// Usage: node bench/ycsb.js [--workloads=A,B,C,D,E,F] [--records=N]
+//                           [--duration=<seconds>] [--threadpool=4,8,...]
+//                           [--workers=1,2,...] [--connections=1,2,...]
+//                           [--concurrency=N] [--busy-timeout=<ms>]
+//                           [--theta=N] [--path=<db path>] [--out=<path>]
+
+const { spawnSync } = require('child_process');
+const { existsSync, unlinkSync, writeFileSync } = require('fs');
+const { tmpdir } = require('os');
+const { join } = require('path');
+
+let workerThreads;
+try {
+  workerThreads = require('worker_threads');
+} catch (ex) {
+  if (ex.code !== 'MODULE_NOT_FOUND')
+    throw ex;
+  console.error('This benchmark requires worker_threads support');
+  process.exit(1);
+}
+const { Worker, isMainThread, parentPort, workerData } = workerThreads;
+
+const { Database } = require(join(__dirname, '..', 'lib'));
+const {
+  makeRandom,
+  parseArgs,
+  query,
+  randomString,
+  summarizeLatencies,
+} = require('./common.js');
+
+const FIELD_COUNT = 10;
+const FIELD_LENGTH = 100;
+const MAX_SCAN_LENGTH = 100;
+
+// Operation mixes as defined by the YCSB core workloads
+const WORKLOADS = {
+  A: { read: 0.5, update: 0.5, distribution: 'zipfian' },
+  B: { read: 0.95, update: 0.05, distribution: 'zipfian' },
+  C: { read: 1, distribution: 'zipfian' },
+  D: { read: 0.95, insert: 0.05, distribution: 'latest' },
+  E: { scan: 0.95, insert: 0.05, distribution: 'zipfian' },
+  F: { read: 0.5, readModifyWrite: 0.5, distribution: 'zipfian' },
+};
+const OPS = ['read', 'update', 'insert', 'scan', 'readModifyWrite'];
+
+// =============================================================================
+// Key distributions (ported from YCSB's generators)
+
+function zeta(n, theta) {
+  let sum = 0;
+  for (let i = 1; i <= n; ++i)
+    sum += 1 / (i ** theta);
+  return sum;
+}
+
+class ZipfianGenerator {
+  constructor(items, theta, rand) {
+    this.items = items;
+    this.theta = theta;
+    this.rand = rand;
+    this.zetan = zeta(items, theta);
+    this.alpha = 1 / (1 - theta);
+    this.eta = (1 - ((2 / items) ** (1 - theta)))
+               / (1 - (zeta(2, theta) / this.zetan));
+    this.half = (0.5 ** theta);
+  }
+
+  next() {
+    const u = this.rand();
+    const uz = u * this.zetan;
+    if (uz < 1)
+      return 0;
+    if (uz < 1 + this.half)
+      return 1;
+    return Math.floor(
+      this.items * (((this.eta * u) - this.eta + 1) ** this.alpha)
+    );
+  }
+}
+
+// Spreads the popular items across the key space instead of clustering them
+// at the start of it
+class ScrambledZipfianGenerator extends ZipfianGenerator {
+  next() {
+    return fnv1a(super.next()) % this.items;
+  }
+}
+
+function fnv1a(val) {
+  let hash = 0x811C9DC5;
+  for (let i = 0; i < 4; ++i) {
+    hash ^= (val & 0xFF);
+    hash = Math.imul(hash, 0x01000193) >>> 0;
+    val >>>= 8;
+  }
+  return hash;
+}
+
+// =============================================================================
+// Shared helpers
+
+function fieldValue(rand) {
+  return randomString(rand, FIELD_LENGTH);
+}
+
+async function loadDatabase(path, records) {
+  for (const suffix of ['', '-wal', '-shm']) {
+    if (existsSync(`${path}${suffix}`))
+      unlinkSync(`${path}${suffix}`);
+  }
+  const db = new Database(path);
+  db.open();
+  await query(db, 'PRAGMA journal_mode = WAL');
+  const fields =
+    Array.from({ length: FIELD_COUNT }, (_, i) => `field${i} TEXT`).join(',');
+  await query(
+    db, `CREATE TABLE usertable (ycsb_key INTEGER PRIMARY KEY, ${fields})`
+  );
+  const rand = makeRandom(records);
+  const placeholders = new Array(FIELD_COUNT + 1).fill('?').join(',');
+  const insertSQL = `INSERT INTO usertable VALUES (${placeholders})`;
+  await query(db, 'BEGIN');
+  for (let key = 0; key < records; ++key) {
+    const vals = [key];
+    for (let f = 0; f < FIELD_COUNT; ++f)
+      vals.push(fieldValue(rand));
+    await query(db, insertSQL, null, vals);
+  }
+  await query(db, 'COMMIT');
+  db.close();
+}
+
+// =============================================================================
+// Worker thread: drives `connections` connections with `concurrency`
+// outstanding operations each
+
+async function runWorker(data) {
+  const {
+    path,
+    workload,
+    records,
+    durationMs,
+    connections,
+    concurrency,
+    busyTimeout,
+    theta,
+    seed,
+    insertCounter,
+  } = data;
+  const mix = WORKLOADS[workload];
+  const rand = makeRandom(seed);
+  const nextInsertKey = () => (records + Atomics.add(insertCounter, 0, 1));
+  const maxKey = () => (records + Atomics.load(insertCounter, 0));
+  const zipf = new ScrambledZipfianGenerator(records, theta, rand);
+  const latestZipf = new ZipfianGenerator(records, theta, rand);
+  const chooseKey = () => {
+    if (mix.distribution === 'latest')
+      return Math.max(0, maxKey() - 1 - latestZipf.next());
+    return zipf.next();
+  };
+  const thresholds = [];
+  {
+    let sum = 0;
+    for (const op of OPS) {
+      if (mix[op]) {
+        sum += mix[op];
+        thresholds.push([sum, op]);
+      }
+    }
+  }
+  const chooseOp = () => {
+    const r = rand() * thresholds[thresholds.length - 1][0];
+    for (const [threshold, op] of thresholds) {
+      if (r < threshold)
+        return op;
+    }
+    return thresholds[thresholds.length - 1][1];
+  };
+
+  const placeholders = new Array(FIELD_COUNT + 1).fill('?').join(',');
+  const execute = {
+    read: (db) => query(
+      db, 'SELECT * FROM usertable WHERE ycsb_key = ?', null, [chooseKey()]
+    ),
+    update: (db) => query(
+      db,
+      `UPDATE usertable SET field${Math.floor(rand() * FIELD_COUNT)} = ?
+       WHERE ycsb_key = ?`,
+      null,
+      [fieldValue(rand), chooseKey()]
+    ),
+    insert: (db) => {
+      const vals = [nextInsertKey()];
+      for (let f = 0; f < FIELD_COUNT; ++f)
+        vals.push(fieldValue(rand));
+      return query(
+        db, `INSERT INTO usertable VALUES (${placeholders})`, null, vals
+      );
+    },
+    scan: (db) => query(
+      db,
+      'SELECT * FROM usertable WHERE ycsb_key >= ? LIMIT ?',
+      null,
+      [chooseKey(), 1 + Math.floor(rand() * MAX_SCAN_LENGTH)]
+    ),
+    readModifyWrite: async (db) => {
+      const key = chooseKey();
+      await query(
+        db, 'SELECT * FROM usertable WHERE ycsb_key = ?', null, [key]
+      );
+      await query(
+        db,
+        `UPDATE usertable SET field${Math.floor(rand() * FIELD_COUNT)} = ?
+         WHERE ycsb_key = ?`,
+        null,
+        [fieldValue(rand), key]
+      );
+    },
+  };
+
+  const dbs = [];
+  for (let i = 0; i < connections; ++i) {
+    const db = new Database(path);
+    db.open();
+    await query(db, `PRAGMA busy_timeout = ${busyTimeout | 0}`);
+    dbs.push(db);
+  }
+
+  const latencies = {};
+  const errors = {};
+  for (const op of OPS)
+    latencies[op] = [];
+
+  const deadline = process.hrtime.bigint() + BigInt(durationMs) * 1000000n;
+  const loop = async (db) => {
+    while (process.hrtime.bigint() < deadline) {
+      const op = chooseOp();
+      const start = process.hrtime.bigint();
+      try {
+        await execute[op](db);
+        latencies[op].push(Number(process.hrtime.bigint() - start));
+      } catch (ex) {
+        const code = (ex.code || ex.message);
+        errors[code] = ((errors[code] || 0) + 1);
+      }
+    }
+  };
+
+  const loops = [];
+  for (const db of dbs) {
+    for (let i = 0; i < concurrency; ++i)
+      loops.push(loop(db));
+  }
+  await Promise.all(loops);
+  for (const db of dbs)
+    db.close();
+
+  return { latencies, errors };
+}
+
+// =============================================================================
+// Child process: runs a single configuration
+
+async function runConfig(config) {
+  const insertCounter = new Int32Array(new SharedArrayBuffer(4));
+  insertCounter[0] = config.inserted;
+  const results = await Promise.all(
+    Array.from({ length: config.workers }, (_, i) => new Promise((res, rej) => {
+      const worker = new Worker(__filename, {
+        workerData: { ...config, seed: config.seed + i, insertCounter },
+      });
+      worker.once('message', res);
+      worker.once('error', rej);
+    }))
+  );
+
+  const perOp = {};
+  const errors = {};
+  let ops = 0;
+  for (const op of OPS) {
+    const merged = [];
+    for (const { latencies } of results) {
+      for (const latency of latencies[op])
+        merged.push(latency);
+    }
+    if (merged.length) {
+      ops += merged.length;
+      perOp[op] = {
+        ops: merged.length,
+        opsPerSec: merged.length / (config.durationMs / 1000),
+        latencyMs: summarizeLatencies(merged),
+      };
+    }
+  }
+  for (const result of results) {
+    for (const [code, count] of Object.entries(result.errors))
+      errors[code] = ((errors[code] || 0) + count);
+  }
+  const all = [];
+  for (const { latencies } of results) {
+    for (const op of OPS) {
+      for (const latency of latencies[op])
+        all.push(latency);
+    }
+  }
+
+  return {
+    workload: config.workload,
+    threadpoolSize: +process.env.UV_THREADPOOL_SIZE,
+    workers: config.workers,
+    connectionsPerWorker: config.connections,
+    concurrencyPerConnection: config.concurrency,
+    ops,
+    opsPerSec: ops / (config.durationMs / 1000),
+    latencyMs: summarizeLatencies(all),
+    perOp,
+    errors,
+    busyErrors: Object.keys(errors)
+      .filter((code) => code.startsWith('SQLITE_BUSY'))
+      .reduce((sum, code) => sum + errors[code], 0),
+    inserted: Atomics.load(insertCounter, 0),
+  };
+}
+
+// =============================================================================
+
+const list = (val) => String(val).split(',').filter(Boolean);
+
+if (!isMainThread) {
+  runWorker(workerData).then((result) => parentPort.postMessage(result));
+} else if (process.argv[2] === '--child') {
+  runConfig(JSON.parse(process.argv[3])).then((result) => {
+    process.stdout.write(JSON.stringify(result));
+  }, (err) => {
+    console.error(err);
+    process.exitCode = 1;
+  });
+} else {
+  const opts = parseArgs(process.argv.slice(2), {
+    workloads: 'A,B,C,D,E,F',
+    records: 100000,
+    duration: 10,
+    threadpool: '4',
+    workers: '1',
+    connections: '1',
+    concurrency: 4,
+    busyTimeout: 0,
+    theta: 0.99,
+    seed: 1,
+    path: join(tmpdir(), 'esqlite-ycsb.db'),
+    out: '',
+  });
+
+  (async () => {
+    const results = [];
+    for (const workload of list(opts.workloads)) {
+      if (!WORKLOADS[workload])
+        throw new Error(`Unknown workload: ${workload}`);
+      await loadDatabase(opts.path, opts.records);
+      let inserted = 0;
+      for (const threadpool of list(opts.threadpool)) {
+        for (const workers of list(opts.workers)) {
+          for (const connections of list(opts.connections)) {
+            const config = {
+              path: opts.path,
+              workload,
+              records: opts.records,
+              inserted,
+              durationMs: opts.duration * 1000,
+              workers: +workers,
+              connections: +connections,
+              concurrency: opts.concurrency,
+              busyTimeout: opts.busyTimeout,
+              theta: opts.theta,
+              seed: opts.seed,
+            };
+            const { status, stdout } = spawnSync(
+              process.execPath,
+              [__filename, '--child', JSON.stringify(config)],
+              {
+                env: { ...process.env, UV_THREADPOOL_SIZE: threadpool },
+                stdio: ['ignore', 'pipe', 'inherit'],
+                maxBuffer: 64 * 1024 * 1024,
+              }
+            );
+            if (status !== 0)
+              throw new Error(`Benchmark child exited with code ${status}`);
+            const result = JSON.parse(stdout.toString());
+            inserted = result.inserted;
+            results.push(result);
+          }
+        }
+      }
+    }
+
+    const output = JSON.stringify({
+      meta: {
+        node: process.version,
+        records: opts.records,
+        durationSec: opts.duration,
+        busyTimeoutMs: opts.busyTimeout,
+        theta: opts.theta,
+        date: new Date().toISOString(),
+      },
+      results,
+    }, null, 2);
+    if (opts.out)
+      writeFileSync(opts.out, `${output}\n`);
+    else
+      process.stdout.write(`${output}\n`);
+  })().catch((err) => {
+    console.error(err);
+    process.exitCode = 1;
+  });
+}
@@ -1,4 +1,9 @@
 {
+  'variables': {
+    # Set to 1 (e.g. `node-gyp rebuild -- -Desqlite_benchmarks=1`) to include
+    # the native micro-benchmark entry points used by `bench/micro.js`
+    'esqlite_benchmarks%': 0,
+  },
   'targets': [
     {
       'target_name': 'esqlite3',
@@ -12,6 +17,9 @@
       ],
       'cflags': [ '-O3' ],
       'conditions': [
+        [ 'esqlite_benchmarks==1', {
+          'defines': [ 'ESQLITE_BENCHMARKS' ],
+        }],
         [ 'OS=="mac"', {
           'xcode_settings': {
             'OTHER_LDFLAGS': ['-framework Security', '-framework Foundation'],
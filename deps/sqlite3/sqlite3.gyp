@@ -20,10 +20,9 @@
         'SQLITE_OMIT_DECLTYPE',
         'SQLITE_OMIT_DEPRECATED',
         'SQLITE_OMIT_GET_TABLE',
-        'SQLITE_OMIT_PROGRESS_CALLBACK',
         'SQLITE_OMIT_SHARED_CACHE',
         'SQLITE_OMIT_TCL_VARIABLE',
-        'SQLITE_OMIT_TRACE',
+        # Tracing is not omitted, the change listener needs sqlite3_trace_v2()
         'SQLITE_OMIT_UTF16',
         'SQLITE_THREADSAFE=2',
         'SQLITE_TRACE_SIZE_LIMIT=32',
@@ -33,6 +32,8 @@
         # Defines from/for SQLite3MultipleCiphers
         'CODEC_TYPE=CODEC_TYPE_CHACHA20',
         'HAVE_CIPHER_CHACHA20=1',
+        # AES-based AEAD cipher, uses AES-NI/ARMv8 Crypto when available
+        'HAVE_CIPHER_AEGIS=1',
         'HAVE_CIPHER_AES_128_CBC=0',
         'HAVE_CIPHER_AES_256_CBC=0',
         'HAVE_CIPHER_SQLCIPHER=0',
@@ -40,8 +41,12 @@
         'SQLITE_CORE=1',
         'SQLITE_ENABLE_CSV=1',
         'SQLITE_ENABLE_EXTFUNC=1',
+        'SQLITE_ENABLE_PREUPDATE_HOOK=1',
         'SQLITE_ENABLE_REGEXP=1',
         'SQLITE_ENABLE_SERIES=1',
+        # Changesets, also needed by the binding (see below)
+        'SQLITE_ENABLE_SESSION=1',
+        'SQLITE_ENABLE_SNAPSHOT=1',
         'SQLITE_ENABLE_UUID=1',
         'SQLITE_SECURE_DELETE=1',
         'SQLITE_TEMP_STORE=2',
@@ -69,6 +74,8 @@
       'direct_dependent_settings': {
         'include_dirs': ['.'],
         'defines': [
+          # Exposes the session extension's API in the amalgamation header
+          'SQLITE_ENABLE_SESSION=1',
           # Manually-tracked custom git revision
           'SQLITE3MC_VERSION_REV=fadf5ae17bdb29a59bf2bb65b13702a4543b9937',
         ],
@@ -1,6 +1,14 @@
 'use strict';
 
-const { DBHandle, version } = require('../build/Release/esqlite3.node');
+const {
+  DBHandle,
+  aesHardwareSupported,
+  version,
+} = require('../build/Release/esqlite3.node');
+
+const { Readable, Writable } = require('stream');
+
+const { PRIORITIES, PriorityQueue } = require('./queue.js');
 
 const OPEN_FLAGS = {
   READONLY: 0x00000001,
@@ -67,6 +75,30 @@ const OPEN_FLAGS_MASK = Object.values(OPEN_FLAGS).reduce((prev, cur) => {
   return (prev | cur);
 });
 
+const CIPHERS = new Set([ 'chacha20', 'aegis' ]);
+const BUSY_RETRY_DEFAULTS = {
+  initialDelayMs: 2,
+  maxDelayMs: 100,
+  maxWaitMs: 5000,
+};
+// Thresholds are WAL sizes in pages, 0 disables escalating to that mode.
+// Escalation is opt-in because `RESTART` and `TRUNCATE` checkpoints block
+// writers while they wait for readers.
+const CHECKPOINTER_DEFAULTS = {
+  passivePages: 1000,
+  restartPages: 0,
+  truncatePages: 0,
+  busyTimeoutMs: 100,
+};
+const AES_HARDWARE = aesHardwareSupported();
+// Indexes are the native transaction (begin) types
+const TRANSACTION_MODES = [ 'deferred', 'immediate', 'exclusive' ];
+const TRANSACTION_IMMEDIATE = 1;
+const GROUP_COMMIT_DEFAULTS = {
+  windowMs: 1,
+  maxBatch: 128,
+};
+
 const PREPARE_FLAGS = {
   NO_VTAB: 0x04,
 };
@@ -78,6 +110,9 @@ const PREPARE_FLAGS_MASK = Object.values(PREPARE_FLAGS).reduce((prev, cur) => {
 const QUERY_FLAG_SINGLE = 0x01;
 const QUERY_FLAG_NAMED_PARAMS = 0x02;
 const QUERY_FLAG_ROWS_AS_ARRAY = 0x04;
+const QUERY_FLAG_NO_ROWS = 0x08;
+const QUERY_FLAG_SINGLE_ROW = 0x10;
+const QUERY_FLAG_PLUCK = 0x20;
 
 const QUERY_STATUS_COMPLETE = 0x01;
 const QUERY_STATUS_INCOMPLETE = 0x02;
@@ -102,9 +137,123 @@ const kParent = Symbol('Statement parent');
 const kAbortAll = Symbol('Query should abort all statements');
 const kResume = Symbol('Iterator should resume');
 const kAsyncIterAbort = Symbol('Async iterator break handling');
+const kSignal = Symbol('Query abort signal');
+const kGroupCommit = Symbol('Group commit options');
+const kWrites = Symbol('Pending group commit writes');
+const kExtraFlags = Symbol('Internal query flags');
+const kBlobId = Symbol('Blob handle id');
+const kClosed = Symbol('Blob is closed');
+const kPriority = Symbol('Blob I/O priority');
+const kCipher = Symbol('Database cipher');
+
+const DEFAULT_BLOB_CHUNK_SIZE = 64 * 1024;
+const BACKUP_DEFAULTS = { pagesPerStep: 100, pauseMs: 0 };
+// Indexes are the native conflict types (offset by one), values are the
+// conflict resolution actions
+const CONFLICT_TYPES = [
+  'data', 'notFound', 'conflict', 'constraint', 'foreignKey',
+];
+const CONFLICT_ACTIONS = new Map([
+  [ 'omit', 0 ], [ 'replace', 1 ], [ 'abort', 2 ],
+]);
+// Types of conflicts that may be resolved by replacing the conflicting row
+const REPLACEABLE_CONFLICTS = new Set([ 'data', 'conflict' ]);
+
+const COMBINE_OPS = new Set([ 'sum', 'count', 'min', 'max' ]);
+const DEFAULT_PARALLEL_WORKERS = (+process.env.UV_THREADPOOL_SIZE || 4);
+const INTEGER_RE = /^-?\d+$/;
 
 const ABORT_TYPES = new Set([ 'none', 'all', 'current' ]);
 
+class AbortError extends Error {
+  constructor(signal) {
+    super('The operation was aborted');
+    this.name = 'AbortError';
+    this.code = 'ABORT_ERR';
+    if (signal.reason !== undefined)
+      this.cause = signal.reason;
+  }
+}
+
+function validateSignal(signal) {
+  if (typeof signal !== 'object'
+      || signal === null
+      || typeof signal.aborted !== 'boolean'
+      || typeof signal.addEventListener !== 'function'
+      || typeof signal.removeEventListener !== 'function') {
+    throw new TypeError('Invalid signal value');
+  }
+}
+
+function validateTimeout(timeoutMs) {
+  if (!Number.isInteger(timeoutMs)
+      || timeoutMs <= 0
+      || timeoutMs > (2 ** 32 - 1)) {
+    throw new TypeError(`Invalid timeout value: ${timeoutMs}`);
+  }
+  return timeoutMs;
+}
+
+function validateTimeSlice(timeSliceMs) {
+  if (!Number.isInteger(timeSliceMs)
+      || timeSliceMs <= 0
+      || timeSliceMs > (2 ** 32 - 1)) {
+    throw new TypeError(`Invalid time slice value: ${timeSliceMs}`);
+  }
+  return timeSliceMs;
+}
+
+function validateCipher(cipher) {
+  if (typeof cipher !== 'string' || !CIPHERS.has(cipher))
+    throw new Error(`Invalid cipher: ${cipher}`);
+  if (cipher === 'aegis' && !AES_HARDWARE) {
+    throw new Error(
+      'The AEGIS cipher requires AES hardware acceleration, which is not '
+        + 'available on this CPU'
+    );
+  }
+  return cipher;
+}
+
+function validatePriority(priority) {
+  const idx = PRIORITIES.indexOf(priority);
+  if (idx === -1)
+    throw new Error(`Invalid priority: ${priority}`);
+  return idx;
+}
+
+function validateVmSteps(maxVmSteps) {
+  if (!Number.isSafeInteger(maxVmSteps) || maxVmSteps <= 0)
+    throw new TypeError(`Invalid VM step limit value: ${maxVmSteps}`);
+  return maxVmSteps;
+}
+
+// Converts named placeholder values to the flat key/value list expected by the
+// binding
+function toNamedValues(vals) {
+  const keys = Object.keys(vals);
+  const valsKV = new Array(keys.length * 2);
+  for (let k = 0, p = 0; k < keys.length; ++k, p += 2) {
+    const key = keys[k];
+    valsKV[p] = `:${key}`;
+    valsKV[p + 1] = vals[key];
+  }
+  return valsKV;
+}
+
+function attachSignal(obj, signal, onAbort) {
+  obj[kSignal] = [ signal, onAbort ];
+  signal.addEventListener('abort', onAbort);
+}
+
+function detachSignal(obj) {
+  const entry = obj[kSignal];
+  if (entry) {
+    obj[kSignal] = null;
+    entry[0].removeEventListener('abort', entry[1]);
+  }
+}
+
 const withResolvers = (() => {
   let resolve_;
   let reject_;
@@ -123,7 +272,15 @@ const withResolvers = (() => {
 })();
 
 class Statement {
-  constructor(abortType, db, sqlOrIter, prepareFlags, flags, vals) {
+  constructor(abortType,
+              db,
+              sqlOrIter,
+              prepareFlags,
+              flags,
+              vals,
+              timeoutMs,
+              maxVmSteps,
+              timeSliceMs) {
     this[kDatabase] = db;
     this[kAborting] = false;
     this[kAborter] = null;
@@ -133,7 +290,15 @@ class Statement {
     this[kSlot] = null;
     this[kIsNew] = true;
     if (typeof sqlOrIter === 'string') {
-      this[kArgs] = [ sqlOrIter, prepareFlags, flags, vals ];
+      this[kArgs] = [
+        sqlOrIter,
+        prepareFlags,
+        flags,
+        vals,
+        timeoutMs,
+        maxVmSteps,
+        timeSliceMs,
+      ];
       this[kParent] = db;
       this[kAbortAll] = true;
     } else {
@@ -143,46 +308,14 @@ class Statement {
     }
     this[kQueue] = [];
     this.colCount = undefined;
+    this.busyRetries = 0;
+    this.busyWaitMs = 0;
+    this.changes = 0;
+    this.lastInsertRowid = 0;
   }
 
   abort() {
-    if (!this[kAborter])
-      this[kAborter] = withResolvers();
-    if (this[kDone]) {
-      if (!this[kAborting])
-        this[kAborter].resolve();
-      return this[kAborter].promise;
-    }
-    this[kAborting] = true;
-    this[kError] = new Error('Statement aborted');
-    this[kDone] = true;
-    for (const { reject } of this[kQueue])
-      reject(this[kError]);
-    this[kQueue] = [];
-    if (this[kParent][kSlot] === this) {
-      if (!this[kDatabase][kBusy]) {
-        const onDoneAborting = () => {
-          this[kDatabase][kBusy] = false;
-          this[kAborter].resolve();
-          this[kParent][kSlot] = null;
-          processQueue(this[kDatabase]);
-        };
-        const active = this[kDatabase][kHandle].abort(
-          this[kAbortAll],
-          onDoneAborting
-        );
-        if (active)
-          this[kDatabase][kBusy] = true;
-        else
-          onDoneAborting();
-      }
-    } else {
-      const idx = this[kParent][kQueue].indexOf(this);
-      if (idx !== -1)
-        this[kParent][kQueue].splice(idx, 1);
-      this[kAborter].resolve();
-    }
-    return this[kAborter].promise;
+    return abortStatement(this, new Error('Statement aborted'), false);
   }
 
   execute(n) {
@@ -270,15 +403,73 @@ class Statement {
   }
 }
 
+function abortStatement(stmt, err, interrupt) {
+  if (!stmt[kAborter])
+    stmt[kAborter] = withResolvers();
+  if (stmt[kDone]) {
+    if (!stmt[kAborting])
+      stmt[kAborter].resolve();
+    return stmt[kAborter].promise;
+  }
+  detachSignal(stmt);
+  stmt[kAborting] = true;
+  stmt[kError] = err;
+  stmt[kDone] = true;
+  for (const { reject } of stmt[kQueue])
+    reject(stmt[kError]);
+  stmt[kQueue] = [];
+  const db = stmt[kDatabase];
+  if (stmt[kParent][kSlot] === stmt) {
+    if (!db[kBusy]) {
+      const onDoneAborting = () => {
+        db[kBusy] = false;
+        stmt[kAborter].resolve();
+        stmt[kParent][kSlot] = null;
+        processQueue(db);
+      };
+      const active = db[kHandle].abort(stmt[kAbortAll], onDoneAborting);
+      if (active)
+        db[kBusy] = true;
+      else
+        onDoneAborting();
+    } else if (interrupt && stmt[kSlot]) {
+      // Stop the statement that is currently executing instead of waiting for
+      // it to produce its rows
+      db[kHandle].interrupt();
+    }
+  } else {
+    const queue = stmt[kParent][kQueue];
+    if (queue === db[kQueue]) {
+      queue.remove(stmt);
+    } else {
+      const idx = queue.indexOf(stmt);
+      if (idx !== -1)
+        queue.splice(idx, 1);
+    }
+    stmt[kAborter].resolve();
+  }
+  return stmt[kAborter].promise;
+}
+
 class StatementIterator {
-  constructor(abortType, db, sql, prepareFlags, flags, vals) {
+  constructor(abortType,
+              db,
+              sql,
+              prepareFlags,
+              flags,
+              vals,
+              timeoutMs,
+              maxVmSteps,
+              timeSliceMs) {
     this[kDatabase] = db;
     this[kAborting] = false;
     this[kAborter] = null;
     this[kAsyncIterAbort] = abortType;
     this[kDone] = false;
     this[kSlot] = null;
-    this[kArgs] = [ sql, prepareFlags, flags, vals ];
+    this[kArgs] = [
+      sql, prepareFlags, flags, vals, timeoutMs, maxVmSteps, timeSliceMs,
+    ];
     this[kQueue] = [];
     this[kResume] = false;
     this[kAbortAll] = true;
@@ -320,9 +511,7 @@ class StatementIterator {
           onDoneAborting();
       }
     } else {
-      const idx = this[kDatabase][kQueue].indexOf(this);
-      if (idx !== -1)
-        this[kDatabase][kQueue].splice(idx, 1);
+      this[kDatabase][kQueue].remove(this);
       this[kAborter].resolve();
     }
     return await this[kAborter].promise;
@@ -374,10 +563,584 @@ class StatementIterator {
   }
 }
 
+// Work that occupies a single queue entry and is executed natively as a single
+// unit of work on the threadpool. `start` is passed the database handle and the
+// completion callback.
+class NativeJob {
+  constructor(start, cb) {
+    this.start = start;
+    this.cb = cb;
+  }
+}
+
+function queueJob(db, start, priority, cb) {
+  db[kQueue].push(new NativeJob(start, cb), priority);
+  if (!db[kSlot])
+    processQueue(db);
+}
+
+// Queues a native blob I/O operation using the blob's priority
+function blobJob(blob, start) {
+  const { promise, resolve, reject } = withResolvers();
+  queueJob(blob[kDatabase], start, blob[kPriority], (err, result) => {
+    if (err)
+      reject(err);
+    else
+      resolve(result);
+  });
+  return promise;
+}
+
+function getSnapshotOptions(opts) {
+  let dbName = 'main';
+  let priority;
+  if (typeof opts === 'object' && opts !== null) {
+    if (opts.db !== undefined) {
+      if (typeof opts.db !== 'string')
+        throw new TypeError('Invalid db value');
+      dbName = opts.db;
+    }
+    if (opts.priority !== undefined)
+      priority = validatePriority(opts.priority);
+  }
+  return { dbName, priority };
+}
+
+// Runs `sql` for each partition on its own reader connection, with all readers
+// pinned to the same snapshot of `db`. If no snapshot can be taken because
+// nothing has been written to the WAL yet, `db` holds the write lock instead
+// while every reader starts its read transaction, so that they all see the same
+// state as well.
+async function runParallelQuery(db, sql, opts) {
+  const { partitionBy, workers, combine, values, key } = opts;
+  const readers = [];
+  let ranges;
+
+  const openReader = async (snapshot) => {
+    const reader = new Database(db[kPath]);
+    reader.open(OPEN_FLAGS.READONLY, { cipher: db[kCipher] });
+    readers.push(reader);
+    if (key)
+      await reader.run(`PRAGMA hexkey = '${key.toString('hex')}'`);
+    if (snapshot)
+      await reader.openSnapshot(snapshot);
+    else
+      await reader.exec('BEGIN; PRAGMA schema_version');
+    return reader;
+  };
+
+  // The partition ranges are determined by the first reader, so that they
+  // match the snapshot all partitions see
+  const openReaders = async (snapshot) => {
+    const column = `"${partitionBy.replace(/"/g, '""')}"`;
+    const table = `"${opts.table.replace(/"/g, '""')}"`;
+    const bounds = await (await openReader(snapshot)).get(
+      `SELECT min(${column}) AS lo, max(${column}) AS hi FROM ${table}`
+    );
+    ranges = getPartitionRanges(bounds.lo, bounds.hi, workers);
+    while (readers.length < ranges.length)
+      await openReader(snapshot);
+  };
+
+  try {
+    // Take the snapshot on `db` and keep its queue blocked until every reader
+    // holds the snapshot itself, so that none of the caller's own queries end
+    // up in the read transaction that is started for it
+    await new Promise((resolve, reject) => {
+      queueJob(db, (handle, cb) => {
+        const began = handle.autoCommitEnabled();
+        const start = (snapshot) => {
+          openReaders(snapshot).then(() => null, (err) => err).then((err) => {
+            if (!began)
+              return cb(err);
+            handle.exec('COMMIT', (commitErr) => cb(err || commitErr));
+          });
+        };
+        handle.snapshotGet('main', (err, snapshot) => {
+          if (!err)
+            return start(snapshot);
+          if (err.code !== 'SNAPSHOT_WAL_EMPTY' || !began)
+            return cb(err);
+          // No commit can happen while the write lock is held
+          handle.exec('BEGIN IMMEDIATE', (err) => {
+            if (err)
+              return cb(err);
+            start(null);
+          });
+        });
+      }, undefined, (err) => {
+        if (err)
+          reject(err);
+        else
+          resolve();
+      });
+    });
+
+    // Wait for every partition, even after a failure, so that no reader is
+    // still in use when it is closed
+    const settled = await Promise.all(ranges.map(([start, end], i) => {
+      return queryWithFlags(
+        readers[i],
+        sql,
+        { values: { ...values, start, end } },
+        undefined,
+        0,
+        getRows
+      ).then((rows) => ({ rows }), (err) => ({ err }));
+    }));
+    const results = [];
+    for (const { rows, err } of settled) {
+      if (err)
+        throw err;
+      results.push(rows);
+    }
+    return (combine ? combineRows(results, combine) : [].concat(...results));
+  } finally {
+    for (const reader of readers) {
+      try {
+        reader.close();
+      } catch {
+        // Never mask the actual result or error
+      }
+    }
+  }
+}
+
+// Splits the integer range [lo, hi] into at most `count` half-open ranges of
+// (nearly) equal size
+function getPartitionRanges(lo, hi, count) {
+  if (lo === null || hi === null)
+    return [ [ 0, 0 ] ];
+  if (!INTEGER_RE.test(lo) || !INTEGER_RE.test(hi))
+    throw new Error('Partitioning column must contain integers');
+  lo = BigInt(lo);
+  hi = BigInt(hi) + BigInt(1);
+  const span = hi - lo;
+  if (span < BigInt(count))
+    count = Number(span);
+  const ranges = [];
+  let start = lo;
+  for (let i = 1; i <= count; ++i) {
+    const end = (i === count ? hi : lo + (span * BigInt(i)) / BigInt(count));
+    ranges.push([ start, end ]);
+    start = end;
+  }
+  return ranges;
+}
+
+// Merges the rows of all partitions. Columns named in `combine` are combined
+// with their operation, all other columns are treated as grouping keys.
+function combineRows(results, combine) {
+  const groups = new Map();
+  for (const rows of results) {
+    for (const row of rows) {
+      const groupKey = JSON.stringify(
+        Object.keys(row).filter((name) => !combine.has(name))
+                        .map((name) => row[name])
+      );
+      const group = groups.get(groupKey);
+      if (group === undefined) {
+        groups.set(groupKey, { ...row });
+        continue;
+      }
+      for (const [name, op] of combine) {
+        if (name in row)
+          group[name] = combineValue(op, group[name], row[name]);
+      }
+    }
+  }
+  return Array.from(groups.values());
+}
+
+function combineValue(op, a, b) {
+  if (a === null)
+    return b;
+  if (b === null)
+    return a;
+  switch (op) {
+    case 'sum':
+    case 'count':
+      // 64-bit integers are returned as strings, so add them exactly
+      if (isIntegerString(a) && isIntegerString(b))
+        return `${BigInt(a) + BigInt(b)}`;
+      return +a + +b;
+    case 'min':
+      return (compareValues(b, a) < 0 ? b : a);
+    case 'max':
+      return (compareValues(b, a) > 0 ? b : a);
+  }
+}
+
+function isIntegerString(val) {
+  return (typeof val === 'string' && INTEGER_RE.test(val));
+}
+
+// Compares two result values the way SQLite orders them: NULLs first, then
+// numbers (including integers returned as strings), then other values
+function compareValues(a, b) {
+  if (a === b)
+    return 0;
+  if (a === null || a === undefined)
+    return -1;
+  if (b === null || b === undefined)
+    return 1;
+  if (isIntegerString(a) && isIntegerString(b)) {
+    const x = BigInt(a);
+    const y = BigInt(b);
+    return (x < y ? -1 : (x > y ? 1 : 0));
+  }
+  const aNum = (typeof a === 'number' || isIntegerString(a));
+  const bNum = (typeof b === 'number' || isIntegerString(b));
+  if (aNum && bNum) {
+    a = +a;
+    b = +b;
+  } else if (aNum !== bNum) {
+    return (aNum ? -1 : 1);
+  } else if (Buffer.isBuffer(a) && Buffer.isBuffer(b)) {
+    return Buffer.compare(a, b);
+  }
+  return (a < b ? -1 : (a > b ? 1 : 0));
+}
+
+// 32-bit FNV-1a hash of a shard key
+function hashKey(key) {
+  const buf = (Buffer.isBuffer(key) ? key : Buffer.from(String(key)));
+  let hash = 0x811C9DC5;
+  for (let i = 0; i < buf.length; ++i)
+    hash = Math.imul(hash ^ buf[i], 0x01000193);
+  return (hash >>> 0);
+}
+
+// Merges rows that are each already sorted by `orderBy` into a single sorted
+// array of at most `limit` rows, using a binary heap of per-shard cursors
+function mergeSortedRows(results, orderBy, limit) {
+  const compareRows = (a, b) => {
+    for (const [column, desc] of orderBy) {
+      const cmp = compareValues(a[column], b[column]);
+      if (cmp !== 0)
+        return (desc ? -cmp : cmp);
+    }
+    return 0;
+  };
+  // Ties are broken by shard index to keep the merge stable
+  const less = (x, y) => {
+    const cmp = compareRows(results[x.shard][x.idx], results[y.shard][y.idx]);
+    return (cmp < 0 || (cmp === 0 && x.shard < y.shard));
+  };
+  const siftDown = (heap, i) => {
+    for (;;) {
+      const left = (2 * i + 1);
+      const right = (left + 1);
+      let min = i;
+      if (left < heap.length && less(heap[left], heap[min]))
+        min = left;
+      if (right < heap.length && less(heap[right], heap[min]))
+        min = right;
+      if (min === i)
+        return;
+      const tmp = heap[i];
+      heap[i] = heap[min];
+      heap[min] = tmp;
+      i = min;
+    }
+  };
+
+  const heap = [];
+  for (let shard = 0; shard < results.length; ++shard) {
+    if (results[shard].length)
+      heap.push({ shard, idx: 0 });
+  }
+  for (let i = (heap.length >>> 1) - 1; i >= 0; --i)
+    siftDown(heap, i);
+
+  const rows = [];
+  while (heap.length && rows.length < limit) {
+    const top = heap[0];
+    rows.push(results[top.shard][top.idx]);
+    if (++top.idx === results[top.shard].length) {
+      const last = heap.pop();
+      if (heap.length === 0)
+        break;
+      heap[0] = last;
+    }
+    siftDown(heap, 0);
+  }
+  return rows;
+}
+
+function validateBlobOffset(offset, size) {
+  if (!Number.isInteger(offset) || offset < 0 || offset > size)
+    throw new RangeError(`Invalid blob offset: ${offset}`);
+  return offset;
+}
+
+// An open handle for incremental I/O on a single blob value. The size of the
+// value is fixed for as long as the handle is open.
+class Blob {
+  constructor(db, id, size, writable, priority) {
+    this[kDatabase] = db;
+    this[kBlobId] = id;
+    this[kClosed] = false;
+    this[kPriority] = priority;
+    this.size = size;
+    this.writable = writable;
+  }
+
+  read(offset, length) {
+    validateBlobOffset(offset, this.size);
+    if (length === undefined) {
+      length = this.size - offset;
+    } else {
+      if (!Number.isInteger(length) || length < 0)
+        throw new RangeError(`Invalid blob read length: ${length}`);
+      length = Math.min(length, this.size - offset);
+    }
+    if (this[kClosed])
+      return Promise.reject(new Error('Blob is closed'));
+    const id = this[kBlobId];
+    return blobJob(this, (handle, cb) => {
+      handle.blobRead(id, offset, length, cb);
+    });
+  }
+
+  write(offset, data) {
+    validateBlobOffset(offset, this.size);
+    if (!Buffer.isBuffer(data))
+      throw new TypeError('Invalid blob data value');
+    if (!this.writable)
+      return Promise.reject(new Error('Blob is not writable'));
+    if (this[kClosed])
+      return Promise.reject(new Error('Blob is closed'));
+    const id = this[kBlobId];
+    return blobJob(this, (handle, cb) => {
+      handle.blobWrite(id, offset, data, cb);
+    });
+  }
+
+  close() {
+    if (this[kClosed])
+      return Promise.resolve();
+    this[kClosed] = true;
+    const id = this[kBlobId];
+    return blobJob(this, (handle, cb) => {
+      handle.blobClose(id, cb);
+    });
+  }
+
+  createReadStream(opts) {
+    return new BlobReadStream(this, opts);
+  }
+
+  createWriteStream(opts) {
+    if (!this.writable)
+      throw new Error('Blob is not writable');
+    return new BlobWriteStream(this, opts);
+  }
+}
+
+function getStreamOptions(opts) {
+  let start = 0;
+  let end;
+  let autoClose = true;
+  let highWaterMark = DEFAULT_BLOB_CHUNK_SIZE;
+  if (typeof opts === 'object' && opts !== null) {
+    if (opts.start !== undefined)
+      start = opts.start;
+    if (opts.end !== undefined)
+      end = opts.end;
+    if (opts.autoClose !== undefined)
+      autoClose = !!opts.autoClose;
+    if (opts.highWaterMark !== undefined)
+      highWaterMark = opts.highWaterMark;
+  }
+  return { start, end, autoClose, highWaterMark };
+}
+
+// Reads a range of a blob in chunks of (at most) `highWaterMark` bytes
+class BlobReadStream extends Readable {
+  constructor(blob, opts) {
+    const { start, end, autoClose, highWaterMark } = getStreamOptions(opts);
+    super({ highWaterMark });
+    validateBlobOffset(start, blob.size);
+    let stop = blob.size;
+    if (end !== undefined) {
+      if (!Number.isInteger(end) || end < start)
+        throw new RangeError(`Invalid blob stream end: ${end}`);
+      // Like `fs.createReadStream()`, `end` is inclusive
+      stop = Math.min(end + 1, blob.size);
+    }
+    this.blob = blob;
+    this.pos = start;
+    this.end = stop;
+    this.autoClose = autoClose;
+  }
+
+  _read(n) {
+    const length = Math.min(n, this.end - this.pos);
+    if (length <= 0) {
+      if (!this.autoClose)
+        return this.push(null);
+      this.blob.close().then(() => this.push(null), (err) => this.destroy(err));
+      return;
+    }
+    this.blob.read(this.pos, length).then((data) => {
+      this.pos += data.length;
+      this.push(data);
+    }, (err) => this.destroy(err));
+  }
+
+  _destroy(err, cb) {
+    if (!this.autoClose)
+      return cb(err);
+    this.blob.close().then(() => cb(err), (closeErr) => cb(err || closeErr));
+  }
+}
+
+// Overwrites a blob sequentially, starting at `start`. The blob cannot grow,
+// so writing past its end fails.
+class BlobWriteStream extends Writable {
+  constructor(blob, opts) {
+    const { start, autoClose, highWaterMark } = getStreamOptions(opts);
+    super({ highWaterMark });
+    validateBlobOffset(start, blob.size);
+    this.blob = blob;
+    this.pos = start;
+    this.autoClose = autoClose;
+  }
+
+  _write(chunk, encoding, cb) {
+    this.blob.write(this.pos, chunk).then(() => {
+      this.pos += chunk.length;
+      cb();
+    }, cb);
+  }
+
+  _final(cb) {
+    if (!this.autoClose)
+      return cb();
+    this.blob.close().then(() => cb(), cb);
+  }
+
+  _destroy(err, cb) {
+    if (!this.autoClose)
+      return cb(err);
+    this.blob.close().then(() => cb(err), (closeErr) => cb(err || closeErr));
+  }
+}
+
+// Records changes made to (some of) the tables of a database, see
+// `Database#createSession()`
+class Session {
+  constructor(db, id, priority) {
+    this[kDatabase] = db;
+    this[kHandle] = id;
+    this[kClosed] = false;
+    this[kPriority] = priority;
+  }
+
+  changeset() {
+    return sessionJob(this, false);
+  }
+
+  patchset() {
+    return sessionJob(this, true);
+  }
+
+  close() {
+    if (this[kClosed])
+      return Promise.resolve();
+    this[kClosed] = true;
+    const id = this[kHandle];
+    const { promise, resolve, reject } = withResolvers();
+    queueJob(this[kDatabase], (handle, cb) => {
+      handle.sessionDelete(id, cb);
+    }, this[kPriority], (err) => {
+      if (err)
+        reject(err);
+      else
+        resolve();
+    });
+    return promise;
+  }
+}
+
+function sessionJob(session, patchset) {
+  if (session[kClosed])
+    return Promise.reject(new Error('Session is closed'));
+  const id = session[kHandle];
+  const { promise, resolve, reject } = withResolvers();
+  queueJob(session[kDatabase], (handle, cb) => {
+    handle.sessionChangeset(id, patchset, cb);
+  }, session[kPriority], (err, buf) => {
+    if (err)
+      reject(err);
+    else
+      resolve(buf);
+  });
+  return promise;
+}
+
+// Converts an `onConflict` policy into the action for each conflict type
+function getConflictActions(onConflict) {
+  if (typeof onConflict === 'string') {
+    if (!CONFLICT_ACTIONS.has(onConflict))
+      throw new Error(`Invalid onConflict value: ${onConflict}`);
+    return CONFLICT_TYPES.map((type) => {
+      if (onConflict === 'replace' && !REPLACEABLE_CONFLICTS.has(type))
+        return CONFLICT_ACTIONS.get('omit');
+      return CONFLICT_ACTIONS.get(onConflict);
+    });
+  }
+  if (typeof onConflict !== 'object' || onConflict === null)
+    throw new TypeError(`Invalid onConflict value: ${onConflict}`);
+  return CONFLICT_TYPES.map((type) => {
+    const action = onConflict[type];
+    if (action === undefined)
+      return CONFLICT_ACTIONS.get('abort');
+    if (!CONFLICT_ACTIONS.has(action)
+        || (action === 'replace' && !REPLACEABLE_CONFLICTS.has(type))) {
+      throw new Error(`Invalid onConflict.${type} value: ${action}`);
+    }
+    return CONFLICT_ACTIONS.get(action);
+  });
+}
+
+function makeBatchItem(sql, vals, flags) {
+  if (vals && !Array.isArray(vals)) {
+    if (typeof vals === 'object' && vals !== null) {
+      flags |= QUERY_FLAG_NAMED_PARAMS;
+      vals = toNamedValues(vals);
+    } else {
+      throw new TypeError('Invalid query placeholder values type');
+    }
+  }
+  return [ sql, flags, vals ];
+}
+
+function runJob(db, job) {
+  const cb = (err, result) => {
+    db[kBusy] = false;
+    db[kSlot] = null;
+    job.cb(err, result);
+    processQueue(db);
+  };
+  try {
+    job.start(db[kHandle], cb);
+  } catch (ex) {
+    process.nextTick(() => {
+      db[kSlot] = null;
+      job.cb(ex);
+      processQueue(db);
+    });
+    return;
+  }
+  db[kBusy] = true;
+}
+
 function processQueue(db) {
   let current = db[kSlot];
   if (current) {
-    if (Array.isArray(current))
+    if (Array.isArray(current) || current instanceof NativeJob)
       return;
     if (current[kAborting]) {
       // Either an iterator or an independent statement is aborting
@@ -404,7 +1167,14 @@ function processQueue(db) {
           stmt[kArgs] = null;
           try {
             db[kHandle].query(
-              args[0], args[1], args[2], args[3], stmt[kSlot].n
+              args[0],
+              args[1],
+              args[2],
+              args[3],
+              stmt[kSlot].n,
+              args[4],
+              args[5],
+              args[6]
             );
           } catch (ex) {
             process.nextTick(
@@ -446,7 +1216,14 @@ function processQueue(db) {
           iter[kArgs] = null;
           try {
             db[kHandle].query(
-              args[0], args[1], args[2], args[3], stmt[kSlot].n
+              args[0],
+              args[1],
+              args[2],
+              args[3],
+              stmt[kSlot].n,
+              args[4],
+              args[5],
+              args[6]
             );
           } catch (ex) {
             process.nextTick(
@@ -467,7 +1244,10 @@ function processQueue(db) {
     db[kSlot] = current = db[kQueue].shift();
     if (Array.isArray(current)) {
       try {
-        db[kHandle].query(current[0], current[1], current[2], current[3], 0);
+        db[kHandle].query(
+          current[0], current[1], current[2], current[3], 0, current[4],
+          current[5], current[6]
+        );
       } catch (ex) {
         process.nextTick(
           () => statusCallback.call(db, QUERY_STATUS_ERROR, true, ex)
@@ -475,6 +1255,8 @@ function processQueue(db) {
         return;
       }
       db[kBusy] = true;
+    } else if (current instanceof NativeJob) {
+      runJob(db, current);
     } else if (current[kParent]) {
       // Independent statement
       const stmt = current;
@@ -483,7 +1265,16 @@ function processQueue(db) {
         const args = stmt[kArgs];
         stmt[kArgs] = null;
         try {
-          db[kHandle].query(args[0], args[1], args[2], args[3], stmt[kSlot].n);
+          db[kHandle].query(
+            args[0],
+            args[1],
+            args[2],
+            args[3],
+            stmt[kSlot].n,
+            args[4],
+            args[5],
+            args[6]
+          );
         } catch (ex) {
           process.nextTick(
             () => statusCallback.call(db, QUERY_STATUS_ERROR, true, ex)
@@ -540,7 +1331,9 @@ class Database {
     this[kBuffer] = [ undefined, undefined ];
     this[kBusy] = false;
     this[kSlot] = null;
-    this[kQueue] = [];
+    this[kQueue] = new PriorityQueue();
+    this[kGroupCommit] = { ...GROUP_COMMIT_DEFAULTS };
+    this[kWrites] = null;
     this[kHandle] = new DBHandle(
       makeRows,
       makeRowObjFn,
@@ -554,13 +1347,322 @@ class Database {
     this[kHandle].db = this;
   }
 
-  open(flags) {
+  static fromBuffer(buf, opts) {
+    if (!Buffer.isBuffer(buf))
+      throw new TypeError('Invalid buffer value');
+
+    let readonly = false;
+    if (typeof opts === 'object' && opts !== null) {
+      if (opts.readonly === true)
+        readonly = true;
+    }
+
+    const db = new Database(':memory:');
+    db.open();
+    const { promise, resolve, reject } = withResolvers();
+    queueJob(db, (handle, cb) => {
+      handle.deserialize('main', buf, readonly, cb);
+    }, undefined, (err) => {
+      if (err) {
+        db.close();
+        reject(err);
+      } else {
+        resolve(db);
+      }
+    });
+    return promise;
+  }
+
+  open(flags, opts) {
+    if (typeof flags === 'object' && flags !== null) {
+      opts = flags;
+      flags = undefined;
+    }
     if (typeof flags !== 'number')
       flags = DEFAULT_OPEN_FLAGS;
     else
       flags &= OPEN_FLAGS_MASK;
-    this[kHandle].open(this[kPath], flags);
+
+    let cipher;
+    let busyRetry;
+    let checkpointer;
+    if (typeof opts === 'object' && opts !== null) {
+      if (opts.cipher !== undefined)
+        cipher = validateCipher(opts.cipher);
+
+      if (opts.priorityAgingMs !== undefined) {
+        const val = opts.priorityAgingMs;
+        if (!Number.isInteger(val) || val < 0)
+          throw new TypeError(`Invalid priorityAgingMs value: ${val}`);
+        this[kQueue].agingMs = val;
+      }
+
+      if (opts.groupCommit !== undefined) {
+        const cfg = opts.groupCommit;
+        if (typeof cfg !== 'object' || cfg === null)
+          throw new TypeError(`Invalid groupCommit value: ${cfg}`);
+        const { windowMs, maxBatch } = cfg;
+        if (windowMs !== undefined) {
+          if (!Number.isInteger(windowMs)
+              || windowMs < 0
+              || windowMs > (2 ** 31 - 1)) {
+            throw new TypeError(
+              `Invalid groupCommit.windowMs value: ${windowMs}`
+            );
+          }
+          this[kGroupCommit].windowMs = windowMs;
+        }
+        if (maxBatch !== undefined) {
+          if (!Number.isInteger(maxBatch) || maxBatch <= 0) {
+            throw new TypeError(
+              `Invalid groupCommit.maxBatch value: ${maxBatch}`
+            );
+          }
+          this[kGroupCommit].maxBatch = maxBatch;
+        }
+      }
+
+      const cfg = opts.busyRetry;
+      if (cfg === true) {
+        busyRetry = BUSY_RETRY_DEFAULTS;
+      } else if (typeof cfg === 'object' && cfg !== null) {
+        busyRetry = { ...BUSY_RETRY_DEFAULTS };
+        for (const key of Object.keys(BUSY_RETRY_DEFAULTS)) {
+          const val = cfg[key];
+          if (val === undefined)
+            continue;
+          if (!Number.isInteger(val) || val <= 0 || val > (2 ** 32 - 1))
+            throw new TypeError(`Invalid busyRetry.${key} value: ${val}`);
+          busyRetry[key] = val;
+        }
+      } else if (cfg !== undefined && cfg !== false) {
+        throw new TypeError(`Invalid busyRetry value: ${cfg}`);
+      }
+
+      const ckptCfg = opts.checkpointer;
+      if (ckptCfg === true) {
+        checkpointer = CHECKPOINTER_DEFAULTS;
+      } else if (typeof ckptCfg === 'object' && ckptCfg !== null) {
+        checkpointer = { ...CHECKPOINTER_DEFAULTS };
+        for (const key of Object.keys(CHECKPOINTER_DEFAULTS)) {
+          const val = ckptCfg[key];
+          if (val === undefined)
+            continue;
+          const min = (key === 'passivePages' ? 1 : 0);
+          if (!Number.isInteger(val) || val < min || val > (2 ** 31 - 1))
+            throw new TypeError(`Invalid checkpointer.${key} value: ${val}`);
+          checkpointer[key] = val;
+        }
+        if (typeof ckptCfg.key === 'string')
+          checkpointer.key = Buffer.from(ckptCfg.key);
+        else if (Buffer.isBuffer(ckptCfg.key))
+          checkpointer.key = ckptCfg.key;
+        else if (ckptCfg.key !== undefined)
+          throw new TypeError('Invalid checkpointer.key value');
+      } else if (ckptCfg !== undefined && ckptCfg !== false) {
+        throw new TypeError(`Invalid checkpointer value: ${ckptCfg}`);
+      }
+    }
+
+    this[kHandle].open(this[kPath], flags, cipher);
+    this[kCipher] = cipher;
     this[kAutoClose] = false;
+    if (busyRetry) {
+      this[kHandle].busyRetry(
+        busyRetry.initialDelayMs,
+        busyRetry.maxDelayMs,
+        busyRetry.maxWaitMs
+      );
+    } else {
+      this[kHandle].busyRetry(0, 0, 0);
+    }
+    if (checkpointer) {
+      try {
+        this[kHandle].startCheckpointer(
+          checkpointer.key,
+          checkpointer.passivePages,
+          checkpointer.restartPages,
+          checkpointer.truncatePages,
+          checkpointer.busyTimeoutMs
+        );
+      } catch (ex) {
+        this[kHandle].close();
+        throw ex;
+      }
+    }
+  }
+
+  checkpointStats() {
+    return this[kHandle].checkpointStats();
+  }
+
+  createSession(tables, opts) {
+    if (tables !== undefined && tables !== null) {
+      if (!Array.isArray(tables)
+          || !tables.every((table) => typeof table === 'string')) {
+        throw new TypeError('Invalid tables value');
+      }
+    } else {
+      tables = null;
+    }
+
+    let dbName = 'main';
+    let priority;
+    if (typeof opts === 'object' && opts !== null) {
+      if (opts.db !== undefined) {
+        if (typeof opts.db !== 'string')
+          throw new TypeError('Invalid db value');
+        dbName = opts.db;
+      }
+      if (opts.priority !== undefined)
+        priority = validatePriority(opts.priority);
+    }
+
+    const { promise, resolve, reject } = withResolvers();
+    queueJob(this, (handle, cb) => {
+      handle.sessionCreate(dbName, tables, cb);
+    }, priority, (err, id) => {
+      if (err)
+        reject(err);
+      else
+        resolve(new Session(this, id, priority));
+    });
+    return promise;
+  }
+
+  applyChangeset(changeset, opts) {
+    if (!Buffer.isBuffer(changeset))
+      throw new TypeError('Invalid changeset value');
+
+    let actions = getConflictActions('abort');
+    let priority;
+    if (typeof opts === 'object' && opts !== null) {
+      if (opts.onConflict !== undefined)
+        actions = getConflictActions(opts.onConflict);
+      if (opts.priority !== undefined)
+        priority = validatePriority(opts.priority);
+    }
+
+    const { promise, resolve, reject } = withResolvers();
+    queueJob(this, (handle, cb) => {
+      handle.applyChangeset(changeset, actions, cb);
+    }, priority, (err, counts) => {
+      if (err)
+        return reject(err);
+      const conflicts = {};
+      for (let i = 0; i < CONFLICT_TYPES.length; ++i)
+        conflicts[CONFLICT_TYPES[i]] = counts[i];
+      resolve({ conflicts });
+    });
+    return promise;
+  }
+
+  setChangeListener(listener) {
+    if (listener !== null && typeof listener !== 'function')
+      throw new TypeError('Invalid listener value');
+
+    // The hooks are (un)installed from the queue so that the connection is
+    // not in use on the threadpool at that moment
+    const { promise, resolve, reject } = withResolvers();
+    queueJob(this, (handle, cb) => {
+      handle.setChangeListener(listener);
+      process.nextTick(cb, null);
+    }, undefined, (err) => {
+      if (err)
+        reject(err);
+      else
+        resolve();
+    });
+    return promise;
+  }
+
+  snapshot(opts) {
+    const { dbName, priority } = getSnapshotOptions(opts);
+    const { promise, resolve, reject } = withResolvers();
+    queueJob(this, (handle, cb) => {
+      handle.snapshotGet(dbName, cb);
+    }, priority, (err, snapshot) => {
+      if (err)
+        reject(err);
+      else
+        resolve(snapshot);
+    });
+    return promise;
+  }
+
+  openSnapshot(snapshot, opts) {
+    if (!Buffer.isBuffer(snapshot))
+      throw new TypeError('Invalid snapshot value');
+
+    const { dbName, priority } = getSnapshotOptions(opts);
+    const { promise, resolve, reject } = withResolvers();
+    queueJob(this, (handle, cb) => {
+      handle.snapshotOpen(dbName, snapshot, cb);
+    }, priority, (err) => {
+      if (err)
+        reject(err);
+      else
+        resolve();
+    });
+    return promise;
+  }
+
+  parallelQuery(sql, opts) {
+    if (typeof sql !== 'string')
+      throw new TypeError('Invalid sql value');
+    if (!/:start\b/.test(sql) || !/:end\b/.test(sql))
+      throw new Error('sql must use the :start and :end parameters');
+    if (typeof opts !== 'object' || opts === null)
+      throw new TypeError('Invalid options value');
+    if (typeof opts.table !== 'string')
+      throw new TypeError('Invalid table value');
+
+    let partitionBy = 'rowid';
+    let workers = DEFAULT_PARALLEL_WORKERS;
+    let combine = null;
+    let values = {};
+    let key;
+    if (opts.partitionBy !== undefined) {
+      if (typeof opts.partitionBy !== 'string')
+        throw new TypeError('Invalid partitionBy value');
+      partitionBy = opts.partitionBy;
+    }
+    if (opts.workers !== undefined) {
+      if (!Number.isInteger(opts.workers) || opts.workers < 1)
+        throw new TypeError(`Invalid workers value: ${opts.workers}`);
+      workers = opts.workers;
+    }
+    if (opts.combine !== undefined && opts.combine !== null) {
+      if (typeof opts.combine !== 'object')
+        throw new TypeError('Invalid combine value');
+      combine = new Map();
+      for (const column of Object.keys(opts.combine)) {
+        const op = opts.combine[column];
+        if (!COMBINE_OPS.has(op))
+          throw new Error(`Invalid combine.${column} value: ${op}`);
+        combine.set(column, op);
+      }
+    }
+    if (opts.values !== undefined) {
+      if (typeof opts.values !== 'object' || opts.values === null)
+        throw new TypeError('Invalid values value');
+      values = opts.values;
+    }
+    if (typeof opts.key === 'string')
+      key = Buffer.from(opts.key);
+    else if (Buffer.isBuffer(opts.key))
+      key = opts.key;
+    else if (opts.key !== undefined)
+      throw new TypeError('Invalid key value');
+
+    return runParallelQuery(this, sql, {
+      table: opts.table,
+      partitionBy,
+      workers,
+      combine,
+      values,
+      key,
+    });
   }
 
   queryAsync(sql, opts, vals) {
@@ -570,6 +1672,11 @@ class Database {
     let prepareFlags = DEFAULT_PREPARE_FLAGS;
     let flags = QUERY_FLAG_SINGLE;
     let abortType = 'all';
+    let signal;
+    let timeoutMs;
+    let maxVmSteps;
+    let timeSliceMs;
+    let priority;
     if (Array.isArray(opts)) {
       // query(sql, vals)
       vals = opts;
@@ -585,29 +1692,54 @@ class Database {
         }
         abortType = opts.abortType;
       }
+      if (opts.signal !== undefined) {
+        validateSignal(opts.signal);
+        signal = opts.signal;
+      }
       if (opts.values !== undefined)
         vals = opts.values;
       if (opts.rowsAsArray === true)
         flags |= QUERY_FLAG_ROWS_AS_ARRAY;
+      if (opts.timeoutMs !== undefined)
+        timeoutMs = validateTimeout(opts.timeoutMs);
+      if (opts.maxVmSteps !== undefined)
+        maxVmSteps = validateVmSteps(opts.maxVmSteps);
+      if (opts.timeSliceMs !== undefined)
+        timeSliceMs = validateTimeSlice(opts.timeSliceMs);
+      if (opts.priority !== undefined)
+        priority = validatePriority(opts.priority);
     }
     if (vals && !Array.isArray(vals)) {
       if (typeof vals === 'object' && vals !== null) {
         flags |= QUERY_FLAG_NAMED_PARAMS;
-        const keys = Object.keys(vals);
-        const valsKV = new Array(keys.length * 2);
-        for (let k = 0, p = 0; k < keys.length; ++k, p += 2) {
-          const key = keys[k];
-          valsKV[p] = `:${key}`;
-          valsKV[p + 1] = vals[key];
-        }
-        vals = valsKV;
+        vals = toNamedValues(vals);
       } else {
         throw new TypeError('Invalid query placeholder values type');
       }
     }
 
-    const stmt = new Statement(abortType, this, sql, prepareFlags, flags, vals);
-    this[kQueue].push(stmt);
+    const stmt = new Statement(
+      abortType,
+      this,
+      sql,
+      prepareFlags,
+      flags,
+      vals,
+      timeoutMs,
+      maxVmSteps,
+      timeSliceMs
+    );
+    if (signal) {
+      if (signal.aborted) {
+        stmt[kError] = new AbortError(signal);
+        stmt[kDone] = true;
+        return stmt;
+      }
+      attachSignal(stmt, signal, () => {
+        abortStatement(stmt, new AbortError(signal), true);
+      });
+    }
+    this[kQueue].push(stmt, priority);
     if (!this[kSlot])
       processQueue(this);
     return stmt;
@@ -620,6 +1752,10 @@ class Database {
     let prepareFlags = DEFAULT_PREPARE_FLAGS;
     let flags = 0;
     let abortType = 'all';
+    let timeoutMs;
+    let maxVmSteps;
+    let timeSliceMs;
+    let priority;
     if (Array.isArray(opts)) {
       // query(sql, vals)
       vals = opts;
@@ -639,27 +1775,36 @@ class Database {
         vals = opts.values;
       if (opts.rowsAsArray === true)
         flags |= QUERY_FLAG_ROWS_AS_ARRAY;
+      if (opts.timeoutMs !== undefined)
+        timeoutMs = validateTimeout(opts.timeoutMs);
+      if (opts.maxVmSteps !== undefined)
+        maxVmSteps = validateVmSteps(opts.maxVmSteps);
+      if (opts.timeSliceMs !== undefined)
+        timeSliceMs = validateTimeSlice(opts.timeSliceMs);
+      if (opts.priority !== undefined)
+        priority = validatePriority(opts.priority);
     }
     if (vals && !Array.isArray(vals)) {
       if (typeof vals === 'object' && vals !== null) {
         flags |= QUERY_FLAG_NAMED_PARAMS;
-        const keys = Object.keys(vals);
-        const valsKV = new Array(keys.length * 2);
-        for (let k = 0, p = 0; k < keys.length; ++k, p += 2) {
-          const key = keys[k];
-          valsKV[p] = `:${key}`;
-          valsKV[p + 1] = vals[key];
-        }
-        vals = valsKV;
+        vals = toNamedValues(vals);
       } else {
         throw new TypeError('Invalid query placeholder values type');
       }
     }
 
     const iter = new StatementIterator(
-      abortType, this, sql, prepareFlags, flags, vals
+      abortType,
+      this,
+      sql,
+      prepareFlags,
+      flags,
+      vals,
+      timeoutMs,
+      maxVmSteps,
+      timeSliceMs
     );
-    this[kQueue].push(iter);
+    this[kQueue].push(iter, priority);
     if (!this[kSlot])
       processQueue(this);
     return iter;
@@ -671,6 +1816,11 @@ class Database {
 
     let prepareFlags = DEFAULT_PREPARE_FLAGS;
     let flags = QUERY_FLAG_SINGLE;
+    let signal;
+    let timeoutMs;
+    let maxVmSteps;
+    let timeSliceMs;
+    let priority;
     if (typeof opts === 'function') {
       // query(sql, cb)
       cb = opts;
@@ -689,6 +1839,20 @@ class Database {
         flags &= ~QUERY_FLAG_SINGLE;
       if (opts.rowsAsArray === true)
         flags |= QUERY_FLAG_ROWS_AS_ARRAY;
+      if (opts.signal !== undefined) {
+        validateSignal(opts.signal);
+        signal = opts.signal;
+      }
+      if (opts.timeoutMs !== undefined)
+        timeoutMs = validateTimeout(opts.timeoutMs);
+      if (opts.maxVmSteps !== undefined)
+        maxVmSteps = validateVmSteps(opts.maxVmSteps);
+      if (opts.timeSliceMs !== undefined)
+        timeSliceMs = validateTimeSlice(opts.timeSliceMs);
+      if (opts.priority !== undefined)
+        priority = validatePriority(opts.priority);
+      if (opts[kExtraFlags] !== undefined)
+        flags |= opts[kExtraFlags];
       if (typeof vals === 'function') {
         cb = vals;
         vals = undefined;
@@ -699,14 +1863,7 @@ class Database {
     if (vals && !Array.isArray(vals)) {
       if (typeof vals === 'object' && vals !== null) {
         flags |= QUERY_FLAG_NAMED_PARAMS;
-        const keys = Object.keys(vals);
-        const valsKV = new Array(keys.length * 2);
-        for (let k = 0, p = 0; k < keys.length; ++k, p += 2) {
-          const key = keys[k];
-          valsKV[p] = `:${key}`;
-          valsKV[p + 1] = vals[key];
-        }
-        vals = valsKV;
+        vals = toNamedValues(vals);
       } else {
         throw new TypeError('Invalid query placeholder values type');
       }
@@ -715,11 +1872,290 @@ class Database {
     if (typeof cb !== 'function')
       cb = null;
 
-    this[kQueue].push([sql, prepareFlags, flags, vals, cb]);
+    const entry = [
+      sql, prepareFlags, flags, vals, timeoutMs, maxVmSteps, timeSliceMs, cb,
+    ];
+    if (signal) {
+      if (signal.aborted) {
+        if (cb) {
+          const err = new AbortError(signal);
+          process.nextTick(() => cb(err));
+        }
+        return;
+      }
+      attachSignal(entry, signal, () => abortQuery(this, entry, signal));
+    }
+    this[kQueue].push(entry, priority);
     if (!this[kSlot])
       processQueue(this);
   }
 
+  run(sql, opts, vals) {
+    return queryWithFlags(
+      this, sql, opts, vals, QUERY_FLAG_NO_ROWS, getRunResult
+    );
+  }
+
+  get(sql, opts, vals) {
+    return queryWithFlags(
+      this, sql, opts, vals, QUERY_FLAG_SINGLE_ROW, getFirstRow
+    );
+  }
+
+  pluck(sql, opts, vals) {
+    return queryWithFlags(this, sql, opts, vals, QUERY_FLAG_PLUCK, getRows);
+  }
+
+  querySync(sql, opts, vals) {
+    return querySync(this, sql, opts, vals, 0);
+  }
+
+  serialize(schema, opts) {
+    if (typeof schema === 'object' && schema !== null) {
+      opts = schema;
+      schema = undefined;
+    }
+    if (schema === undefined)
+      schema = 'main';
+    else if (typeof schema !== 'string')
+      throw new TypeError('Invalid schema value');
+
+    let priority;
+    if (typeof opts === 'object' && opts !== null) {
+      if (opts.priority !== undefined)
+        priority = validatePriority(opts.priority);
+    }
+
+    const { promise, resolve, reject } = withResolvers();
+    queueJob(this, (handle, cb) => {
+      handle.serialize(schema, cb);
+    }, priority, (err, buf) => {
+      if (err)
+        reject(err);
+      else
+        resolve(buf);
+    });
+    return promise;
+  }
+
+  backup(destPath, opts) {
+    if (typeof destPath !== 'string')
+      throw new TypeError('Invalid destination path value');
+
+    let dbName = 'main';
+    let { pagesPerStep, pauseMs } = BACKUP_DEFAULTS;
+    let cipher = '';
+    let key;
+    let priority;
+    let progress;
+    if (typeof opts === 'object' && opts !== null) {
+      if (opts.db !== undefined) {
+        if (typeof opts.db !== 'string')
+          throw new TypeError('Invalid db value');
+        dbName = opts.db;
+      }
+      if (opts.pagesPerStep !== undefined) {
+        pagesPerStep = opts.pagesPerStep;
+        if (!Number.isInteger(pagesPerStep) || pagesPerStep < 1
+            || pagesPerStep > (2 ** 31 - 1)) {
+          throw new RangeError(`Invalid pagesPerStep value: ${pagesPerStep}`);
+        }
+      }
+      if (opts.pauseMs !== undefined) {
+        pauseMs = opts.pauseMs;
+        if (!Number.isInteger(pauseMs) || pauseMs < 0)
+          throw new RangeError(`Invalid pauseMs value: ${pauseMs}`);
+      }
+      if (opts.cipher !== undefined)
+        cipher = validateCipher(opts.cipher);
+      if (opts.key !== undefined) {
+        if (typeof opts.key === 'string')
+          key = Buffer.from(opts.key);
+        else if (Buffer.isBuffer(opts.key))
+          key = opts.key;
+        else
+          throw new TypeError('Invalid key value');
+      }
+      if (opts.priority !== undefined)
+        priority = validatePriority(opts.priority);
+      if (opts.progress !== undefined) {
+        if (typeof opts.progress !== 'function')
+          throw new TypeError('Invalid progress value');
+        progress = opts.progress;
+      }
+    }
+
+    const { promise, resolve, reject } = withResolvers();
+    const finish = (id, err, pageCount) => {
+      queueJob(this, (handle, cb) => {
+        handle.backupFinish(id, cb);
+      }, priority, (finishErr) => {
+        if (err || finishErr)
+          reject(err || finishErr);
+        else
+          resolve({ pageCount });
+      });
+    };
+    queueJob(this, (handle, cb) => {
+      handle.backupInit(destPath, dbName, cipher, key, cb);
+    }, priority, (err, id) => {
+      if (err)
+        return reject(err);
+      // Every step is queued separately, so queries queued in the meantime
+      // are executed in between steps
+      const step = () => {
+        queueJob(this, (handle, cb) => {
+          handle.backupStep(id, pagesPerStep, cb);
+        }, priority, (err, result) => {
+          if (err)
+            return finish(id, err);
+          const [ done, remaining, pageCount ] = result;
+          if (progress)
+            progress({ remaining, pageCount });
+          if (done)
+            finish(id, null, pageCount);
+          else if (pauseMs > 0)
+            setTimeout(step, pauseMs);
+          else
+            step();
+        });
+      };
+      step();
+    });
+    return promise;
+  }
+
+  openBlob(table, column, rowid, opts) {
+    if (typeof table !== 'string')
+      throw new TypeError('Invalid table value');
+    if (typeof column !== 'string')
+      throw new TypeError('Invalid column value');
+    if (!Number.isInteger(rowid) && typeof rowid !== 'bigint')
+      throw new TypeError(`Invalid rowid value: ${rowid}`);
+
+    let dbName = 'main';
+    let writable = false;
+    let priority;
+    if (typeof opts === 'object' && opts !== null) {
+      if (opts.db !== undefined) {
+        if (typeof opts.db !== 'string')
+          throw new TypeError('Invalid db value');
+        dbName = opts.db;
+      }
+      if (opts.write === true)
+        writable = true;
+      if (opts.priority !== undefined)
+        priority = validatePriority(opts.priority);
+    }
+
+    const { promise, resolve, reject } = withResolvers();
+    queueJob(this, (handle, cb) => {
+      handle.blobOpen(dbName, table, column, rowid, writable, cb);
+    }, priority, (err, result) => {
+      if (err)
+        reject(err);
+      else
+        resolve(new Blob(this, result[0], result[1], writable, priority));
+    });
+    return promise;
+  }
+
+  getSync(sql, opts, vals) {
+    return querySync(this, sql, opts, vals, QUERY_FLAG_SINGLE_ROW)[0];
+  }
+
+  exec(sql, opts) {
+    if (typeof sql !== 'string')
+      throw new TypeError('Invalid sql value');
+
+    let priority;
+    if (typeof opts === 'object' && opts !== null) {
+      if (opts.priority !== undefined)
+        priority = validatePriority(opts.priority);
+    }
+
+    const { promise, resolve, reject } = withResolvers();
+    queueJob(this, (handle, cb) => {
+      handle.exec(sql, cb);
+    }, priority, (err) => {
+      if (err)
+        reject(err);
+      else
+        resolve();
+    });
+    return promise;
+  }
+
+  write(sql, vals) {
+    if (typeof sql !== 'string')
+      throw new TypeError('Invalid sql value');
+
+    const item =
+      makeBatchItem(sql, vals, QUERY_FLAG_SINGLE | QUERY_FLAG_NO_ROWS);
+
+    let pending = this[kWrites];
+    if (!pending) {
+      pending = this[kWrites] = {
+        items: [],
+        resolvers: [],
+        timer: setTimeout(flushWrites, this[kGroupCommit].windowMs, this),
+      };
+    }
+    const entry = withResolvers();
+    pending.items.push(item);
+    pending.resolvers.push(entry);
+    if (pending.items.length >= this[kGroupCommit].maxBatch)
+      flushWrites(this);
+    return entry.promise;
+  }
+
+  transaction(statements, opts) {
+    if (!Array.isArray(statements))
+      throw new TypeError('Invalid statements value');
+
+    let beginType = 0;
+    let flags = QUERY_FLAG_SINGLE;
+    let priority;
+    if (typeof opts === 'object' && opts !== null) {
+      if (opts.mode !== undefined) {
+        beginType = TRANSACTION_MODES.indexOf(opts.mode);
+        if (beginType === -1)
+          throw new Error(`Invalid transaction mode: ${opts.mode}`);
+      }
+      if (opts.rowsAsArray === true)
+        flags |= QUERY_FLAG_ROWS_AS_ARRAY;
+      if (opts.priority !== undefined)
+        priority = validatePriority(opts.priority);
+    }
+
+    const items = new Array(statements.length);
+    for (let i = 0; i < statements.length; ++i) {
+      const stmt = statements[i];
+      let sql;
+      let vals;
+      if (typeof stmt === 'string') {
+        sql = stmt;
+      } else if (typeof stmt === 'object' && stmt !== null) {
+        sql = stmt.sql;
+        vals = stmt.params;
+      }
+      if (typeof sql !== 'string')
+        throw new TypeError(`Invalid statement at index ${i}`);
+      items[i] = makeBatchItem(sql, vals, flags);
+    }
+
+    const { promise, resolve, reject } = withResolvers();
+    queueJob(this, (handle, cb) => {
+      handle.batch(items, beginType, true, cb);
+    }, priority, (err, results) => {
+      if (err)
+        reject(err);
+      else
+        resolve(results);
+    });
+    return promise;
+  }
+
   limit(type, newLimit) {
     if (!Number.isInteger(type))
       throw new TypeError(`Invalid limit type value: ${type}`);
@@ -737,10 +2173,13 @@ class Database {
   }
 
   interrupt(cb) {
-    this[kHandle].interrupt(() => {
-      if (typeof cb === 'function')
-        cb();
-    });
+    this[kHandle].interrupt();
+    if (typeof cb === 'function')
+      process.nextTick(cb);
+  }
+
+  queueStats() {
+    return this[kQueue].stats();
   }
 
   autoCommitEnabled() {
@@ -748,6 +2187,7 @@ class Database {
   }
 
   end() {
+    flushWrites(this);
     if (this[kSlot] || this[kQueue].length)
       this[kAutoClose] = true;
     else
@@ -756,9 +2196,248 @@ class Database {
 
   close() {
     this[kHandle].close();
+    const pending = this[kWrites];
+    if (pending) {
+      this[kWrites] = null;
+      clearTimeout(pending.timer);
+      const err = new Error('Database closed');
+      for (const { reject } of pending.resolvers)
+        reject(err);
+    }
   }
 }
 
+// Spreads rows over several database files, each with its own connection (and
+// therefore its own writer). Writes are routed to a single shard by the hash
+// of a key, reads are run on all shards concurrently and their rows merged.
+class ShardedDatabase {
+  constructor(paths, authorizer) {
+    if (!Array.isArray(paths)
+        || paths.length === 0
+        || !paths.every((path) => typeof path === 'string')) {
+      throw new TypeError('Invalid paths value');
+    }
+    this.shards = paths.map((path) => new Database(path, authorizer));
+  }
+
+  open(flags, opts) {
+    const opened = [];
+    try {
+      for (const shard of this.shards) {
+        shard.open(flags, opts);
+        opened.push(shard);
+      }
+    } catch (ex) {
+      for (const shard of opened)
+        shard.close();
+      throw ex;
+    }
+  }
+
+  close() {
+    for (const shard of this.shards)
+      shard.close();
+  }
+
+  end() {
+    for (const shard of this.shards)
+      shard.end();
+  }
+
+  shardFor(key) {
+    if (key === undefined || key === null)
+      throw new TypeError('Invalid key value');
+    return this.shards[hashKey(key) % this.shards.length];
+  }
+
+  // Executes `sql` on every shard (e.g. to create the schema)
+  exec(sql, opts) {
+    return Promise.all(this.shards.map((shard) => shard.exec(sql, opts)));
+  }
+
+  run(key, sql, opts, vals) {
+    return this.shardFor(key).run(sql, opts, vals);
+  }
+
+  write(key, sql, vals) {
+    return this.shardFor(key).write(sql, vals);
+  }
+
+  transaction(key, statements, opts) {
+    return this.shardFor(key).transaction(statements, opts);
+  }
+
+  query(sql, opts, vals) {
+    if (typeof sql !== 'string')
+      throw new TypeError('Invalid sql value');
+    if (Array.isArray(opts)) {
+      vals = opts;
+      opts = undefined;
+    }
+
+    let orderBy;
+    let limit = Infinity;
+    if (typeof opts === 'object' && opts !== null) {
+      if (opts.orderBy !== undefined)
+        orderBy = getOrderBy(opts.orderBy);
+      if (opts.limit !== undefined) {
+        if (!Number.isInteger(opts.limit) || opts.limit < 0)
+          throw new TypeError(`Invalid limit value: ${opts.limit}`);
+        limit = opts.limit;
+      }
+    }
+
+    return Promise.all(this.shards.map((shard) => {
+      return queryWithFlags(shard, sql, opts, vals, 0, getRows);
+    })).then((results) => {
+      if (orderBy)
+        return mergeSortedRows(results, orderBy, limit);
+      const rows = [].concat(...results);
+      return (rows.length > limit ? rows.slice(0, limit) : rows);
+    });
+  }
+
+  get(sql, opts, vals) {
+    if (Array.isArray(opts)) {
+      vals = opts;
+      opts = undefined;
+    }
+    return this.query(sql, { ...opts, limit: 1 }, vals).then(getFirstRow);
+  }
+}
+
+// Normalizes an `orderBy` option into an array of [column, descending] pairs
+function getOrderBy(orderBy) {
+  if (!Array.isArray(orderBy))
+    orderBy = [ orderBy ];
+  if (orderBy.length === 0)
+    throw new TypeError('Invalid orderBy value');
+  return orderBy.map((term) => {
+    if (typeof term === 'string' || typeof term === 'number')
+      return [ term, false ];
+    if (typeof term === 'object' && term !== null
+        && (typeof term.column === 'string'
+            || typeof term.column === 'number')) {
+      return [ term.column, term.desc === true ];
+    }
+    throw new TypeError(`Invalid orderBy term: ${term}`);
+  });
+}
+
+// Queues all writes collected so far as one transaction
+function flushWrites(db) {
+  const pending = db[kWrites];
+  if (!pending)
+    return;
+  db[kWrites] = null;
+  clearTimeout(pending.timer);
+  const { items, resolvers } = pending;
+  queueJob(db, (handle, cb) => {
+    // Writes are acknowledged once they are committed, which would not be the
+    // case inside a transaction someone else may still roll back
+    if (!handle.autoCommitEnabled()) {
+      const err = new Error(
+        'Cannot group commit writes while a transaction is open'
+      );
+      err.code = 'TRANSACTION_OPEN';
+      throw err;
+    }
+    handle.batch(items, TRANSACTION_IMMEDIATE, false, cb);
+  }, undefined, (err, results) => {
+    for (let i = 0; i < resolvers.length; ++i) {
+      const result = (err || results[i]);
+      if (result instanceof Error)
+        resolvers[i].reject(result);
+      else
+        resolvers[i].resolve(result);
+    }
+  });
+}
+
+// Executes a query using the callback API with additional query flags and
+// returns a promise for the value returned by `getResult(rows, metrics)`. For
+// multiple statements, the rows of the last statement are used.
+function queryWithFlags(db, sql, opts, vals, extraFlags, getResult) {
+  if (Array.isArray(opts)) {
+    vals = opts;
+    opts = undefined;
+  }
+  opts = { ...opts, [kExtraFlags]: extraFlags };
+  const { promise, resolve, reject } = withResolvers();
+  db.query(sql, opts, vals, (err, rows, metrics) => {
+    if (Array.isArray(err)) {
+      err = err.find((e) => e !== null);
+      rows = rows[rows.length - 1];
+    }
+    if (err)
+      reject(err);
+    else
+      resolve(getResult(rows, metrics));
+  });
+  return promise;
+}
+
+// Executes the first statement in `sql` on the calling thread
+function querySync(db, sql, opts, vals, extraFlags) {
+  if (typeof sql !== 'string')
+    throw new TypeError('Invalid sql value');
+  if (db[kSlot] || db[kQueue].length) {
+    throw new Error(
+      'Cannot execute synchronously while asynchronous requests are active'
+    );
+  }
+
+  let prepareFlags = DEFAULT_PREPARE_FLAGS;
+  let flags = (QUERY_FLAG_SINGLE | extraFlags);
+  if (Array.isArray(opts)) {
+    vals = opts;
+  } else if (typeof opts === 'object' && opts !== null) {
+    if (typeof opts.prepareFlags === 'number')
+      prepareFlags = (opts.prepareFlags & PREPARE_FLAGS_MASK);
+    if (opts.rowsAsArray === true)
+      flags |= QUERY_FLAG_ROWS_AS_ARRAY;
+    if (opts.values !== undefined)
+      vals = opts.values;
+  }
+  const item = makeBatchItem(sql, vals, flags);
+  return db[kHandle].querySync(item[0], prepareFlags, item[1], item[2]);
+}
+
+function getRunResult(rows, metrics) {
+  return {
+    changes: metrics.changes,
+    lastInsertRowid: metrics.lastInsertRowid,
+    totalChanges: metrics.totalChanges,
+  };
+}
+
+function getFirstRow(rows) {
+  return (rows ? rows[0] : undefined);
+}
+
+function getRows(rows) {
+  return rows;
+}
+
+// Aborts a callback API query
+function abortQuery(db, entry, signal) {
+  detachSignal(entry);
+  const err = new AbortError(signal);
+  if (db[kSlot] === entry) {
+    // The query is currently executing (or waiting for a thread), the abort is
+    // reported once the native side is done with it, unless it finished anyway
+    entry[kError] = err;
+    if (db[kBusy])
+      db[kHandle].interrupt();
+    return;
+  }
+  // Still queued, so no native resources have been allocated yet
+  db[kQueue].remove(entry);
+  const cb = entry[entry.length - 1];
+  if (cb)
+    cb(err);
+}
+
 function makeRowObjFn() {
   let code = 'return {';
   for (let i = 0; i < arguments.length; ++i)
@@ -785,14 +2464,68 @@ function makeRows(pos, rowFn, ...data) {
     this[pos++] = rowFn(data, i);
 }
 
-function statusCallback(status, lastStmt, data, colCount) {
+function makeMetrics(busyRetries,
+                     busyWaitMs,
+                     changes,
+                     lastInsertRowid,
+                     totalChanges) {
+  return {
+    busyRetries: (busyRetries || 0),
+    busyWaitMs: (busyWaitMs || 0),
+    changes: (changes || 0),
+    lastInsertRowid: (lastInsertRowid || 0),
+    totalChanges: (totalChanges || 0),
+  };
+}
+
+function statusCallback(status,
+                        lastStmt,
+                        data,
+                        colCount,
+                        busyRetries,
+                        busyWaitMs,
+                        changes,
+                        lastInsertRowid,
+                        totalChanges) {
   const db = (this.db || this);
   db[kBusy] = false;
   const current = db[kSlot];
   if (Array.isArray(current)) {
     // Callback API
+    if (current[kError]
+        && lastStmt
+        && (status !== QUERY_STATUS_ERROR
+            || data.code !== 'SQLITE_INTERRUPT')) {
+      // The abort came too late to stop the (last) statement, so report what
+      // actually happened instead
+      current[kError] = undefined;
+    }
+    if (current[kError]) {
+      // Aborted while executing, skip any remaining statements
+      db[kBuffer][0] = undefined;
+      db[kBuffer][1] = undefined;
+      const onDoneAborting = () => {
+        db[kBusy] = false;
+        db[kSlot] = null;
+        const cb = current[current.length - 1];
+        if (cb)
+          cb(current[kError]);
+        processQueue(db);
+      };
+      if (!lastStmt && db[kHandle].abort(true, onDoneAborting))
+        db[kBusy] = true;
+      else
+        onDoneAborting();
+      return;
+    }
     const cb = current[current.length - 1];
     if (cb) {
+      let metrics = null;
+      if (lastStmt) {
+        metrics = makeMetrics(
+          busyRetries, busyWaitMs, changes, lastInsertRowid, totalChanges
+        );
+      }
       const errs = db[kBuffer][0];
       const sets = db[kBuffer][1];
       if (status === QUERY_STATUS_DONE) {
@@ -800,9 +2533,9 @@ function statusCallback(status, lastStmt, data, colCount) {
         db[kBuffer][0] = undefined;
         db[kBuffer][1] = undefined;
         if (!sets)
-          cb(null);
+          cb(null, undefined, metrics);
         else
-          cb(errs, sets);
+          cb(errs, sets, metrics);
       } else if (status === QUERY_STATUS_COMPLETE) {
         const rows = (data || []);
 
@@ -810,11 +2543,11 @@ function statusCallback(status, lastStmt, data, colCount) {
           db[kBuffer][0] = undefined;
           db[kBuffer][1] = undefined;
           if (!sets) {
-            cb(null, rows);
+            cb(null, rows, metrics);
           } else {
             errs.push(null);
             sets.push(rows);
-            cb(errs, sets);
+            cb(errs, sets, metrics);
           }
         } else if (!sets) {
           db[kBuffer][0] = [null];
@@ -828,11 +2561,11 @@ function statusCallback(status, lastStmt, data, colCount) {
           db[kBuffer][0] = undefined;
           db[kBuffer][1] = undefined;
           if (!errs) {
-            cb(data);
+            cb(data, undefined, metrics);
           } else {
             errs.push(data);
             sets.push(undefined);
-            cb(errs, sets);
+            cb(errs, sets, metrics);
           }
         } else if (!errs) {
           db[kBuffer][0] = [data];
@@ -845,11 +2578,16 @@ function statusCallback(status, lastStmt, data, colCount) {
     }
     if (!lastStmt)
       return this.query();
+    detachSignal(current);
   } else if (current[kParent]) {
     // Statement
     const stmt = current;
     if (stmt.colCount === undefined)
       stmt.colCount = colCount;
+    if (busyRetries) {
+      stmt.busyRetries = busyRetries;
+      stmt.busyWaitMs = busyWaitMs;
+    }
     if (status === QUERY_STATUS_INCOMPLETE) {
       stmt[kSlot].resolve(data || []);
       stmt[kSlot] = null;
@@ -857,6 +2595,7 @@ function statusCallback(status, lastStmt, data, colCount) {
       return;
     }
     stmt[kDone] = true;
+    detachSignal(stmt);
     if (status === QUERY_STATUS_DONE) {
       // Implies `lastStmt === true`
       stmt[kSlot].resolve();
@@ -864,24 +2603,34 @@ function statusCallback(status, lastStmt, data, colCount) {
       for (const entry of stmt[kQueue])
         entry.resolve();
     } else if (status === QUERY_STATUS_COMPLETE) {
+      stmt.changes = changes;
+      stmt.lastInsertRowid = lastInsertRowid;
       stmt[kSlot].resolve(data);
       stmt[kSlot] = null;
       for (const entry of stmt[kQueue])
         entry.resolve();
     } else if (status === QUERY_STATUS_ERROR) {
-      stmt[kError] = data;
-      stmt[kSlot].reject(data);
+      // Report the abort reason instead of the interruption it caused
+      if (!stmt[kAborting] || data.code !== 'SQLITE_INTERRUPT')
+        stmt[kError] = data;
+      stmt[kSlot].reject(stmt[kError]);
       stmt[kSlot] = null;
       for (const entry of stmt[kQueue])
-        entry.reject(data);
+        entry.reject(stmt[kError]);
     }
     stmt[kQueue] = [];
+    if (stmt[kAborting])
+      stmt[kAborter].resolve();
   } else {
     // Iterator
     const iter = current;
     const stmt = iter[kSlot];
     if (stmt.colCount === undefined)
       stmt.colCount = colCount;
+    if (busyRetries) {
+      stmt.busyRetries = busyRetries;
+      stmt.busyWaitMs = busyWaitMs;
+    }
     if (status === QUERY_STATUS_INCOMPLETE) {
       stmt[kSlot].resolve(data || []);
       stmt[kSlot] = null;
@@ -896,6 +2645,8 @@ function statusCallback(status, lastStmt, data, colCount) {
       for (const entry of stmt[kQueue])
         entry.resolve();
     } else if (status === QUERY_STATUS_COMPLETE) {
+      stmt.changes = changes;
+      stmt.lastInsertRowid = lastInsertRowid;
       stmt[kSlot].resolve(data);
       stmt[kSlot] = null;
       for (const entry of stmt[kQueue])
@@ -925,9 +2676,11 @@ function statusCallback(status, lastStmt, data, colCount) {
 
 module.exports = {
   Database,
+  ShardedDatabase,
   OPEN_FLAGS: { ...OPEN_FLAGS },
   PREPARE_FLAGS: { ...PREPARE_FLAGS },
   ACTION_CODES,
   LIMITS,
+  AES_HARDWARE,
   version: version(),
 };
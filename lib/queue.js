@@ -0,0 +1,168 @@
+'use strict';
+
+const { performance } = require('perf_hooks');
+
+// Growable FIFO ring buffer. Unlike `Array.prototype.shift()`, removing from
+// the front is always O(1) and never moves the remaining items.
+class RingBuffer {
+  constructor(capacity) {
+    // Capacity is kept a power of two so that indexes can be masked
+    let size = 16;
+    while (size < capacity)
+      size *= 2;
+    this.items = new Array(size);
+    this.mask = size - 1;
+    this.head = 0;
+    this.length = 0;
+  }
+
+  push(item) {
+    if (this.length === this.items.length)
+      this.grow();
+    this.items[(this.head + this.length) & this.mask] = item;
+    ++this.length;
+  }
+
+  peek() {
+    return (this.length ? this.items[this.head] : undefined);
+  }
+
+  shift() {
+    if (this.length === 0)
+      return undefined;
+    const item = this.items[this.head];
+    this.items[this.head] = undefined;
+    this.head = ((this.head + 1) & this.mask);
+    --this.length;
+    return item;
+  }
+
+  // Removes the item at the logical position `idx`
+  removeAt(idx) {
+    const item = this.items[(this.head + idx) & this.mask];
+    for (let i = idx; i < this.length - 1; ++i) {
+      this.items[(this.head + i) & this.mask] =
+        this.items[(this.head + i + 1) & this.mask];
+    }
+    this.items[(this.head + this.length - 1) & this.mask] = undefined;
+    --this.length;
+    return item;
+  }
+
+  indexOf(item) {
+    for (let i = 0; i < this.length; ++i) {
+      if (this.items[(this.head + i) & this.mask] === item)
+        return i;
+    }
+    return -1;
+  }
+
+  grow() {
+    const items = new Array(this.items.length * 2);
+    for (let i = 0; i < this.length; ++i)
+      items[i] = this.items[(this.head + i) & this.mask];
+    this.items = items;
+    this.mask = items.length - 1;
+    this.head = 0;
+  }
+}
+
+const PRIORITIES = [ 'high', 'normal', 'low' ];
+const DEFAULT_PRIORITY = 1;
+const DEFAULT_AGING_MS = 500;
+
+// Multi-level FIFO queue. Items are served from the highest priority lane
+// first, except that an item is promoted by one level for every `agingMs` it
+// has spent waiting, so that lower priority lanes cannot be starved.
+class PriorityQueue {
+  constructor(agingMs) {
+    this.agingMs = (agingMs === undefined ? DEFAULT_AGING_MS : agingMs);
+    this.lanes = [];
+    for (let i = 0; i < PRIORITIES.length; ++i) {
+      this.lanes.push({
+        items: new RingBuffer(),
+        // Enqueue times, kept in lockstep with `items`
+        times: new RingBuffer(),
+        served: 0,
+        totalWaitMs: 0,
+        maxWaitMs: 0,
+      });
+    }
+    this.length = 0;
+  }
+
+  push(item, priority) {
+    if (priority === undefined)
+      priority = DEFAULT_PRIORITY;
+    const lane = this.lanes[priority];
+    lane.items.push(item);
+    lane.times.push(performance.now());
+    ++this.length;
+  }
+
+  shift() {
+    if (this.length === 0)
+      return undefined;
+
+    const now = performance.now();
+    let best = -1;
+    let bestLevel = Infinity;
+    for (let i = 0; i < this.lanes.length; ++i) {
+      const lane = this.lanes[i];
+      if (lane.items.length === 0)
+        continue;
+      let level = i;
+      if (this.agingMs > 0 && i > 0)
+        level -= Math.floor((now - lane.times.peek()) / this.agingMs);
+      if (level < bestLevel) {
+        best = i;
+        bestLevel = level;
+      }
+    }
+
+    const lane = this.lanes[best];
+    const waitMs = (now - lane.times.shift());
+    ++lane.served;
+    lane.totalWaitMs += waitMs;
+    if (waitMs > lane.maxWaitMs)
+      lane.maxWaitMs = waitMs;
+    --this.length;
+    return lane.items.shift();
+  }
+
+  remove(item) {
+    for (const lane of this.lanes) {
+      const idx = lane.items.indexOf(item);
+      if (idx !== -1) {
+        lane.items.removeAt(idx);
+        lane.times.removeAt(idx);
+        --this.length;
+        return true;
+      }
+    }
+    return false;
+  }
+
+  stats() {
+    const now = performance.now();
+    const stats = {};
+    for (let i = 0; i < this.lanes.length; ++i) {
+      const lane = this.lanes[i];
+      const oldest = lane.times.peek();
+      stats[PRIORITIES[i]] = {
+        depth: lane.items.length,
+        oldestWaitMs: (oldest === undefined ? 0 : now - oldest),
+        served: lane.served,
+        meanWaitMs: (lane.served ? lane.totalWaitMs / lane.served : 0),
+        maxWaitMs: lane.maxWaitMs,
+      };
+    }
+    return stats;
+  }
+}
+
+module.exports = {
+  PRIORITIES,
+  PriorityQueue,
+  RingBuffer,
+};
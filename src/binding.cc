@@ -1,11 +1,22 @@
 #include <node.h>
 #include <node_buffer.h>
 #include <nan.h>
+#include <atomic>
 #include <unordered_map>
 #include <unordered_set>
 #ifdef _MSC_VER
 # include <malloc.h>
 #endif
+#if defined(__x86_64__) || defined(__i386__)
+# include <cpuid.h>
+#elif defined(_M_X64) || defined(_M_IX86)
+# include <intrin.h>
+#elif defined(__aarch64__) && defined(__linux__)
+# include <sys/auxv.h>
+# ifndef HWCAP_AES
+#  define HWCAP_AES (1 << 3)
+# endif
+#endif
 
 #include <sqlite3mc_amalgamation.h>
 
@@ -19,6 +30,9 @@ enum QueryFlag : uint32_t {
   SingleStatement = 0x01,
   NamedParams = 0x02,
   RowsAsArray = 0x04,
+  NoRows = 0x08,
+  SingleRow = 0x10,
+  Pluck = 0x20,
 };
 
 enum StatementStatus : uint8_t {
@@ -29,6 +43,12 @@ enum StatementStatus : uint8_t {
   Done = 0x04,
 };
 
+enum class QueryLimit : uint8_t {
+  None,
+  Timeout,
+  VMSteps
+};
+
 enum class BindParamsType : uint8_t {
   None,
   Numeric,
@@ -105,6 +125,50 @@ class ExtString : public String::ExternalOneByteStringResource {
   size_t len_;
 };
 
+// Converts a value collected on the threadpool into its JS equivalent. For
+// strings and blobs, ownership of the underlying memory is taken over by this
+// function.
+static inline Local<Value> row_value_to_js(RowValue& rv) {
+  switch (rv.type) {
+    case ValueType::Null:
+      return Nan::Null();
+    case ValueType::StringEmpty:
+      return Nan::EmptyString();
+    case ValueType::BlobEmpty:
+      return Nan::NewBuffer(0).ToLocalChecked();
+    case ValueType::Blob:
+      // Transfers ownership
+      return Nan::NewBuffer(
+        static_cast<char*>(rv.val),
+        rv.len
+#ifdef _MSC_VER
+        ,
+        free_blob,
+        nullptr
+#endif
+      ).ToLocalChecked();
+    default: {
+      char* raw = static_cast<char*>(rv.val);
+      size_t len = rv.len;
+      if (len < EXTERN_APEX) {
+        // Makes copy
+        Local<Value> val = Nan::New(raw, len).ToLocalChecked();
+        free(raw);
+        return val;
+      }
+      // Uses reference to existing memory
+      return Nan::New(new ExtString(raw, len)).ToLocalChecked();
+    }
+  }
+}
+
+// Integers outside of JS's safe integer range are converted to BigInt
+static inline Local<Value> int64_to_js(int64_t val) {
+  if (val >= -9007199254740991LL && val <= 9007199254740991LL)
+    return Nan::New<Number>(static_cast<double>(val));
+  return BigInt::New(Isolate::GetCurrent(), val);
+}
+
 typedef int (*SqliteAuthCallback)(void*,int,const char*,const char*,const char*,
                                   const char*);
 
@@ -275,9 +339,510 @@ bool set_bind_value(BindValue& bv, Local<Value>& val) {
   return true;
 }
 
+void free_bind_params(BindParamsType params_type, void* params) {
+  switch (params_type) {
+    case BindParamsType::Named: {
+      NamedParamsMap* map = static_cast<NamedParamsMap*>(params);
+      NamedParamsMap::iterator it = map->begin();
+      while (it != map->end()) {
+        bind_value_cleanup(it->second);
+        ++it;
+      }
+      delete map;
+      break;
+    }
+    case BindParamsType::Numeric: {
+      vector<BindValue>* list =
+        static_cast<vector<BindValue>*>(params);
+      for (size_t i = 0; i < list->size(); ++i)
+        bind_value_cleanup(list->at(i));
+      delete list;
+      break;
+    }
+    default:
+      // Appease compiler
+      break;
+  }
+}
+
+// Converts JS bind values into their native equivalents. On failure a JS
+// exception is scheduled and false is returned.
+bool parse_bind_params(Local<Value> vals,
+                       uint32_t query_flags,
+                       BindParamsType* params_type,
+                       void** params) {
+  if (!vals->IsArray()) {
+    *params_type = BindParamsType::None;
+    *params = nullptr;
+    return true;
+  }
+
+  Local<Array> param_list = Local<Array>::Cast(vals);
+  if (query_flags & QueryFlag::NamedParams) {
+    // [ key1, val1, key2, val2, ... ]
+    NamedParamsMap* map = new NamedParamsMap();
+    for (uint32_t i = 0; i < param_list->Length(); i += 2) {
+      BindValue bv;
+      Local<Value> js_key = Nan::Get(param_list, i).ToLocalChecked();
+      Nan::Utf8String key_str(js_key);
+      Local<Value> js_val = Nan::Get(param_list, i + 1).ToLocalChecked();
+      if (!set_bind_value(bv, js_val)) {
+        free_bind_params(BindParamsType::Named, map);
+        string msg = "Unsupported value for bind parameter \"";
+        msg += *key_str;
+        msg += "\": ";
+        Nan::Utf8String val_str(js_val);
+        msg += *val_str;
+        Nan::ThrowError(Nan::New(msg).ToLocalChecked());
+        return false;
+      }
+      map->emplace(make_pair(string(*key_str, key_str.length()), bv));
+    }
+    *params_type = BindParamsType::Named;
+    *params = map;
+  } else {
+    // [ val1, val2, .... ]
+    vector<BindValue>* bind_values =
+      new vector<BindValue>(param_list->Length());
+    for (uint32_t i = 0; i < param_list->Length(); ++i) {
+      Local<Value> js_val = Nan::Get(param_list, i).ToLocalChecked();
+      if (!set_bind_value(bind_values->at(i), js_val)) {
+        bind_values->resize(i);
+        free_bind_params(BindParamsType::Numeric, bind_values);
+        string msg = "Unsupported value for bind parameter at position ";
+        msg += to_string(i);
+        msg += ": ";
+        Nan::Utf8String val_str(js_val);
+        msg += *val_str;
+        Nan::ThrowError(Nan::New(msg).ToLocalChecked());
+        return false;
+      }
+    }
+    *params_type = BindParamsType::Numeric;
+    *params = bind_values;
+  }
+  return true;
+}
+
+// Binds parameters to a freshly prepared statement. For positional values,
+// `list_pos` tracks how many values have been consumed so far (by previous
+// statements in the same query). Returns false with `*err` set to a static
+// message if a value has an invalid type, otherwise `*res` is the result of
+// the last SQLite bind call.
+bool bind_params(sqlite3_stmt* stmt,
+                 BindParamsType params_type,
+                 void* params,
+                 size_t* list_pos,
+                 int* res) {
+  *res = SQLITE_OK;
+  int nbinds = sqlite3_bind_parameter_count(stmt);
+  if (nbinds == 0)
+    return true;
+
+  switch (params_type) {
+    case BindParamsType::Named: {
+      NamedParamsMap* map = static_cast<NamedParamsMap*>(params);
+      for (int index = 1; index <= nbinds; ++index) {
+        const char* name = sqlite3_bind_parameter_name(stmt, index);
+        if (name == nullptr)
+          continue;
+
+        // TODO: switch to map keyed on C string instead to avoid copying
+        //       of parameter name?
+        auto it = map->find(string(name));
+
+        if (it == map->end())
+          continue;
+
+        if (!bind_value(stmt, index, it->second, res))
+          return false;
+        if (*res != SQLITE_OK)
+          return true;
+      }
+      break;
+    }
+    case BindParamsType::Numeric: {
+      vector<BindValue>* list = static_cast<vector<BindValue>*>(params);
+      for (int index = 1;
+           index <= nbinds && *list_pos < list->size();
+           ++index) {
+        if (!bind_value(stmt, index, list->at((*list_pos)++), res))
+          return false;
+        if (*res != SQLITE_OK)
+          return true;
+      }
+      break;
+    }
+    default:
+      // Appease the compiler
+      break;
+  }
+  return true;
+}
+
+// Adds the current statement's column names to a result set, for use as
+// object keys when the rows are converted on the main thread
+void push_column_names(sqlite3_stmt* stmt,
+                       int col_count,
+                       vector<vector<RowValue>>& rows) {
+  vector<RowValue> cols(col_count);
+  for (int i = 0; i < col_count; ++i) {
+    const char* name = sqlite3_column_name(stmt, i);
+    int len = -1;
+    while (name[++len]);
+    if (len > 0) {
+      cols[i].type = ValueType::String;
+      cols[i].val = malloc(len);
+      assert(cols[i].val != nullptr);
+      memcpy(cols[i].val, name, len);
+      cols[i].len = len;
+    } else {
+      cols[i].type = ValueType::StringEmpty;
+    }
+  }
+  rows.push_back(std::move(cols));
+}
+
+// Copies the current row's values out of SQLite's memory
+void push_row(sqlite3_stmt* stmt,
+              int col_count,
+              vector<vector<RowValue>>& rows) {
+  vector<RowValue> row(col_count);
+  for (int i = 0; i < col_count; ++i) {
+    switch (sqlite3_column_type(stmt, i)) {
+      case SQLITE_NULL:
+        row[i].type = ValueType::Null;
+        break;
+      case SQLITE_BLOB: {
+        const void* data = sqlite3_column_blob(stmt, i);
+        int len = sqlite3_column_bytes(stmt, i);
+        if (len == 0) {
+          row[i].type = ValueType::BlobEmpty;
+        } else {
+          row[i].type = ValueType::Blob;
+          row[i].len = len;
+          row[i].val = malloc(len);
+          assert(row[i].val != nullptr);
+          memcpy(row[i].val, data, len);
+        }
+        break;
+      }
+      default: {
+        const char* text =
+          reinterpret_cast<const char*>(sqlite3_column_text(stmt, i));
+        int len = sqlite3_column_bytes(stmt, i);
+        if (len == 0) {
+          row[i].type = ValueType::StringEmpty;
+        } else {
+          row[i].type = ValueType::String;
+          row[i].val = malloc(len);
+          assert(row[i].val != nullptr);
+          memcpy(row[i].val, text, len);
+          row[i].len = len;
+        }
+      }
+    }
+  }
+  rows.push_back(std::move(row));
+}
+
+// Releases collected values that will never be converted to JS
+void free_rows(vector<vector<RowValue>>& rows) {
+  for (auto& row : rows) {
+    for (auto& rv : row) {
+      if (rv.type == ValueType::String || rv.type == ValueType::Blob)
+        free(rv.val);
+    }
+  }
+  rows.clear();
+}
+
+Local<Value> sqlite_error(const char* msg, int sqlite_status) {
+  Local<Value> err = Nan::Error(msg);
+  if (sqlite_status >= 0) {
+    Nan::Set(
+      Nan::To<Object>(err).ToLocalChecked(),
+      Nan::New("code").ToLocalChecked(),
+      esqlite_err_name(sqlite_status)
+    ).FromJust();
+  }
+  return err;
+}
+
+
 class AuthorizerRequest;
+class ChangeNotifier;
 class QueryRequest;
 
+// How often (in VM opcodes) the progress handler checks a query's limits
+#define PROGRESS_INTERVAL 1000
+
+// Checkpoints a WAL mode database from a dedicated thread using its own
+// connection, instead of letting whichever commit crosses the autocheckpoint
+// threshold pay for the checkpoint. Commits on the main connection report the
+// size of the WAL through a WAL hook, which wakes up the thread once the WAL
+// has grown to `passive_pages` pages. Checkpoints are escalated to RESTART or
+// TRUNCATE once the WAL reaches `restart_pages` or `truncate_pages` pages
+// (when non-zero), which happens when passive checkpoints cannot keep up
+// (e.g. because of long-running readers).
+class Checkpointer {
+ public:
+  Checkpointer(const char* path_,
+               int cipher_index_,
+               string key_,
+               int passive_pages_,
+               int restart_pages_,
+               int truncate_pages_,
+               int busy_timeout_ms_)
+    : path(path_),
+      cipher_index(cipher_index_),
+      key(key_),
+      passive_pages(passive_pages_),
+      restart_pages(restart_pages_),
+      truncate_pages(truncate_pages_),
+      busy_timeout_ms(busy_timeout_ms_),
+      db(nullptr),
+      stopping(false),
+      pending(false),
+      wal_pages(0),
+      checkpoints(0),
+      restarts(0),
+      truncates(0),
+      busy(0),
+      errors(0),
+      frames_backfilled(0),
+      last_log_frames(0),
+      last_ckpt_frames(0),
+      last_duration_ns(0),
+      max_duration_ns(0),
+      total_duration_ns(0) {
+  }
+
+  int start() {
+    int status = uv_mutex_init(&mutex);
+    assert(status == 0);
+    status = uv_cond_init(&cond);
+    assert(status == 0);
+    status = uv_thread_create(&thread, Checkpointer::run, this);
+    if (status != 0) {
+      uv_cond_destroy(&cond);
+      uv_mutex_destroy(&mutex);
+    }
+    return status;
+  }
+
+  // Waits for any checkpoint in progress to finish
+  void stop() {
+    uv_mutex_lock(&mutex);
+    stopping = true;
+    uv_cond_signal(&cond);
+    uv_mutex_unlock(&mutex);
+    uv_thread_join(&thread);
+    uv_cond_destroy(&cond);
+    uv_mutex_destroy(&mutex);
+  }
+
+  // Called by SQLite on whichever thread committed a transaction
+  static int wal_hook(void* arg, sqlite3* db, const char* db_name, int pages) {
+    Checkpointer* self = static_cast<Checkpointer*>(arg);
+    uv_mutex_lock(&self->mutex);
+    self->wal_pages = pages;
+    if (pages >= self->passive_pages) {
+      self->pending = true;
+      uv_cond_signal(&self->cond);
+    }
+    uv_mutex_unlock(&self->mutex);
+    return SQLITE_OK;
+  }
+
+  static void run(void* arg) {
+    Checkpointer* self = static_cast<Checkpointer*>(arg);
+    uv_mutex_lock(&self->mutex);
+    while (true) {
+      while (!self->stopping && !self->pending)
+        uv_cond_wait(&self->cond, &self->mutex);
+      if (self->stopping)
+        break;
+      self->pending = false;
+      int pages = self->wal_pages;
+      uv_mutex_unlock(&self->mutex);
+      self->checkpoint(pages);
+      uv_mutex_lock(&self->mutex);
+    }
+    uv_mutex_unlock(&self->mutex);
+    if (self->db)
+      sqlite3_close_v2(self->db);
+  }
+
+  void checkpoint(int pages) {
+    if (!db && !open_db())
+      return;
+
+    int mode = SQLITE_CHECKPOINT_PASSIVE;
+    if (truncate_pages && pages >= truncate_pages)
+      mode = SQLITE_CHECKPOINT_TRUNCATE;
+    else if (restart_pages && pages >= restart_pages)
+      mode = SQLITE_CHECKPOINT_RESTART;
+
+    int log_frames = 0;
+    int ckpt_frames = 0;
+    int res = SQLITE_OK;
+    uint64_t start = uv_hrtime();
+    if (mode == SQLITE_CHECKPOINT_TRUNCATE) {
+      // A truncated WAL reports no frames at all, so backfill what can be
+      // backfilled without waiting first. This also shortens the time the
+      // truncating checkpoint has to hold the writer lock.
+      res = sqlite3_wal_checkpoint_v2(db,
+                                      nullptr,
+                                      SQLITE_CHECKPOINT_PASSIVE,
+                                      &log_frames,
+                                      &ckpt_frames);
+      if (res == SQLITE_OK) {
+        uv_mutex_lock(&mutex);
+        add_backfilled(log_frames, ckpt_frames);
+        uv_mutex_unlock(&mutex);
+      }
+    }
+    if (res == SQLITE_OK) {
+      res = sqlite3_wal_checkpoint_v2(db,
+                                      nullptr,
+                                      mode,
+                                      &log_frames,
+                                      &ckpt_frames);
+    }
+    uint64_t duration = (uv_hrtime() - start);
+
+    uv_mutex_lock(&mutex);
+    ++checkpoints;
+    last_duration_ns = duration;
+    total_duration_ns += duration;
+    if (duration > max_duration_ns)
+      max_duration_ns = duration;
+    if (res == SQLITE_OK) {
+      if (mode == SQLITE_CHECKPOINT_TRUNCATE) {
+        // The WAL is empty now, so the counts are reset as well. Frames
+        // appended since the passive checkpoint above were backfilled too,
+        // but there is no way to tell how many there were.
+        ++truncates;
+        last_log_frames = 0;
+        last_ckpt_frames = 0;
+      } else {
+        if (mode == SQLITE_CHECKPOINT_RESTART)
+          ++restarts;
+        add_backfilled(log_frames, ckpt_frames);
+      }
+    } else if ((res & 0xFF) == SQLITE_BUSY) {
+      ++busy;
+    } else {
+      ++errors;
+      last_error = sqlite3_errmsg(db);
+    }
+    uv_mutex_unlock(&mutex);
+  }
+
+  // Must be called with `mutex` held
+  void add_backfilled(int log_frames, int ckpt_frames) {
+    // The WAL starts over after a restart, in which case the counts start from
+    // zero again
+    if (ckpt_frames >= last_ckpt_frames && log_frames >= last_log_frames)
+      frames_backfilled += (ckpt_frames - last_ckpt_frames);
+    else
+      frames_backfilled += ckpt_frames;
+    last_log_frames = log_frames;
+    last_ckpt_frames = ckpt_frames;
+  }
+
+  bool open_db() {
+    int res = sqlite3_open_v2(path.c_str(),
+                              &db,
+                              SQLITE_OPEN_READWRITE | SQLITE_OPEN_NOMUTEX,
+                              nullptr);
+    if (res == SQLITE_OK && cipher_index >= 0
+        && sqlite3mc_config(db, "cipher", cipher_index) != cipher_index) {
+      res = SQLITE_ERROR;
+    }
+    if (res == SQLITE_OK && key.size()) {
+      res = sqlite3_key_v2(db,
+                           "main",
+                           key.data(),
+                           static_cast<int>(key.size()));
+    }
+    if (res == SQLITE_OK)
+      res = sqlite3_busy_timeout(db, busy_timeout_ms);
+    if (res == SQLITE_OK)
+      return true;
+
+    uv_mutex_lock(&mutex);
+    ++errors;
+    last_error = (db ? sqlite3_errmsg(db) : sqlite3_errstr(res));
+    uv_mutex_unlock(&mutex);
+    sqlite3_close_v2(db);
+    db = nullptr;
+    return false;
+  }
+
+  Local<Object> stats() {
+    Local<Object> obj = Nan::New<Object>();
+    uv_mutex_lock(&mutex);
+#define SET_STAT(name, val)                                                    \
+    Nan::Set(obj,                                                              \
+             Nan::New(name).ToLocalChecked(),                                  \
+             Nan::New<Number>(static_cast<double>(val))).FromJust()
+    SET_STAT("walPages", wal_pages);
+    SET_STAT("checkpoints", checkpoints);
+    SET_STAT("restarts", restarts);
+    SET_STAT("truncates", truncates);
+    SET_STAT("busy", busy);
+    SET_STAT("errors", errors);
+    SET_STAT("framesBackfilled", frames_backfilled);
+    SET_STAT("lastLogFrames", last_log_frames);
+    SET_STAT("lastDurationMs", last_duration_ns / 1e6);
+    SET_STAT("maxDurationMs", max_duration_ns / 1e6);
+    SET_STAT("totalDurationMs", total_duration_ns / 1e6);
+#undef SET_STAT
+    if (last_error.size()) {
+      Nan::Set(obj,
+               Nan::New("lastError").ToLocalChecked(),
+               Nan::New(last_error).ToLocalChecked()).FromJust();
+    }
+    uv_mutex_unlock(&mutex);
+    return obj;
+  }
+
+ private:
+  // Settings, only read by the thread
+  string path;
+  int cipher_index;
+  string key;
+  int passive_pages;
+  int restart_pages;
+  int truncate_pages;
+  int busy_timeout_ms;
+
+  uv_thread_t thread;
+  uv_mutex_t mutex;
+  uv_cond_t cond;
+  // Only used by the thread
+  sqlite3* db;
+
+  // Protected by `mutex`
+  bool stopping;
+  bool pending;
+  int wal_pages;
+  uint64_t checkpoints;
+  uint64_t restarts;
+  uint64_t truncates;
+  uint64_t busy;
+  uint64_t errors;
+  uint64_t frames_backfilled;
+  int last_log_frames;
+  int last_ckpt_frames;
+  uint64_t last_duration_ns;
+  uint64_t max_duration_ns;
+  uint64_t total_duration_ns;
+  string last_error;
+};
+
 class DBHandle : public Nan::ObjectWrap {
  public:
   explicit DBHandle(Local<Function> make_rows_fn_,
@@ -289,9 +854,31 @@ class DBHandle : public Nan::ObjectWrap {
   static NAN_METHOD(New);
   static NAN_METHOD(Open);
   static NAN_METHOD(Query);
+  static NAN_METHOD(Batch);
+  static NAN_METHOD(Exec);
+  static NAN_METHOD(QuerySync);
+  static NAN_METHOD(BlobOpen);
+  static NAN_METHOD(BlobRead);
+  static NAN_METHOD(BlobWrite);
+  static NAN_METHOD(BlobClose);
+  static NAN_METHOD(BackupInit);
+  static NAN_METHOD(BackupStep);
+  static NAN_METHOD(BackupFinish);
+  static NAN_METHOD(Serialize);
+  static NAN_METHOD(Deserialize);
+  static NAN_METHOD(StartCheckpointer);
+  static NAN_METHOD(CheckpointStats);
+  static NAN_METHOD(SetChangeListener);
+  static NAN_METHOD(SessionCreate);
+  static NAN_METHOD(SessionChangeset);
+  static NAN_METHOD(SessionDelete);
+  static NAN_METHOD(ApplyChangeset);
+  static NAN_METHOD(SnapshotGet);
+  static NAN_METHOD(SnapshotOpen);
   static NAN_METHOD(AutoCommit);
   static NAN_METHOD(Limit);
   static NAN_METHOD(Interrupt);
+  static NAN_METHOD(BusyRetry);
   static NAN_METHOD(Close);
   static NAN_METHOD(Abort);
   static inline Eternal<Function> & constructor() {
@@ -306,7 +893,66 @@ class DBHandle : public Nan::ObjectWrap {
   Nan::Persistent<Function> make_obj_row_fn;
   Nan::Persistent<Function> make_arr_row_fn;
   AuthorizerRequest* authorizeReq;
+  ChangeNotifier* notifier;
   Nan::Persistent<Function> status_callback;
+
+  // Busy retry policy, retrying is disabled when `busy_max_wait_ms` is 0
+  uint32_t busy_initial_delay_ms;
+  uint32_t busy_max_delay_ms;
+  uint32_t busy_max_wait_ms;
+  // Jitter PRNG state, only used on the threadpool while a query is working
+  uint32_t busy_rng;
+
+  // Open incremental blob I/O handles, keyed on the id given to JS
+  unordered_map<uint32_t, sqlite3_blob*> blobs;
+  uint32_t next_blob_id;
+
+  void close_blobs() {
+    for (auto& entry : blobs)
+      sqlite3_blob_close(entry.second);
+    blobs.clear();
+  }
+
+  // Online backups in progress, keyed on the id given to JS. Each backup owns
+  // its destination connection.
+  unordered_map<uint32_t, pair<sqlite3_backup*, sqlite3*>> backups;
+  uint32_t next_backup_id;
+
+  // Sessions recording changes, keyed on the id given to JS
+  unordered_map<uint32_t, sqlite3_session*> sessions;
+  uint32_t next_session_id;
+
+  void close_sessions() {
+    for (auto& entry : sessions)
+      sqlite3session_delete(entry.second);
+    sessions.clear();
+  }
+
+  // A read-only database image used in place by SQLite, which must be kept
+  // alive until the connection is closed
+  Nan::Persistent<Object> image;
+
+  // The cipher selected when opening, needed by other connections to the same
+  // database
+  int cipher_index;
+  Checkpointer* checkpointer;
+
+  void stop_checkpointer() {
+    if (!checkpointer)
+      return;
+    sqlite3_wal_hook(db_, nullptr, nullptr);
+    checkpointer->stop();
+    delete checkpointer;
+    checkpointer = nullptr;
+  }
+
+  void close_backups() {
+    for (auto& entry : backups) {
+      sqlite3_backup_finish(entry.second.first);
+      sqlite3_close_v2(entry.second.second);
+    }
+    backups.clear();
+  }
 };
 
 class AuthorizerRequest : public Nan::AsyncResource {
@@ -355,41 +1001,51 @@ public:
     AuthorizerRequest* req = static_cast<AuthorizerRequest*>(handle->data);
     uv_mutex_lock(&req->mutex);
 
+    req->result = req->call_js_callback(true);
+
+    uv_cond_signal(&req->cond);
+    uv_mutex_unlock(&req->mutex);
+  }
+
+  // Calls the JS authorizer with the current request's arguments. This must be
+  // called on the main thread. If the callback throws, the action is denied
+  // and the exception is left pending for the caller to handle.
+  int call_js_callback(bool in_async_scope) {
     Local<Value> argv[5];
-    argv[0] = Nan::New<Int32>(req->code);
-    if (req->arg1 == nullptr)
+    argv[0] = Nan::New<Int32>(code);
+    if (arg1 == nullptr)
       argv[1] = Nan::Null();
     else
-      argv[1] = Nan::New<String>(req->arg1).ToLocalChecked();
-    if (req->arg2 == nullptr)
+      argv[1] = Nan::New<String>(arg1).ToLocalChecked();
+    if (arg2 == nullptr)
       argv[2] = Nan::Null();
     else
-      argv[2] = Nan::New<String>(req->arg2).ToLocalChecked();
-    if (req->arg3 == nullptr)
+      argv[2] = Nan::New<String>(arg2).ToLocalChecked();
+    if (arg3 == nullptr)
       argv[3] = Nan::Null();
     else
-      argv[3] = Nan::New<String>(req->arg3).ToLocalChecked();
-    if (req->arg4 == nullptr)
+      argv[3] = Nan::New<String>(arg3).ToLocalChecked();
+    if (arg4 == nullptr)
       argv[4] = Nan::Null();
     else
-      argv[4] = Nan::New<String>(req->arg4).ToLocalChecked();
-
-    Local<Value> ret = req->runInAsyncScope(
-      Nan::GetCurrentContext()->Global(),
-      Nan::New(req->js_callback),
-      5,
-      argv
-    ).ToLocalChecked();
+      argv[4] = Nan::New<String>(arg4).ToLocalChecked();
+
+    Local<Object> recv = Nan::GetCurrentContext()->Global();
+    Local<Function> fn = Nan::New(js_callback);
+    Nan::MaybeLocal<Value> maybe_ret = (
+      in_async_scope
+      ? runInAsyncScope(recv, fn, 5, argv)
+      : Nan::Call(fn, recv, 5, argv)
+    );
+    Local<Value> ret;
+    if (!maybe_ret.ToLocal(&ret))
+      return SQLITE_DENY;
 
     if (ret->IsTrue())
-      req->result = SQLITE_OK;
-    else if (ret->IsFalse())
-      req->result = SQLITE_DENY;
-    else
-      req->result = SQLITE_IGNORE;
-
-    uv_cond_signal(&req->cond);
-    uv_mutex_unlock(&req->mutex);
+      return SQLITE_OK;
+    if (ret->IsFalse())
+      return SQLITE_DENY;
+    return SQLITE_IGNORE;
   }
 
   void close() {
@@ -419,6 +1075,356 @@ public:
   int result;
 };
 
+// Used to find a connection's change notifier from the statements executing on
+// it, see `ChangeNotifier::statement_failed()`
+static const char CHANGE_NOTIFIER_KEY[] = "esqlite:ChangeNotifier";
+
+// Skips whitespace and comments in SQL text
+static const char* skip_sql_space(const char* p) {
+  while (true) {
+    while (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r' || *p == '\f')
+      ++p;
+    if (p[0] == '-' && p[1] == '-') {
+      while (*p && *p != '\n')
+        ++p;
+    } else if (p[0] == '/' && p[1] == '*') {
+      const char* end = strstr(p + 2, "*/");
+      if (!end)
+        return p + strlen(p);
+      p = end + 2;
+    } else {
+      return p;
+    }
+  }
+}
+
+static inline bool is_sql_ident_char(char c) {
+  return ((c >= 'a' && c <= 'z')
+          || (c >= 'A' && c <= 'Z')
+          || (c >= '0' && c <= '9')
+          || c == '_'
+          || c == '$'
+          || (c & 0x80));
+}
+
+// Reads the next keyword or (possibly quoted) name from SQL text, returning
+// false if there is none
+static bool next_sql_token(const char** pos, string& token) {
+  const char* p = skip_sql_space(*pos);
+  token.clear();
+  char quote = *p;
+  if (quote == '"' || quote == '\'' || quote == '`' || quote == '[') {
+    char end_quote = (quote == '[' ? ']' : quote);
+    for (++p; *p; ++p) {
+      if (*p == end_quote) {
+        // Quotes are escaped by doubling them
+        if (end_quote == ']' || p[1] != end_quote)
+          break;
+        ++p;
+      }
+      token.push_back(*p);
+    }
+    if (!*p)
+      return false;
+    *pos = p + 1;
+    return true;
+  }
+  while (is_sql_ident_char(*p))
+    token.push_back(*p++);
+  *pos = p;
+  return !token.empty();
+}
+
+// A row change reported by the update hook
+struct RowChange {
+  int op;
+  string db_name;
+  string table;
+  sqlite3_int64 rowid;
+};
+
+// Collects the row changes made by each transaction and delivers them to JS as
+// a single batch once the transaction has committed, using one `uv_async_t`
+// for all transactions.
+//
+// Changes that do not survive are dropped: those of transactions that are
+// rolled back, of `ROLLBACK TO` savepoints, and of statements that fail and
+// are undone within a transaction that stays open. Statements are followed via
+// `sqlite3_trace_v2()`, which reports the start of each top-level statement
+// (and of the triggers it fires) and the end of each statement.
+class ChangeNotifier : public Nan::AsyncResource {
+public:
+  ChangeNotifier(Local<Function> js_cb)
+    : Nan::AsyncResource("esqlite:ChangeNotifier"),
+      flush_on_close(false),
+      last_stmt(nullptr),
+      last_mark(0) {
+    int status = uv_mutex_init(&mutex);
+    assert(status == 0);
+
+    status = uv_async_init(
+      Nan::GetCurrentEventLoop(),
+      &async,
+      ChangeNotifier::notify_async_cb
+    );
+    assert(status == 0);
+    async.data = this;
+    // Don't let this keep the event loop alive
+    uv_unref(reinterpret_cast<uv_handle_t*>(&async));
+
+    js_callback.Reset(js_cb);
+  }
+  ~ChangeNotifier() {
+    uv_mutex_destroy(&mutex);
+    js_callback.Reset();
+  }
+
+  void install(sqlite3* db) {
+    sqlite3_set_clientdata(db, CHANGE_NOTIFIER_KEY, this, nullptr);
+    sqlite3_update_hook(db, ChangeNotifier::update_hook, this);
+    sqlite3_commit_hook(db, ChangeNotifier::commit_hook, this);
+    sqlite3_rollback_hook(db, ChangeNotifier::rollback_hook, this);
+    sqlite3_trace_v2(db,
+                     SQLITE_TRACE_STMT | SQLITE_TRACE_PROFILE,
+                     ChangeNotifier::trace_cb,
+                     this);
+  }
+
+  static void uninstall(sqlite3* db) {
+    sqlite3_set_clientdata(db, CHANGE_NOTIFIER_KEY, nullptr, nullptr);
+    sqlite3_update_hook(db, nullptr, nullptr);
+    sqlite3_commit_hook(db, nullptr, nullptr);
+    sqlite3_rollback_hook(db, nullptr, nullptr);
+    sqlite3_trace_v2(db, 0, nullptr, nullptr);
+  }
+
+  // Must be called by the thread executing a statement when stepping it fails,
+  // before it is finalized. Within a transaction that stays open, a failing
+  // statement normally has its own changes undone (`ON CONFLICT ABORT`), in
+  // which case SQLite resets the change count to zero.
+  static void statement_failed(sqlite3_stmt* stmt) {
+    if (!stmt || sqlite3_stmt_readonly(stmt))
+      return;
+    sqlite3* db = sqlite3_db_handle(stmt);
+    ChangeNotifier* self = static_cast<ChangeNotifier*>(
+      sqlite3_get_clientdata(db, CHANGE_NOTIFIER_KEY)
+    );
+    if (!self || self->last_stmt != stmt)
+      return;
+    self->last_stmt = nullptr;
+    if (sqlite3_get_autocommit(db) || sqlite3_changes64(db) != 0)
+      return;
+    self->truncate(self->last_mark);
+  }
+
+  // The hooks are called by whichever thread is executing on the connection
+  static void update_hook(void* arg,
+                          int op,
+                          const char* db_name,
+                          const char* table,
+                          sqlite3_int64 rowid) {
+    ChangeNotifier* self = static_cast<ChangeNotifier*>(arg);
+    self->pending.push_back({ op, db_name, table, rowid });
+  }
+
+  // The commit hook runs before the commit is attempted, which may still fail
+  // (e.g. with `SQLITE_BUSY`), so the changes are only staged here and get
+  // published once the statement ends with the connection in autocommit mode
+  static int commit_hook(void* arg) {
+    ChangeNotifier* self = static_cast<ChangeNotifier*>(arg);
+    if (self->staged.empty()) {
+      self->staged.swap(self->pending);
+    } else {
+      self->staged.insert(self->staged.end(),
+                          self->pending.begin(),
+                          self->pending.end());
+      self->pending.clear();
+    }
+    return 0;
+  }
+
+  static void rollback_hook(void* arg) {
+    ChangeNotifier* self = static_cast<ChangeNotifier*>(arg);
+    self->pending.clear();
+    self->staged.clear();
+    self->savepoints.clear();
+  }
+
+  static int trace_cb(unsigned int type, void* arg, void* p, void* x) {
+    ChangeNotifier* self = static_cast<ChangeNotifier*>(arg);
+    sqlite3_stmt* stmt = static_cast<sqlite3_stmt*>(p);
+    if (type == SQLITE_TRACE_STMT) {
+      // Triggers report the statement that fired them a second time
+      if (self->running.emplace(stmt, self->pending.size()).second)
+        self->statement_started(static_cast<const char*>(x));
+    } else if (type == SQLITE_TRACE_PROFILE) {
+      auto it = self->running.find(stmt);
+      if (it != self->running.end()) {
+        self->last_stmt = stmt;
+        self->last_mark = it->second;
+        self->running.erase(it);
+      }
+      self->statement_ended(sqlite3_db_handle(stmt));
+    }
+    return 0;
+  }
+
+  // Keeps track of savepoints so that `ROLLBACK TO` can drop the changes made
+  // since the savepoint was created
+  void statement_started(const char* sql) {
+    string token;
+    if (!next_sql_token(&sql, token))
+      return;
+    if (sqlite3_stricmp(token.c_str(), "SAVEPOINT") == 0) {
+      if (next_sql_token(&sql, token))
+        savepoints.emplace_back(token, pending.size());
+      return;
+    }
+
+    bool rollback = (sqlite3_stricmp(token.c_str(), "ROLLBACK") == 0);
+    if (!rollback && sqlite3_stricmp(token.c_str(), "RELEASE") != 0)
+      return;
+    if (!next_sql_token(&sql, token))
+      return;
+    if (rollback) {
+      if (sqlite3_stricmp(token.c_str(), "TRANSACTION") == 0
+          && !next_sql_token(&sql, token)) {
+        return;
+      }
+      // A full rollback is handled by the rollback hook
+      if (sqlite3_stricmp(token.c_str(), "TO") != 0
+          || !next_sql_token(&sql, token)) {
+        return;
+      }
+    }
+    if (sqlite3_stricmp(token.c_str(), "SAVEPOINT") == 0
+        && !next_sql_token(&sql, token)) {
+      return;
+    }
+
+    // The most recent savepoint with the name is the one that is used
+    size_t i = savepoints.size();
+    while (i > 0 && sqlite3_stricmp(savepoints[i - 1].first.c_str(),
+                                    token.c_str()) != 0) {
+      --i;
+    }
+    if (i == 0)
+      return;
+    if (rollback) {
+      // The savepoint itself remains after rolling back to it
+      truncate(savepoints[i - 1].second);
+      savepoints.resize(i);
+    } else {
+      savepoints.resize(i - 1);
+    }
+  }
+
+  void statement_ended(sqlite3* db) {
+    if (!sqlite3_get_autocommit(db)) {
+      // The commit did not happen after all, so the transaction continues
+      if (!staged.empty()) {
+        staged.insert(staged.end(), pending.begin(), pending.end());
+        pending.swap(staged);
+        staged.clear();
+      }
+      return;
+    }
+    savepoints.clear();
+    if (staged.empty())
+      return;
+    uv_mutex_lock(&mutex);
+    committed.push_back(std::move(staged));
+    uv_mutex_unlock(&mutex);
+    staged.clear();
+    uv_async_send(&async);
+  }
+
+  void truncate(size_t mark) {
+    if (mark < pending.size())
+      pending.erase(pending.begin() + mark, pending.end());
+  }
+
+  static void notify_async_cb(uv_async_t* handle) {
+    static_cast<ChangeNotifier*>(handle->data)->deliver();
+  }
+
+  // Calls the JS callback once for each committed transaction. Sends to the
+  // async handle may be coalesced, so there may be more than one.
+  void deliver() {
+    Nan::HandleScope scope;
+    vector<vector<RowChange>> batches;
+    uv_mutex_lock(&mutex);
+    batches.swap(committed);
+    uv_mutex_unlock(&mutex);
+
+    Local<Function> callback = Nan::New(js_callback);
+    Local<String> op_key = Nan::New("op").ToLocalChecked();
+    Local<String> db_key = Nan::New("db").ToLocalChecked();
+    Local<String> table_key = Nan::New("table").ToLocalChecked();
+    Local<String> rowid_key = Nan::New("rowid").ToLocalChecked();
+    for (auto& batch : batches) {
+      Local<Array> changes = Nan::New<Array>(batch.size());
+      for (size_t i = 0; i < batch.size(); ++i) {
+        const RowChange& row_change = batch[i];
+        const char* op;
+        switch (row_change.op) {
+          case SQLITE_INSERT: op = "insert"; break;
+          case SQLITE_UPDATE: op = "update"; break;
+          default: op = "delete"; break;
+        }
+        Local<Object> change = Nan::New<Object>();
+        Nan::Set(change, op_key, Nan::New(op).ToLocalChecked()).FromJust();
+        Nan::Set(change,
+                 db_key,
+                 Nan::New(row_change.db_name).ToLocalChecked()).FromJust();
+        Nan::Set(change,
+                 table_key,
+                 Nan::New(row_change.table).ToLocalChecked()).FromJust();
+        Nan::Set(change, rowid_key, int64_to_js(row_change.rowid)).FromJust();
+        Nan::Set(changes, i, change).FromJust();
+      }
+      Local<Value> argv[1] = { changes };
+      runInAsyncScope(Nan::GetCurrentContext()->Global(), callback, 1, argv);
+    }
+  }
+
+  static void uv_close_callback(uv_handle_t* handle) {
+    ChangeNotifier* self = static_cast<ChangeNotifier*>(handle->data);
+    // Deliver any transactions that committed before the hooks were removed
+    if (self->flush_on_close)
+      self->deliver();
+    delete self;
+  }
+
+  void close(bool flush) {
+    flush_on_close = flush;
+    uv_close(reinterpret_cast<uv_handle_t*>(&async), uv_close_callback);
+  }
+
+  Nan::Persistent<Function> js_callback;
+  uv_async_t async;
+  uv_mutex_t mutex;
+  bool flush_on_close;
+
+  // Changes made by the current transaction
+  vector<RowChange> pending;
+  // Changes of a transaction that is in the process of committing
+  vector<RowChange> staged;
+  // The savepoints of the current transaction (innermost last), along with
+  // the number of changes in `pending` when each was created
+  vector<pair<string, size_t>> savepoints;
+  // The statements currently executing, along with the number of changes in
+  // `pending` when each started
+  unordered_map<sqlite3_stmt*, size_t> running;
+  // The statement that ended most recently and the number of changes in
+  // `pending` when it started
+  sqlite3_stmt* last_stmt;
+  size_t last_mark;
+  // Changes made by committed transactions that have yet to be delivered,
+  // protected by `mutex`
+  vector<vector<RowChange>> committed;
+};
+
 class QueryRequest : public Nan::AsyncResource {
 public:
   QueryRequest(Local<Object> handle_,
@@ -428,7 +1434,10 @@ public:
                void* params_,
                unsigned int prepare_flags_,
                uint32_t query_flags_,
-               size_t initial_max_rows_)
+               size_t initial_max_rows_,
+               uint32_t timeout_ms_,
+               uint64_t max_vm_steps_,
+               uint32_t time_slice_ms_)
     : Nan::AsyncResource("esqlite:QueryRequest"),
       handle_ptr(handle_ptr_),
       active(false),
@@ -445,8 +1454,31 @@ public:
       last_status(StatementStatus::Init),
       sqlite_status(0),
       last_error(nullptr),
-      defer_delete(false) {
+      defer_delete(false),
+      deadline(timeout_ms_ ? uv_hrtime() + (timeout_ms_ * 1000000ULL) : 0),
+      max_vm_steps(max_vm_steps_),
+      vm_steps(0),
+      limit_hit(QueryLimit::None),
+      busy_retries(0),
+      busy_wait_ns(0),
+      retry_delay_ms(0),
+      retry_start(0),
+      retry_timer(nullptr),
+      retrying(false),
+      retry_interrupted(false),
+      cancelled(false),
+      time_slice_ns(time_slice_ms_ * 1000000ULL),
+      slice_end(0),
+      chunk_rows(0),
+      yielded(false),
+      start_total_changes(0),
+      changes(0),
+      total_changes(0),
+      last_insert_rowid(0) {
     sql_remaining = sql_utf8str.length();
+    progress_interval = PROGRESS_INTERVAL;
+    if (max_vm_steps > 0 && max_vm_steps < PROGRESS_INTERVAL)
+      progress_interval = static_cast<int>(max_vm_steps);
     sql_str.Reset(sql_str_);
     handle.Reset(handle_);
     cur_stmt_rowfn.Reset();
@@ -456,29 +1488,7 @@ public:
   ~QueryRequest() {
     handle.Reset();
     sql_str.Reset();
-    switch (params_type) {
-      case BindParamsType::Named: {
-        NamedParamsMap* map = static_cast<NamedParamsMap*>(params);
-        NamedParamsMap::iterator it = map->begin();
-        while (it != map->end()) {
-          bind_value_cleanup(it->second);
-          ++it;
-        }
-        delete map;
-        break;
-      }
-      case BindParamsType::Numeric: {
-        vector<BindValue>* list =
-          static_cast<vector<BindValue>*>(params);
-        for (size_t i = 0; i < list->size(); ++i)
-          bind_value_cleanup(list->at(i));
-        delete list;
-        break;
-      }
-      default:
-        // Appease compiler
-        break;
-    }
+    free_bind_params(params_type, params);
     cur_stmt_rowfn.Reset();
     if (last_error)
       free(last_error);
@@ -511,12 +1521,204 @@ public:
   vector<vector<RowValue>> rows;
   char* last_error;
   bool defer_delete;
+
+  // Execution limits, enforced by the progress handler. `deadline` is in
+  // `uv_hrtime()` units (nanoseconds) and is 0 when there is no time limit.
+  uint64_t deadline;
+  uint64_t max_vm_steps;
+  uint64_t vm_steps;
+  int progress_interval;
+  QueryLimit limit_hit;
+
+  // Busy retry state. `retry_delay_ms` is set on the threadpool when the
+  // current statement should be restarted later, everything else is only
+  // accessed on the main thread (or before/after work is queued).
+  uint32_t busy_retries;
+  uint64_t busy_wait_ns;
+  uint32_t retry_delay_ms;
+  uint64_t retry_start;
+  uv_timer_t* retry_timer;
+  bool retrying;
+  bool retry_interrupted;
+
+  // Set on the main thread by `interrupt()` and checked on the threadpool
+  // before preparing and between steps, so that an interruption also stops
+  // work that was queued but had not started running a statement yet (when
+  // `sqlite3_interrupt()` does nothing). Cleared once the work is handed back
+  // to JS.
+  atomic<bool> cancelled;
+
+  // Time slicing state. When `time_slice_ns` is non-zero, the work function
+  // stops stepping once the slice has been used up and the query is requeued
+  // on the threadpool (`yielded`) without involving JS.
+  uint64_t time_slice_ns;
+  uint64_t slice_end;
+  size_t chunk_rows;
+  bool yielded;
+
+  // The connection's total change count when the current statement started
+  int64_t start_total_changes;
+  // Connection change counters, captured when a statement completes
+  int64_t changes;
+  int64_t total_changes;
+  int64_t last_insert_rowid;
 };
 
-void QueryWork(uv_work_t* req) {
-  QueryRequest* query_req = static_cast<QueryRequest*>(req->data);
+static inline bool cancel_requested(QueryRequest* query_req) {
+  return query_req->cancelled.load(memory_order_relaxed);
+}
+
+// Fails the current statement of an interrupted query
+static void fail_interrupted(QueryRequest* query_req) {
+  query_req->last_status = StatementStatus::Error;
+  if (query_req->last_error)
+    free(query_req->last_error);
+  query_req->last_error = strdup(sqlite3_errstr(SQLITE_INTERRUPT));
+  query_req->sqlite_status = SQLITE_INTERRUPT;
+  sqlite3_finalize(query_req->cur_stmt);
+  query_req->cur_stmt = nullptr;
+}
+
+// Whether the current time slice has been used up. This is only checked
+// between `sqlite3_step()` calls.
+static inline bool slice_expired(QueryRequest* query_req) {
+  if (query_req->slice_end == 0 || uv_hrtime() < query_req->slice_end)
+    return false;
+  query_req->yielded = true;
+  return true;
+}
+
+// Returns how long to wait before the next attempt after SQLITE_BUSY, given
+// the number of retries so far and the time spent waiting for them, or 0 if
+// there should be no more attempts
+static uint32_t busy_retry_delay(DBHandle* handle,
+                                 uint32_t busy_retries,
+                                 uint64_t busy_wait_ns) {
+  if (handle->busy_max_wait_ms == 0)
+    return 0;
+
+  uint64_t waited_ms = (busy_wait_ns / 1000000);
+  if (waited_ms >= handle->busy_max_wait_ms)
+    return 0;
+
+  // Exponential backoff ...
+  uint64_t delay = handle->busy_initial_delay_ms;
+  for (uint32_t i = 0;
+       i < busy_retries && delay < handle->busy_max_delay_ms;
+       ++i) {
+    delay <<= 1;
+  }
+  delay = min(delay, static_cast<uint64_t>(handle->busy_max_delay_ms));
+
+  // ... with jitter (somewhere between half and all of the delay) so that
+  // competing processes spread out instead of retrying in lockstep
+  uint32_t rnd = handle->busy_rng;
+  rnd ^= rnd << 13;
+  rnd ^= rnd >> 17;
+  rnd ^= rnd << 5;
+  handle->busy_rng = rnd;
+  delay = (delay / 2) + (rnd % ((delay - (delay / 2)) + 1));
+
+  delay = min(delay, handle->busy_max_wait_ms - waited_ms);
+  return static_cast<uint32_t>(max(delay, static_cast<uint64_t>(1)));
+}
+
+// Decides whether a statement that failed with SQLITE_BUSY on its first step
+// should be restarted later and if so, for how long to wait beforehand
+static bool schedule_busy_retry(QueryRequest* query_req) {
+  DBHandle* handle = query_req->handle_ptr;
+  // Only retry statements running in their own (implicit) transaction, as
+  // restarting a statement in the middle of an explicit transaction can never
+  // succeed if the transaction's snapshot is stale
+  if (!sqlite3_get_autocommit(handle->db_))
+    return false;
+  query_req->retry_delay_ms = busy_retry_delay(handle,
+                                               query_req->busy_retries,
+                                               query_req->busy_wait_ns);
+  return (query_req->retry_delay_ms != 0);
+}
+
+// Called by SQLite every `progress_interval` VM opcodes while a statement with
+// execution limits is being prepared or stepped. Returning non-zero causes the
+// statement to fail with SQLITE_INTERRUPT.
+static int query_progress_handler(void* arg) {
+  QueryRequest* query_req = static_cast<QueryRequest*>(arg);
+  if (cancel_requested(query_req))
+    return 1;
+  if (query_req->max_vm_steps) {
+    query_req->vm_steps += query_req->progress_interval;
+    if (query_req->vm_steps >= query_req->max_vm_steps) {
+      query_req->limit_hit = QueryLimit::VMSteps;
+      return 1;
+    }
+  }
+  if (query_req->deadline && uv_hrtime() >= query_req->deadline) {
+    query_req->limit_hit = QueryLimit::Timeout;
+    return 1;
+  }
+  return 0;
+}
+
+static void query_work(QueryRequest* query_req);
+
+void QueryWork(uv_work_t* req) {
+  QueryRequest* query_req = static_cast<QueryRequest*>(req->data);
+  sqlite3* db = query_req->handle_ptr->db_;
+
+  if (!query_req->deadline && !query_req->max_vm_steps)
+    return query_work(query_req);
+
+  if (query_req->deadline && uv_hrtime() >= query_req->deadline) {
+    // Don't bother starting another statement or resuming the current one
+    query_req->limit_hit = QueryLimit::Timeout;
+  } else {
+    sqlite3_progress_handler(db,
+                             query_req->progress_interval,
+                             query_progress_handler,
+                             query_req);
+    query_work(query_req);
+    sqlite3_progress_handler(db, 0, nullptr, nullptr);
+    if (query_req->limit_hit == QueryLimit::None)
+      return;
+  }
+
+  // A limit was hit, fail the query with a distinct error and skip any
+  // remaining statements
+  if (query_req->cur_stmt) {
+    sqlite3_finalize(query_req->cur_stmt);
+    query_req->cur_stmt = nullptr;
+  }
+  query_req->last_status = StatementStatus::Error;
+  if (query_req->last_error)
+    free(query_req->last_error);
+  query_req->last_error = strdup(
+    query_req->limit_hit == QueryLimit::Timeout
+    ? "Query timed out"
+    : "Query exceeded the VM step limit"
+  );
+  query_req->sqlite_status = SQLITE_INTERRUPT;
+  query_req->sql_pos += query_req->sql_remaining;
+  query_req->sql_remaining = 0;
+}
+
+static void query_work(QueryRequest* query_req) {
+  if (query_req->retry_interrupted) {
+    // Interrupted while waiting to retry
+    query_req->retry_interrupted = false;
+    fail_interrupted(query_req);
+    return;
+  }
+  if (cancel_requested(query_req)) {
+    // Interrupted while waiting for a thread, before anything was executed
+    fail_interrupted(query_req);
+    return;
+  }
 
   bool is_new = (query_req->cur_stmt == nullptr);
+  bool first_step = (is_new || query_req->retrying);
+  query_req->retrying = false;
+  if (query_req->time_slice_ns)
+    query_req->slice_end = uv_hrtime() + query_req->time_slice_ns;
   int res;
   if (is_new) {
     for (;;) {
@@ -559,327 +1761,323 @@ void QueryWork(uv_work_t* req) {
     }
 
     // Bind any parameters
-    int nbinds = sqlite3_bind_parameter_count(query_req->cur_stmt);
-    if (nbinds > 0) {
-      switch (query_req->params_type) {
-        case BindParamsType::Named: {
-          NamedParamsMap* map =
-            static_cast<NamedParamsMap*>(query_req->params);
-          for (int index = 1; index <= nbinds; ++index) {
-            const char* name =
-              sqlite3_bind_parameter_name(query_req->cur_stmt, index);
-            if (name == nullptr)
-              continue;
-
-            // TODO: switch to map keyed on C string instead to avoid copying
-            //       of parameter name?
-            auto it = map->find(string(name));
-
-            if (it == map->end())
-              continue;
-
-            if (!bind_value(query_req->cur_stmt, index, it->second, &res)) {
-              query_req->last_status = StatementStatus::Error;
-              query_req->last_error = strdup("Invalid bind param type");
-              query_req->sqlite_status = -1;
-              sqlite3_finalize(query_req->cur_stmt);
-              query_req->cur_stmt = nullptr;
-              return;
-            }
-            if (res != SQLITE_OK) {
-              query_req->last_status = StatementStatus::Error;
-              query_req->last_error =
-                strdup(sqlite3_errmsg(query_req->handle_ptr->db_));
-              query_req->sqlite_status = -1;
-              sqlite3_finalize(query_req->cur_stmt);
-              query_req->cur_stmt = nullptr;
-              return;
-            }
-          }
-          break;
-        }
-        case BindParamsType::Numeric: {
-          vector<BindValue>* list =
-            static_cast<vector<BindValue>*>(query_req->params);
-          for (int index = 1;
-               index <= nbinds && query_req->bind_list_pos < list->size();
-               ++index) {
-            if (!bind_value(query_req->cur_stmt,
-                            index,
-                            list->at(query_req->bind_list_pos++),
-                            &res)) {
-              query_req->last_status = StatementStatus::Error;
-              query_req->last_error = strdup("Invalid bind param type");
-              query_req->sqlite_status = -1;
-              sqlite3_finalize(query_req->cur_stmt);
-              query_req->cur_stmt = nullptr;
-              return;
-            }
-            if (res != SQLITE_OK) {
-              query_req->last_status = StatementStatus::Error;
-              query_req->last_error =
-                strdup(sqlite3_errmsg(query_req->handle_ptr->db_));
-              query_req->sqlite_status = -1;
-              sqlite3_finalize(query_req->cur_stmt);
-              query_req->cur_stmt = nullptr;
-              return;
-            }
-          }
-          break;
-        }
-        default:
-          // Appease the compiler
-          break;
-      }
+    if (!bind_params(query_req->cur_stmt,
+                     query_req->params_type,
+                     query_req->params,
+                     &query_req->bind_list_pos,
+                     &res)
+        || res != SQLITE_OK) {
+      query_req->last_status = StatementStatus::Error;
+      query_req->last_error = strdup(
+        res == SQLITE_OK
+        ? "Invalid bind param type"
+        : sqlite3_errmsg(query_req->handle_ptr->db_)
+      );
+      query_req->sqlite_status = -1;
+      sqlite3_finalize(query_req->cur_stmt);
+      query_req->cur_stmt = nullptr;
+      return;
     }
   }
 
+  if (first_step) {
+    query_req->start_total_changes =
+      sqlite3_total_changes64(query_req->handle_ptr->db_);
+  }
   res = sqlite3_step(query_req->cur_stmt);
+  if (first_step
+      && (res & 0xFF) == SQLITE_BUSY
+      && schedule_busy_retry(query_req)) {
+    // Nothing has been produced by this statement yet, so it can be restarted
+    // from scratch later on without occupying this thread in the meantime
+    sqlite3_reset(query_req->cur_stmt);
+    return;
+  }
   if (res == SQLITE_ROW) {
-    if (query_req->col_count) {
-      if (is_new && !(query_req->query_flags & QueryFlag::RowsAsArray)) {
-        vector<RowValue> cols(query_req->col_count);
-        // Add the column names to the result set
-        for (int i = 0; i < query_req->col_count; ++i) {
-          const char* name = sqlite3_column_name(query_req->cur_stmt, i);
-          int len = -1;
-          while (name[++len]);
-          if (len > 0) {
-            cols[i].type = ValueType::String;
-            cols[i].val = malloc(len);
-            assert(cols[i].val != nullptr);
-            memcpy(cols[i].val, name, len);
-            cols[i].len = len;
-          } else {
-            cols[i].type = ValueType::StringEmpty;
-          }
+    uint32_t flags = query_req->query_flags;
+    if (flags & QueryFlag::SingleRow) {
+      // Only the first row is wanted, so treat the statement as done instead
+      // of stepping any further
+      if (query_req->col_count) {
+        if (!(flags & QueryFlag::RowsAsArray)) {
+          push_column_names(query_req->cur_stmt,
+                            query_req->col_count,
+                            query_req->rows);
         }
-        query_req->rows.push_back(std::move(cols));
+        push_row(query_req->cur_stmt, query_req->col_count, query_req->rows);
+      }
+      res = SQLITE_DONE;
+    } else if (query_req->col_count && !(flags & QueryFlag::NoRows)) {
+      if (first_step
+          && !(flags & (QueryFlag::RowsAsArray | QueryFlag::Pluck))) {
+        // Add the column names to the result set
+        push_column_names(query_req->cur_stmt,
+                          query_req->col_count,
+                          query_req->rows);
       }
 
-      // Add the rows to the result set
-      size_t row_count = 0;
+      // Add the rows (or only their first values) to the result set
+      int ncols = ((flags & QueryFlag::Pluck) ? 1 : query_req->col_count);
       do {
-        vector<RowValue> row(query_req->col_count);
-        for (int i = 0; i < query_req->col_count; ++i) {
-          switch (sqlite3_column_type(query_req->cur_stmt, i)) {
-            case SQLITE_NULL:
-              row[i].type = ValueType::Null;
-              break;
-            case SQLITE_BLOB: {
-              const void* data =
-                sqlite3_column_blob(query_req->cur_stmt, i);
-              int len = sqlite3_column_bytes(query_req->cur_stmt, i);
-              if (len == 0) {
-                row[i].type = ValueType::BlobEmpty;
-              } else {
-                row[i].type = ValueType::Blob;
-                row[i].len = len;
-                row[i].val = malloc(len);
-                assert(row[i].val != nullptr);
-                memcpy(row[i].val, data, len);
-              }
-              break;
-            }
-            default: {
-              const char* text = reinterpret_cast<const char*>(
-                sqlite3_column_text(query_req->cur_stmt, i)
-              );
-              int len = sqlite3_column_bytes(query_req->cur_stmt, i);
-              if (len == 0) {
-                row[i].type = ValueType::StringEmpty;
-              } else {
-                row[i].type = ValueType::String;
-                row[i].val = malloc(len);
-                assert(row[i].val != nullptr);
-                memcpy(row[i].val, text, len);
-                row[i].len = len;
-              }
-            }
-          }
-        }
-        query_req->rows.push_back(std::move(row));
-        ++row_count;
-      } while ((query_req->max_rows == 0 || (row_count < query_req->max_rows))
+        push_row(query_req->cur_stmt, ncols, query_req->rows);
+        ++query_req->chunk_rows;
+      } while ((query_req->max_rows == 0
+                || (query_req->chunk_rows < query_req->max_rows))
+               && !cancel_requested(query_req)
+               && !slice_expired(query_req)
                && (res = sqlite3_step(query_req->cur_stmt)) == SQLITE_ROW);
     } else {
       // No columns thus no row data, so just step until done
-      while ((res = sqlite3_step(query_req->cur_stmt)) == SQLITE_ROW);
+      while (!cancel_requested(query_req)
+             && !slice_expired(query_req)
+             && (res = sqlite3_step(query_req->cur_stmt)) == SQLITE_ROW);
     }
   }
+  if (res == SQLITE_ROW && cancel_requested(query_req)) {
+    fail_interrupted(query_req);
+    return;
+  }
   if (res == SQLITE_ROW) {
     query_req->last_status = StatementStatus::Incomplete;
     return;
   }
   if (res == SQLITE_DONE) {
     query_req->last_status = StatementStatus::Complete;
+    sqlite3* db = query_req->handle_ptr->db_;
+    // `sqlite3_changes64()` is only updated by INSERT, UPDATE and DELETE, so
+    // it is only meaningful if this statement changed anything at all
+    query_req->total_changes = sqlite3_total_changes64(db);
+    query_req->changes =
+      (query_req->total_changes != query_req->start_total_changes
+       ? sqlite3_changes64(db)
+       : 0);
+    query_req->last_insert_rowid = sqlite3_last_insert_rowid(db);
   } else {
     query_req->last_status = StatementStatus::Error;
     query_req->last_error = strdup(sqlite3_errmsg(query_req->handle_ptr->db_));
     query_req->sqlite_status = res;
+    ChangeNotifier::statement_failed(query_req->cur_stmt);
   }
 
   sqlite3_finalize(query_req->cur_stmt);
   query_req->cur_stmt = nullptr;
 }
 
-void QueryAfter(uv_work_t* req, int status) {
-  Nan::HandleScope scope;
-  QueryRequest* query_req = static_cast<QueryRequest*>(req->data);
-  Local<Object> handle = Nan::New(query_req->handle);
-  Local<Function> status_callback =
-    Nan::New(query_req->handle_ptr->status_callback);
-  Local<Function> make_rows_fn = Nan::New(query_req->handle_ptr->make_rows_fn);
+void QueryAfter(uv_work_t* req, int status);
 
-  --query_req->handle_ptr->working_;
+static void free_timer(uv_handle_t* handle) {
+  delete reinterpret_cast<uv_timer_t*>(handle);
+}
 
-  Local<Array> rows;
-  if (query_req->rows.size() > 0) {
-    size_t row_start = (
-      query_req->cur_stmt_rowfn.IsEmpty()
-        && !(query_req->query_flags & QueryFlag::RowsAsArray)
-      ? 1
-      : 0
-    );
-    int ncols = query_req->col_count;
-    size_t nrows = query_req->rows.size() - row_start;
-    rows = Nan::New<Array>(nrows);
+static void busy_retry_cb(uv_timer_t* timer) {
+  QueryRequest* query_req = static_cast<QueryRequest*>(timer->data);
+  uv_close(reinterpret_cast<uv_handle_t*>(timer), free_timer);
+  query_req->retry_timer = nullptr;
+  query_req->busy_wait_ns += (uv_hrtime() - query_req->retry_start);
+  ++query_req->busy_retries;
+  query_req->retrying = true;
+
+  int status = uv_queue_work(
+    uv_default_loop(),
+    &query_req->request,
+    QueryWork,
+    reinterpret_cast<uv_after_work_cb>(QueryAfter)
+  );
+  assert(status == 0);
+}
+
+// Converts the first value of each row into a flat array
+static Local<Array> values_to_js(vector<vector<RowValue>>& result) {
+  Local<Array> values = Nan::New<Array>(result.size());
+  for (size_t i = 0; i < result.size(); ++i)
+    Nan::Set(values, i, row_value_to_js(result[i][0])).FromJust();
+  return values;
+}
+
+// Converts a result set holding (column names and) a single row directly,
+// without going through a generated row function
+static Local<Value> single_row_to_js(vector<vector<RowValue>>& result,
+                                     int ncols,
+                                     bool rows_as_array) {
+  if (rows_as_array) {
+    Local<Array> row = Nan::New<Array>(ncols);
+    for (int k = 0; k < ncols; ++k)
+      Nan::Set(row, k, row_value_to_js(result[0][k])).FromJust();
+    return row;
+  }
+  Local<Object> row = Nan::New<Object>();
+  for (int k = 0; k < ncols; ++k) {
+    Local<Value> name = row_value_to_js(result[0][k]);
+    Nan::Set(row, name, row_value_to_js(result[1][k])).FromJust();
+  }
+  return row;
+}
+
+// Calls into JS from within an async resource's scope, or directly when called
+// synchronously from JS (`async_res` is null)
+static inline Nan::MaybeLocal<Value> call_js(Nan::AsyncResource* async_res,
+                                            Local<Object> recv,
+                                            Local<Function> fn,
+                                            int argc,
+                                            Local<Value>* argv) {
+  if (async_res)
+    return async_res->runInAsyncScope(recv, fn, argc, argv);
+  return Nan::Call(fn, recv, argc, argv);
+}
 
-    // Note: `argv` is defined once to reduce the ifdefs and is large enough for
-    //       any of the uses in this function
+// Converts a result set collected on the threadpool into an array of row
+// objects (or arrays). Unless rows are arrays, the first entry of `rows` holds
+// the column names when `row_fn` is still empty. The generated row function is
+// stored in `row_fn` so that later chunks of the same statement can reuse it.
+static Local<Array> rows_to_js(Nan::AsyncResource* async_res,
+                               DBHandle* handle_ptr,
+                               vector<vector<RowValue>>& result,
+                               int ncols,
+                               bool rows_as_array,
+                               Nan::Persistent<Function>& row_fn) {
+  Local<Function> make_rows_fn = Nan::New(handle_ptr->make_rows_fn);
+  size_t row_start = (row_fn.IsEmpty() && !rows_as_array ? 1 : 0);
+  size_t nrows = result.size() - row_start;
+  Local<Array> rows = Nan::New<Array>(nrows);
+
+  // Note: `argv` is defined once to reduce the ifdefs and is large enough for
+  //       any of the uses in this function
 #define CHUNK_SIZE 30
 #ifdef _MSC_VER
-    Local<Value>* argv = static_cast<Local<Value>*>(
-      _malloca((2 + (ncols * CHUNK_SIZE)) * sizeof(Local<Value>))
-    );
+  Local<Value>* argv = static_cast<Local<Value>*>(
+    _malloca((2 + (ncols * CHUNK_SIZE)) * sizeof(Local<Value>))
+  );
 #else
-    Local<Value> argv[(2 + (ncols * CHUNK_SIZE))];
+  Local<Value> argv[(2 + (ncols * CHUNK_SIZE))];
 #endif
 
-    Local<Function> rowFn;
-    if (query_req->cur_stmt_rowfn.IsEmpty()) {
-      // Create row generator
-      if (!(query_req->query_flags & QueryFlag::RowsAsArray)) {
-        for (int k = 0; k < ncols; ++k) {
-          Local<Value> val;
-          switch (query_req->rows[0][k].type) {
-            case ValueType::String: {
-              char* raw = static_cast<char*>(query_req->rows[0][k].val);
-              size_t len = query_req->rows[0][k].len;
-              if (len < EXTERN_APEX) {
-                // Makes copy
-                val = Nan::New(raw, len).ToLocalChecked();
-                free(raw);
-              } else {
-                // Uses reference to existing memory
-                val = Nan::New(new ExtString(raw, len)).ToLocalChecked();
-              }
-              break;
-            }
-            case ValueType::StringEmpty:
-              val = Nan::EmptyString();
-              break;
-            default:
-              // Appease compiler
-              break;
-          }
-          argv[k] = val;
-        }
-        rowFn = Local<Function>::Cast(
-          query_req->runInAsyncScope(
-            rows,
-            Nan::New(query_req->handle_ptr->make_obj_row_fn),
-            ncols,
-            argv
-          ).ToLocalChecked()
-        );
-      } else {
-        argv[0] = Nan::New(ncols);
-        rowFn = Local<Function>::Cast(
-          query_req->runInAsyncScope(
-            rows,
-            Nan::New(query_req->handle_ptr->make_arr_row_fn),
-            1,
-            argv
-          ).ToLocalChecked()
-        );
-      }
-      query_req->cur_stmt_rowfn.Reset(rowFn);
+  Local<Function> rowFn;
+  if (row_fn.IsEmpty()) {
+    // Create row generator
+    if (!rows_as_array) {
+      for (int k = 0; k < ncols; ++k)
+        argv[k] = row_value_to_js(result[0][k]);
+      rowFn = Local<Function>::Cast(
+        call_js(
+          async_res,
+          rows,
+          Nan::New(handle_ptr->make_obj_row_fn),
+          ncols,
+          argv
+        ).ToLocalChecked()
+      );
     } else {
-      rowFn = Nan::New(query_req->cur_stmt_rowfn);
+      argv[0] = Nan::New(ncols);
+      rowFn = Local<Function>::Cast(
+        call_js(
+          async_res,
+          rows,
+          Nan::New(handle_ptr->make_arr_row_fn),
+          1,
+          argv
+        ).ToLocalChecked()
+      );
     }
+    row_fn.Reset(rowFn);
+  } else {
+    rowFn = Nan::New(row_fn);
+  }
 
-    // Create rows
-    {
-      size_t j = row_start;
-      while (true) {
-        size_t chunk_size =
-          min(nrows - (j - row_start), static_cast<size_t>(CHUNK_SIZE));
-        if (chunk_size == 0)
-          break;
-        size_t end = j + chunk_size;
-
-        int offset = 2;
-        int argc = 2 + (ncols * chunk_size);
-        argv[0] = Nan::New<Uint32>(static_cast<uint32_t>(j - row_start));
-        argv[1] = rowFn;
-        for (; j < end; ++j) {
-          for (int k = 0; k < ncols; ++k) {
-            Local<Value> val;
-            switch (query_req->rows[j][k].type) {
-              case ValueType::Null:
-                val = Nan::Null();
-                break;
-              case ValueType::StringEmpty:
-                val = Nan::EmptyString();
-                break;
-              case ValueType::BlobEmpty:
-                val = Nan::NewBuffer(0).ToLocalChecked();
-                break;
-              case ValueType::Blob: {
-                // Transfers ownership
-                val = Nan::NewBuffer(
-                  static_cast<char*>(query_req->rows[j][k].val),
-                  query_req->rows[j][k].len
-#ifdef _MSC_VER
-                  ,
-                  free_blob,
-                  nullptr
-#endif
-                ).ToLocalChecked();
-                break;
-              }
-              default: {
-                char* raw =
-                  static_cast<char*>(query_req->rows[j][k].val);
-                size_t len = query_req->rows[j][k].len;
-                if (len < EXTERN_APEX) {
-                  // Makes copy
-                  val = Nan::New(raw, len).ToLocalChecked();
-                  free(raw);
-                } else {
-                  // Uses reference to existing memory
-                  val = Nan::New(new ExtString(raw, len)).ToLocalChecked();
-                }
-              }
-            }
-            argv[offset++] = val;
-          }
-        }
-        query_req->runInAsyncScope(rows, make_rows_fn, argc, argv);
+  // Create rows
+  {
+    size_t j = row_start;
+    while (true) {
+      size_t chunk_size =
+        min(nrows - (j - row_start), static_cast<size_t>(CHUNK_SIZE));
+      if (chunk_size == 0)
+        break;
+      size_t end = j + chunk_size;
+
+      int offset = 2;
+      int argc = 2 + (ncols * chunk_size);
+      argv[0] = Nan::New<Uint32>(static_cast<uint32_t>(j - row_start));
+      argv[1] = rowFn;
+      for (; j < end; ++j) {
+        for (int k = 0; k < ncols; ++k)
+          argv[offset++] = row_value_to_js(result[j][k]);
       }
+      call_js(async_res, rows, make_rows_fn, argc, argv);
     }
+  }
 
 #ifdef _MSC_VER
-    _freea(argv);
+  _freea(argv);
 #endif
+  return rows;
+}
+
+void QueryAfter(uv_work_t* req, int status) {
+  QueryRequest* query_req = static_cast<QueryRequest*>(req->data);
+
+  if (query_req->retry_delay_ms) {
+    // Give the thread back and restart the statement after a delay. The query
+    // stays active (and counted as working) in the meantime.
+    uv_timer_t* timer = new uv_timer_t;
+    int r = uv_timer_init(uv_default_loop(), timer);
+    assert(r == 0);
+    timer->data = query_req;
+    query_req->retry_timer = timer;
+    query_req->retry_start = uv_hrtime();
+    r = uv_timer_start(timer, busy_retry_cb, query_req->retry_delay_ms, 0);
+    assert(r == 0);
+    query_req->retry_delay_ms = 0;
+    return;
+  }
+
+  if (query_req->yielded) {
+    // The time slice was used up before the statement finished or produced
+    // enough rows, let other work use the threadpool before continuing
+    query_req->yielded = false;
+    int r = uv_queue_work(
+      uv_default_loop(),
+      &query_req->request,
+      QueryWork,
+      reinterpret_cast<uv_after_work_cb>(QueryAfter)
+    );
+    assert(r == 0);
+    return;
+  }
+
+  Nan::HandleScope scope;
+  Local<Object> handle = Nan::New(query_req->handle);
+  Local<Function> status_callback =
+    Nan::New(query_req->handle_ptr->status_callback);
+
+  --query_req->handle_ptr->working_;
+  // Any interruption now applies to this work only if it stopped it
+  query_req->cancelled = false;
+
+  Local<Array> rows;
+  if (query_req->rows.size() > 0) {
+    uint32_t flags = query_req->query_flags;
+    if (flags & QueryFlag::Pluck) {
+      rows = values_to_js(query_req->rows);
+    } else if (flags & QueryFlag::SingleRow) {
+      rows = Nan::New<Array>(1);
+      Nan::Set(rows, 0, single_row_to_js(query_req->rows,
+                                          query_req->col_count,
+                                          flags & QueryFlag::RowsAsArray))
+        .FromJust();
+    } else {
+      rows = rows_to_js(query_req,
+                        query_req->handle_ptr,
+                        query_req->rows,
+                        query_req->col_count,
+                        flags & QueryFlag::RowsAsArray,
+                        query_req->cur_stmt_rowfn);
+    }
   }
 
   bool is_last_stmt = (
     query_req->sql_remaining == 0
     || (query_req->query_flags & QueryFlag::SingleStatement)
   );
-  Local<Value> argv[4];
+  Local<Value> argv[9];
   argv[0] = Nan::New(query_req->last_status);
   argv[1] = Nan::New(is_last_stmt);
   switch (query_req->last_status) {
@@ -896,13 +2094,18 @@ void QueryAfter(uv_work_t* req, int status) {
     }
     case StatementStatus::Error: {
       query_req->cur_stmt_rowfn.Reset();
-      argv[2] = Nan::Error(query_req->last_error);
-      if (query_req->sqlite_status >= 0) {
+      if (query_req->limit_hit != QueryLimit::None) {
+        argv[2] = Nan::Error(query_req->last_error);
         Nan::Set(
           Nan::To<Object>(argv[2]).ToLocalChecked(),
           Nan::New("code").ToLocalChecked(),
-          esqlite_err_name(query_req->sqlite_status)
+          Nan::New(query_req->limit_hit == QueryLimit::Timeout
+                   ? "ESQLITE_TIMEOUT"
+                   : "ESQLITE_VM_STEP_LIMIT").ToLocalChecked()
         ).FromJust();
+      } else {
+        argv[2] = sqlite_error(query_req->last_error,
+                               query_req->sqlite_status);
       }
       free(query_req->last_error);
       query_req->last_error = nullptr;
@@ -912,63 +2115,27 @@ void QueryAfter(uv_work_t* req, int status) {
       Nan::ThrowError("Unexpected init statement status");
   }
   argv[3] = Nan::New(query_req->col_count);
+  argv[4] = Nan::New(query_req->busy_retries);
+  argv[5] = Nan::New(query_req->busy_wait_ns / 1e6);
+  argv[6] = int64_to_js(query_req->changes);
+  argv[7] = int64_to_js(query_req->last_insert_rowid);
+  argv[8] = int64_to_js(query_req->total_changes);
 
   bool req_done = (
     is_last_stmt && query_req->last_status != StatementStatus::Incomplete
   );
   query_req->active = false;
   query_req->rows.clear();
+  query_req->chunk_rows = 0;
   if (req_done)
     query_req->handle_ptr->cur_req = nullptr;
 
-  query_req->runInAsyncScope(handle, status_callback, 4, argv);
+  query_req->runInAsyncScope(handle, status_callback, 9, argv);
 
   if (req_done && !query_req->defer_delete)
     delete query_req;
 }
 
-class InterruptRequest : public Nan::AsyncResource {
-public:
-  InterruptRequest(Local<Object> handle_,
-                   DBHandle* handle_ptr_,
-                   Local<Function> callback_)
-    : Nan::AsyncResource("esqlite:InterruptRequest"),
-      handle_ptr(handle_ptr_) {
-    handle.Reset(handle_);
-    callback.Reset(callback_);
-    request.data = this;
-  }
-
-  ~InterruptRequest() {
-    handle.Reset();
-    callback.Reset();
-  }
-
-  uv_work_t request;
-
-  Nan::Persistent<Object> handle;
-  DBHandle* handle_ptr;
-
-  Nan::Persistent<Function> callback;
-};
-
-void InterruptWork(uv_work_t* req) {
-  InterruptRequest* intr_req = static_cast<InterruptRequest*>(req->data);
-  sqlite3_interrupt(intr_req->handle_ptr->db_);
-}
-
-void InterruptAfter(uv_work_t* req, int status) {
-  Nan::HandleScope scope;
-  InterruptRequest* intr_req = static_cast<InterruptRequest*>(req->data);
-  Local<Object> handle = Nan::New(intr_req->handle);
-  Local<Function> callback = Nan::New(intr_req->callback);
-  --intr_req->handle_ptr->working_;
-
-  intr_req->runInAsyncScope(handle, callback, 0, nullptr);
-
-  delete intr_req;
-}
-
 class FinalizeRequest : public Nan::AsyncResource {
 public:
   FinalizeRequest(Local<Object> handle_,
@@ -1017,314 +2184,2457 @@ void FinalizeAfter(uv_work_t* req, int status) {
   delete final_req;
 }
 
-int sqlite_authorizer(void* baton, int code, const char* arg1, const char* arg2,
-                      const char* arg3, const char* arg4) {
-  AuthorizerRequest* req = static_cast<AuthorizerRequest*>(baton);
+// A single statement that is executed in one go, either as part of a batch
+// executed within a single transaction or synchronously
+struct BatchItem {
+  BatchItem()
+    : params_type(BindParamsType::None),
+      params(nullptr),
+      prepare_flags(0),
+      query_flags(0),
+      col_count(0),
+      sqlite_status(0),
+      error(nullptr),
+      changes(0),
+      last_insert_rowid(0),
+      total_changes(0) {}
 
-  if (req->filter.size() > 0 && req->filter.count(code) == 0)
-    return req->nomatch_result;
+  string sql;
+  BindParamsType params_type;
+  void* params;
+  unsigned int prepare_flags;
+  uint32_t query_flags;
+  int col_count;
+  vector<vector<RowValue>> rows;
+  int sqlite_status;
+  char* error;
+  int64_t changes;
+  int64_t last_insert_rowid;
+  int64_t total_changes;
+};
 
-  int result;
-  uv_mutex_lock(&req->mutex);
-  req->code = code;
-  req->arg1 = arg1;
-  req->arg2 = arg2;
-  req->arg3 = arg3;
-  req->arg4 = arg4;
-  req->result = -1;
+static void free_item(BatchItem& item) {
+  free_bind_params(item.params_type, item.params);
+  item.params_type = BindParamsType::None;
+  free_rows(item.rows);
+  if (item.error) {
+    free(item.error);
+    item.error = nullptr;
+  }
+}
 
-  int status = uv_async_send(&req->async);
-  assert(status == 0);
+// Indexed by the `begin_type` of a batch
+static const char* BEGIN_SQL[] = {
+  "BEGIN DEFERRED",
+  "BEGIN IMMEDIATE",
+  "BEGIN EXCLUSIVE",
+};
 
-  while (req->result == -1)
-    uv_cond_wait(&req->cond, &req->mutex);
-  result = req->result;
+class BatchRequest : public Nan::AsyncResource {
+public:
+  BatchRequest(Local<Object> handle_,
+               DBHandle* handle_ptr_,
+               uint32_t begin_type_,
+               bool atomic_,
+               Local<Function> callback_)
+    : Nan::AsyncResource("esqlite:BatchRequest"),
+      handle_ptr(handle_ptr_),
+      begin_type(begin_type_),
+      atomic(atomic_),
+      committing(false),
+      busy_retries(0),
+      busy_wait_ns(0),
+      retry_delay_ms(0),
+      retry_start(0),
+      sqlite_status(0),
+      error(nullptr),
+      failed_index(-1) {
+    handle.Reset(handle_);
+    callback.Reset(callback_);
+    request.data = this;
+  }
 
-  uv_mutex_unlock(&req->mutex);
-  return result;
-}
+  ~BatchRequest() {
+    handle.Reset();
+    callback.Reset();
+    for (auto& item : items)
+      free_item(item);
+    if (error)
+      free(error);
+  }
 
-int sqlite_authorizer_simple(void* baton, int code, const char* arg1,
-                             const char* arg2, const char* arg3,
-                             const char* arg4) {
-  AuthorizerRequest* req = static_cast<AuthorizerRequest*>(baton);
-  return (
-    req->filter.size() > 0 && req->filter.count(code) > 0
-    ? req->match_result
-    : req->nomatch_result
-  );
+  uv_work_t request;
+
+  Nan::Persistent<Object> handle;
+  Nan::Persistent<Function> callback;
+  DBHandle* handle_ptr;
+  vector<BatchItem> items;
+  uint32_t begin_type;
+  bool atomic;
+
+  // Busy retry state (see `schedule_busy_retry()`). `BEGIN` and `COMMIT` are
+  // retried after SQLITE_BUSY, with `committing` set when the items have
+  // already been executed and only the commit is left.
+  bool committing;
+  uint32_t busy_retries;
+  uint64_t busy_wait_ns;
+  uint32_t retry_delay_ms;
+  uint64_t retry_start;
+
+  // Set when the batch as a whole failed (e.g. the transaction could not be
+  // started or committed), in which case none of the items took effect.
+  // `failed_index` is the item that caused the failure, if any.
+  int sqlite_status;
+  char* error;
+  int64_t failed_index;
+};
+
+static bool schedule_batch_retry(BatchRequest* batch_req) {
+  batch_req->retry_delay_ms = busy_retry_delay(batch_req->handle_ptr,
+                                               batch_req->busy_retries,
+                                               batch_req->busy_wait_ns);
+  return (batch_req->retry_delay_ms != 0);
 }
 
-DBHandle::DBHandle(Local<Function> make_rows_fn_,
-                   Local<Function> make_obj_row_fn_,
-                   Local<Function> make_arr_row_fn_,
-                   Local<Function> status_callback_)
-  : db_(nullptr), working_(0), cur_req(nullptr), authorizeReq(nullptr) {
-  make_rows_fn.Reset(make_rows_fn_);
-  make_obj_row_fn.Reset(make_obj_row_fn_);
-  make_arr_row_fn.Reset(make_arr_row_fn_);
-  status_callback.Reset(status_callback_);
+static inline int batch_exec(sqlite3* db, const char* sql) {
+  return sqlite3_exec(db, sql, nullptr, nullptr, nullptr);
 }
-DBHandle::~DBHandle() {
-  if (db_)
-    sqlite3_close_v2(db_);
-  make_rows_fn.Reset();
-  make_obj_row_fn.Reset();
-  make_arr_row_fn.Reset();
-  if (authorizeReq)
-    authorizeReq->close();
-  status_callback.Reset();
+
+// Executes the first statement in an item's SQL, collecting any rows
+static void run_item(sqlite3* db, BatchItem& item) {
+  sqlite3_stmt* stmt = nullptr;
+  const char* pos = item.sql.c_str();
+  size_t remaining = item.sql.size();
+  int res;
+  while (true) {
+    const char* tail;
+    res = sqlite3_prepare_v3(db,
+                             pos,
+                             remaining,
+                             item.prepare_flags,
+                             &stmt,
+                             &tail);
+    if (res != SQLITE_OK) {
+      item.error = strdup(sqlite3_errmsg(db));
+      item.sqlite_status = res;
+      return;
+    }
+    remaining -= (tail - pos);
+    pos = tail;
+    if (stmt)
+      break;
+    if (!remaining) {
+      // Only whitespace and/or comments
+      return;
+    }
+  }
+
+  size_t list_pos = 0;
+  if (!bind_params(stmt, item.params_type, item.params, &list_pos, &res)
+      || res != SQLITE_OK) {
+    item.error = strdup(
+      res == SQLITE_OK ? "Invalid bind param type" : sqlite3_errmsg(db)
+    );
+    item.sqlite_status = -1;
+    sqlite3_finalize(stmt);
+    return;
+  }
+
+  uint32_t flags = item.query_flags;
+  item.col_count = sqlite3_column_count(stmt);
+  int ncols = ((flags & QueryFlag::Pluck) ? 1 : item.col_count);
+  bool first_row = true;
+  sqlite3_int64 start_total_changes = sqlite3_total_changes64(db);
+  while ((res = sqlite3_step(stmt)) == SQLITE_ROW) {
+    if (!item.col_count || (flags & QueryFlag::NoRows))
+      continue;
+    if (first_row
+        && !(flags & (QueryFlag::RowsAsArray | QueryFlag::Pluck))) {
+      push_column_names(stmt, item.col_count, item.rows);
+    }
+    first_row = false;
+    push_row(stmt, ncols, item.rows);
+    if (flags & QueryFlag::SingleRow) {
+      res = SQLITE_DONE;
+      break;
+    }
+  }
+  if (res == SQLITE_DONE) {
+    item.total_changes = sqlite3_total_changes64(db);
+    item.changes = (item.total_changes != start_total_changes
+                    ? sqlite3_changes64(db)
+                    : 0);
+    item.last_insert_rowid = sqlite3_last_insert_rowid(db);
+  } else {
+    item.error = strdup(sqlite3_errmsg(db));
+    item.sqlite_status = res;
+    free_rows(item.rows);
+    ChangeNotifier::statement_failed(stmt);
+  }
+  sqlite3_finalize(stmt);
 }
 
-NAN_METHOD(DBHandle::New) {
-  if (!info.IsConstructCall())
-    return Nan::ThrowError("Use `new` to create instances");
+static void batch_fail(BatchRequest* batch_req, sqlite3* db, int res) {
+  batch_req->error = strdup(sqlite3_errmsg(db));
+  batch_req->sqlite_status = res;
+}
 
-  Local<Value> auth_fn = info[3];
-  Local<Value> auth_filter = info[4];
-  Local<Value> auth_match_result = info[5];
-  Local<Value> auth_nomatch_result = info[6];
+// Runs all items inside one transaction. If the connection is already inside a
+// transaction, a savepoint is used in place of the outer transaction.
+//
+// In atomic mode, the first failing item rolls back the entire batch.
+// Otherwise each item runs within its own savepoint so that a failing item is
+// rolled back without affecting the others.
+void BatchWork(uv_work_t* req) {
+  BatchRequest* batch_req = static_cast<BatchRequest*>(req->data);
+  sqlite3* db = batch_req->handle_ptr->db_;
+  // Only batches that started their own transaction are ever retried
+  bool nested = (!batch_req->committing && !sqlite3_get_autocommit(db));
+  bool atomic = batch_req->atomic;
+  int res;
 
-  DBHandle* obj = new DBHandle(
+  if (batch_req->committing)
+    goto commit;
+
+  res = batch_exec(db, nested
+                       ? "SAVEPOINT esqlite_batch"
+                       : BEGIN_SQL[batch_req->begin_type]);
+  if (res != SQLITE_OK) {
+    // Nothing has been executed yet, so the batch can simply start over later
+    if (!nested
+        && (res & 0xFF) == SQLITE_BUSY
+        && schedule_batch_retry(batch_req)) {
+      return;
+    }
+    return batch_fail(batch_req, db, res);
+  }
+
+  for (size_t i = 0; i < batch_req->items.size(); ++i) {
+    BatchItem& item = batch_req->items[i];
+    if (!atomic) {
+      res = batch_exec(db, "SAVEPOINT esqlite_item");
+      if (res != SQLITE_OK)
+        goto rollback;
+    }
+    run_item(db, item);
+    if (item.error) {
+      // In non-atomic mode, the batch as a whole only fails if SQLite already
+      // rolled back the entire transaction (e.g. because of an I/O error)
+      if (atomic || sqlite3_get_autocommit(db)) {
+        batch_req->error = strdup(item.error);
+        batch_req->sqlite_status = item.sqlite_status;
+        batch_req->failed_index = static_cast<int64_t>(i);
+        goto undo;
+      }
+      res = batch_exec(db, "ROLLBACK TO esqlite_item");
+      if (res != SQLITE_OK)
+        goto rollback;
+    }
+    if (!atomic) {
+      res = batch_exec(db, "RELEASE esqlite_item");
+      if (res != SQLITE_OK)
+        goto rollback;
+    }
+  }
+
+commit:
+  batch_req->committing = false;
+  res = batch_exec(db, nested ? "RELEASE esqlite_batch" : "COMMIT");
+  if (res == SQLITE_OK)
+    return;
+  // A COMMIT that fails with SQLITE_BUSY leaves the transaction open, so just
+  // the COMMIT can be attempted again later
+  if (!nested
+      && (res & 0xFF) == SQLITE_BUSY
+      && !sqlite3_get_autocommit(db)
+      && schedule_batch_retry(batch_req)) {
+    batch_req->committing = true;
+    return;
+  }
+
+rollback:
+  batch_fail(batch_req, db, res);
+undo:
+  if (nested) {
+    batch_exec(db, "ROLLBACK TO esqlite_batch");
+    batch_exec(db, "RELEASE esqlite_batch");
+  } else if (!sqlite3_get_autocommit(db)) {
+    batch_exec(db, "ROLLBACK");
+  }
+}
+
+// Converts the result of a successfully executed item. This is an array of
+// rows (or values, or a single row), or an object with the statement's change
+// counters for items that discard rows.
+static Local<Value> item_to_js(Nan::AsyncResource* async_res,
+                               DBHandle* handle_ptr,
+                               BatchItem& item) {
+  uint32_t flags = item.query_flags;
+  if (flags & QueryFlag::NoRows) {
+    Local<Object> info = Nan::New<Object>();
+    Nan::Set(info,
+             Nan::New("changes").ToLocalChecked(),
+             int64_to_js(item.changes)).FromJust();
+    Nan::Set(info,
+             Nan::New("lastInsertRowid").ToLocalChecked(),
+             int64_to_js(item.last_insert_rowid)).FromJust();
+    Nan::Set(info,
+             Nan::New("totalChanges").ToLocalChecked(),
+             int64_to_js(item.total_changes)).FromJust();
+    return info;
+  }
+  if (item.rows.size() == 0)
+    return Nan::New<Array>(0);
+
+  Local<Array> rows;
+  if (flags & QueryFlag::Pluck) {
+    rows = values_to_js(item.rows);
+  } else if (flags & QueryFlag::SingleRow) {
+    rows = Nan::New<Array>(1);
+    Nan::Set(rows, 0, single_row_to_js(item.rows,
+                                        item.col_count,
+                                        flags & QueryFlag::RowsAsArray))
+      .FromJust();
+  } else {
+    Nan::Persistent<Function> row_fn;
+    rows = rows_to_js(async_res,
+                      handle_ptr,
+                      item.rows,
+                      item.col_count,
+                      flags & QueryFlag::RowsAsArray,
+                      row_fn);
+    row_fn.Reset();
+  }
+  // The values are owned by JS now
+  item.rows.clear();
+  return rows;
+}
+
+void BatchAfter(uv_work_t* req, int status);
+
+static void batch_retry_cb(uv_timer_t* timer) {
+  BatchRequest* batch_req = static_cast<BatchRequest*>(timer->data);
+  uv_close(reinterpret_cast<uv_handle_t*>(timer), free_timer);
+  batch_req->busy_wait_ns += (uv_hrtime() - batch_req->retry_start);
+  ++batch_req->busy_retries;
+
+  int status = uv_queue_work(
+    uv_default_loop(),
+    &batch_req->request,
+    BatchWork,
+    reinterpret_cast<uv_after_work_cb>(BatchAfter)
+  );
+  assert(status == 0);
+}
+
+void BatchAfter(uv_work_t* req, int status) {
+  Nan::HandleScope scope;
+  BatchRequest* batch_req = static_cast<BatchRequest*>(req->data);
+
+  if (batch_req->retry_delay_ms) {
+    // Give the thread back and try again after a delay, as with queries
+    uv_timer_t* timer = new uv_timer_t;
+    int r = uv_timer_init(uv_default_loop(), timer);
+    assert(r == 0);
+    timer->data = batch_req;
+    batch_req->retry_start = uv_hrtime();
+    r = uv_timer_start(timer, batch_retry_cb, batch_req->retry_delay_ms, 0);
+    assert(r == 0);
+    batch_req->retry_delay_ms = 0;
+    return;
+  }
+
+  Local<Object> handle = Nan::New(batch_req->handle);
+  Local<Function> callback = Nan::New(batch_req->callback);
+
+  --batch_req->handle_ptr->working_;
+
+  Local<Value> argv[2];
+  if (batch_req->error) {
+    argv[0] = sqlite_error(batch_req->error, batch_req->sqlite_status);
+    if (batch_req->failed_index >= 0) {
+      Nan::Set(
+        Nan::To<Object>(argv[0]).ToLocalChecked(),
+        Nan::New("index").ToLocalChecked(),
+        Nan::New<Number>(static_cast<double>(batch_req->failed_index))
+      ).FromJust();
+    }
+    argv[1] = Nan::Undefined();
+  } else {
+    // Each result is either the item's converted result or an Error
+    Local<Array> results = Nan::New<Array>(batch_req->items.size());
+    for (size_t i = 0; i < batch_req->items.size(); ++i) {
+      BatchItem& item = batch_req->items[i];
+      Local<Value> result;
+      if (item.error)
+        result = sqlite_error(item.error, item.sqlite_status);
+      else
+        result = item_to_js(batch_req, batch_req->handle_ptr, item);
+      Nan::Set(results, i, result).FromJust();
+    }
+    argv[0] = Nan::Null();
+    argv[1] = results;
+  }
+
+  batch_req->runInAsyncScope(handle, callback, 2, argv);
+
+  delete batch_req;
+}
+
+class ExecRequest : public Nan::AsyncResource {
+public:
+  ExecRequest(Local<Object> handle_,
+              DBHandle* handle_ptr_,
+              Local<Value> sql_str_,
+              Local<Function> callback_)
+    : Nan::AsyncResource("esqlite:ExecRequest"),
+      handle_ptr(handle_ptr_),
+      sql_utf8str(sql_str_),
+      sql_pos(0),
+      busy_retries(0),
+      busy_wait_ns(0),
+      retry_delay_ms(0),
+      retry_start(0),
+      sqlite_status(0),
+      error(nullptr),
+      error_offset(0) {
+    handle.Reset(handle_);
+    callback.Reset(callback_);
+    request.data = this;
+  }
+
+  ~ExecRequest() {
+    handle.Reset();
+    callback.Reset();
+    if (error)
+      free(error);
+  }
+
+  uv_work_t request;
+
+  Nan::Persistent<Object> handle;
+  Nan::Persistent<Function> callback;
+  DBHandle* handle_ptr;
+  Nan::Utf8String sql_utf8str;
+  // Byte offset (within the UTF-8 encoded SQL) of the next statement
+  size_t sql_pos;
+
+  // Busy retry state, see `schedule_busy_retry()`
+  uint32_t busy_retries;
+  uint64_t busy_wait_ns;
+  uint32_t retry_delay_ms;
+  uint64_t retry_start;
+
+  int sqlite_status;
+  char* error;
+  // Byte offset (within the UTF-8 encoded SQL) of the error
+  size_t error_offset;
+};
+
+// Executes every statement in the SQL one after the other, discarding any rows,
+// until the end of the SQL is reached or a statement fails
+void ExecWork(uv_work_t* req) {
+  ExecRequest* exec_req = static_cast<ExecRequest*>(req->data);
+  sqlite3* db = exec_req->handle_ptr->db_;
+  const char* start = *exec_req->sql_utf8str;
+  const char* pos = start + exec_req->sql_pos;
+  size_t remaining = exec_req->sql_utf8str.length() - exec_req->sql_pos;
+
+  while (remaining) {
+    sqlite3_stmt* stmt = nullptr;
+    const char* tail;
+    int res = sqlite3_prepare_v3(db, pos, remaining, 0, &stmt, &tail);
+    bool had_rows = false;
+    if (res == SQLITE_OK && stmt) {
+      while ((res = sqlite3_step(stmt)) == SQLITE_ROW)
+        had_rows = true;
+      if (res == SQLITE_DONE)
+        res = SQLITE_OK;
+    }
+    // Like queries, a statement that has not produced any rows yet and that
+    // ran in its own (implicit) transaction can be started over later on
+    if ((res & 0xFF) == SQLITE_BUSY
+        && !had_rows
+        && sqlite3_get_autocommit(db)) {
+      exec_req->retry_delay_ms = busy_retry_delay(exec_req->handle_ptr,
+                                                  exec_req->busy_retries,
+                                                  exec_req->busy_wait_ns);
+      if (exec_req->retry_delay_ms) {
+        sqlite3_finalize(stmt);
+        exec_req->sql_pos = (pos - start);
+        return;
+      }
+    }
+    if (res != SQLITE_OK) {
+      // For syntax errors and the like, SQLite knows the position of the
+      // offending token within the statement
+      int token_offset = sqlite3_error_offset(db);
+      exec_req->error = strdup(sqlite3_errmsg(db));
+      exec_req->sqlite_status = res;
+      exec_req->error_offset =
+        (pos - start) + (token_offset >= 0 ? token_offset : 0);
+      ChangeNotifier::statement_failed(stmt);
+      sqlite3_finalize(stmt);
+      return;
+    }
+    sqlite3_finalize(stmt);
+    remaining -= (tail - pos);
+    pos = tail;
+  }
+}
+
+void ExecAfter(uv_work_t* req, int status);
+
+static void exec_retry_cb(uv_timer_t* timer) {
+  ExecRequest* exec_req = static_cast<ExecRequest*>(timer->data);
+  uv_close(reinterpret_cast<uv_handle_t*>(timer), free_timer);
+  exec_req->busy_wait_ns += (uv_hrtime() - exec_req->retry_start);
+  ++exec_req->busy_retries;
+
+  int status = uv_queue_work(
+    uv_default_loop(),
+    &exec_req->request,
+    ExecWork,
+    reinterpret_cast<uv_after_work_cb>(ExecAfter)
+  );
+  assert(status == 0);
+}
+
+void ExecAfter(uv_work_t* req, int status) {
+  Nan::HandleScope scope;
+  ExecRequest* exec_req = static_cast<ExecRequest*>(req->data);
+
+  if (exec_req->retry_delay_ms) {
+    // Give the thread back and continue with the same statement after a delay
+    uv_timer_t* timer = new uv_timer_t;
+    int r = uv_timer_init(uv_default_loop(), timer);
+    assert(r == 0);
+    timer->data = exec_req;
+    exec_req->retry_start = uv_hrtime();
+    r = uv_timer_start(timer, exec_retry_cb, exec_req->retry_delay_ms, 0);
+    assert(r == 0);
+    exec_req->retry_delay_ms = 0;
+    return;
+  }
+
+  Local<Object> handle = Nan::New(exec_req->handle);
+  Local<Function> callback = Nan::New(exec_req->callback);
+
+  --exec_req->handle_ptr->working_;
+
+  Local<Value> argv[1];
+  if (exec_req->error) {
+    argv[0] = sqlite_error(exec_req->error, exec_req->sqlite_status);
+    Nan::Set(
+      Nan::To<Object>(argv[0]).ToLocalChecked(),
+      Nan::New("offset").ToLocalChecked(),
+      Nan::New<Number>(static_cast<double>(exec_req->error_offset))
+    ).FromJust();
+  } else {
+    argv[0] = Nan::Null();
+  }
+
+  exec_req->runInAsyncScope(handle, callback, 1, argv);
+
+  delete exec_req;
+}
+
+enum class BlobOp {
+  Open,
+  Read,
+  Write,
+  Close,
+};
+
+// An incremental blob I/O operation. Each operation is executed on the
+// threadpool like any other request, so that large values can be transferred
+// in chunks without blocking the event loop.
+class BlobRequest : public Nan::AsyncResource {
+public:
+  BlobRequest(Local<Object> handle_,
+              DBHandle* handle_ptr_,
+              BlobOp op_,
+              Local<Function> callback_)
+    : Nan::AsyncResource("esqlite:BlobRequest"),
+      handle_ptr(handle_ptr_),
+      op(op_),
+      rowid(0),
+      writable(0),
+      blob(nullptr),
+      offset(0),
+      length(0),
+      data(nullptr),
+      sqlite_status(0),
+      error(nullptr) {
+    handle.Reset(handle_);
+    callback.Reset(callback_);
+    request.data = this;
+  }
+
+  ~BlobRequest() {
+    handle.Reset();
+    callback.Reset();
+    buffer.Reset();
+    if (op == BlobOp::Read && data)
+      free(data);
+    if (error)
+      free(error);
+  }
+
+  uv_work_t request;
+
+  Nan::Persistent<Object> handle;
+  Nan::Persistent<Function> callback;
+  DBHandle* handle_ptr;
+  BlobOp op;
+
+  // Open
+  string db_name;
+  string table;
+  string column;
+  sqlite3_int64 rowid;
+  int writable;
+
+  sqlite3_blob* blob;
+
+  // Read/Write. For writes, `data` points into `buffer`.
+  int offset;
+  int length;
+  char* data;
+  Nan::Persistent<Object> buffer;
+
+  int sqlite_status;
+  char* error;
+};
+
+void BlobWork(uv_work_t* req) {
+  BlobRequest* blob_req = static_cast<BlobRequest*>(req->data);
+  sqlite3* db = blob_req->handle_ptr->db_;
+
+  int res = SQLITE_OK;
+  switch (blob_req->op) {
+    case BlobOp::Open:
+      res = sqlite3_blob_open(db,
+                              blob_req->db_name.c_str(),
+                              blob_req->table.c_str(),
+                              blob_req->column.c_str(),
+                              blob_req->rowid,
+                              blob_req->writable,
+                              &blob_req->blob);
+      if (res == SQLITE_OK)
+        blob_req->length = sqlite3_blob_bytes(blob_req->blob);
+      break;
+    case BlobOp::Read:
+      blob_req->data = static_cast<char*>(malloc(blob_req->length));
+      if (!blob_req->data && blob_req->length > 0) {
+        res = SQLITE_NOMEM;
+        break;
+      }
+      res = sqlite3_blob_read(blob_req->blob,
+                              blob_req->data,
+                              blob_req->length,
+                              blob_req->offset);
+      break;
+    case BlobOp::Write:
+      res = sqlite3_blob_write(blob_req->blob,
+                               blob_req->data,
+                               blob_req->length,
+                               blob_req->offset);
+      break;
+    case BlobOp::Close:
+      res = sqlite3_blob_close(blob_req->blob);
+      break;
+  }
+
+  if (res != SQLITE_OK) {
+    blob_req->sqlite_status = res;
+    blob_req->error = strdup(res == SQLITE_NOMEM
+                             ? sqlite3_errstr(res)
+                             : sqlite3_errmsg(db));
+  }
+}
+
+void BlobAfter(uv_work_t* req, int status) {
+  Nan::HandleScope scope;
+  BlobRequest* blob_req = static_cast<BlobRequest*>(req->data);
+  DBHandle* handle_ptr = blob_req->handle_ptr;
+  Local<Object> handle = Nan::New(blob_req->handle);
+  Local<Function> callback = Nan::New(blob_req->callback);
+
+  --handle_ptr->working_;
+
+  int argc = 1;
+  Local<Value> argv[2];
+  if (blob_req->error) {
+    argv[0] = sqlite_error(blob_req->error, blob_req->sqlite_status);
+  } else {
+    argv[0] = Nan::Null();
+    switch (blob_req->op) {
+      case BlobOp::Open: {
+        uint32_t id = ++handle_ptr->next_blob_id;
+        handle_ptr->blobs[id] = blob_req->blob;
+        Local<Array> result = Nan::New<Array>(2);
+        Nan::Set(result, 0, Nan::New<Number>(id)).FromJust();
+        Nan::Set(result, 1, Nan::New<Number>(blob_req->length)).FromJust();
+        argv[argc++] = result;
+        break;
+      }
+      case BlobOp::Read:
+        // The buffer takes ownership of the data
+        argv[argc++] = Nan::NewBuffer(blob_req->data,
+                                      blob_req->length).ToLocalChecked();
+        blob_req->data = nullptr;
+        break;
+      default:
+        break;
+    }
+  }
+
+  blob_req->runInAsyncScope(handle, callback, argc, argv);
+
+  delete blob_req;
+}
+
+enum class BackupOp {
+  Init,
+  Step,
+  Finish,
+};
+
+// A step of an online backup. Like blob I/O, every step is a separate request
+// so that other requests can run in between steps.
+class BackupRequest : public Nan::AsyncResource {
+public:
+  BackupRequest(Local<Object> handle_,
+                DBHandle* handle_ptr_,
+                BackupOp op_,
+                Local<Function> callback_)
+    : Nan::AsyncResource("esqlite:BackupRequest"),
+      handle_ptr(handle_ptr_),
+      op(op_),
+      backup(nullptr),
+      dest(nullptr),
+      pages(0),
+      done(false),
+      remaining(0),
+      page_count(0),
+      sqlite_status(0),
+      error(nullptr) {
+    handle.Reset(handle_);
+    callback.Reset(callback_);
+    request.data = this;
+  }
+
+  ~BackupRequest() {
+    handle.Reset();
+    callback.Reset();
+    if (error)
+      free(error);
+  }
+
+  uv_work_t request;
+
+  Nan::Persistent<Object> handle;
+  Nan::Persistent<Function> callback;
+  DBHandle* handle_ptr;
+  BackupOp op;
+
+  // Init
+  string dest_path;
+  string db_name;
+  string cipher;
+  string key;
+
+  sqlite3_backup* backup;
+  sqlite3* dest;
+
+  // Step
+  int pages;
+  bool done;
+  int remaining;
+  int page_count;
+
+  int sqlite_status;
+  char* error;
+};
+
+void BackupWork(uv_work_t* req) {
+  BackupRequest* backup_req = static_cast<BackupRequest*>(req->data);
+  sqlite3* db = backup_req->handle_ptr->db_;
+
+  int res = SQLITE_OK;
+  switch (backup_req->op) {
+    case BackupOp::Init: {
+      res = sqlite3_open_v2(
+        backup_req->dest_path.c_str(),
+        &backup_req->dest,
+        SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE | SQLITE_OPEN_NOMUTEX,
+        nullptr
+      );
+      if (res != SQLITE_OK)
+        break;
+      if (backup_req->cipher.size()) {
+        int cipher_idx = sqlite3mc_cipher_index(backup_req->cipher.c_str());
+        if (cipher_idx <= 0) {
+          backup_req->sqlite_status = SQLITE_ERROR;
+          backup_req->error = strdup("Unknown cipher");
+          break;
+        }
+        sqlite3mc_config(backup_req->dest, "cipher", cipher_idx);
+      }
+      if (backup_req->key.size()) {
+        res = sqlite3_key_v2(backup_req->dest,
+                             "main",
+                             backup_req->key.data(),
+                             static_cast<int>(backup_req->key.size()));
+        if (res != SQLITE_OK)
+          break;
+      }
+      backup_req->backup = sqlite3_backup_init(backup_req->dest,
+                                               "main",
+                                               db,
+                                               backup_req->db_name.c_str());
+      if (!backup_req->backup)
+        res = sqlite3_errcode(backup_req->dest);
+      break;
+    }
+    case BackupOp::Step:
+      res = sqlite3_backup_step(backup_req->backup, backup_req->pages);
+      switch (res) {
+        case SQLITE_DONE:
+          backup_req->done = true;
+          // FALLTHROUGH
+        case SQLITE_OK:
+        case SQLITE_BUSY:
+        case SQLITE_LOCKED:
+          // A locked source or destination is simply retried on the next step
+          res = SQLITE_OK;
+          break;
+      }
+      backup_req->remaining = sqlite3_backup_remaining(backup_req->backup);
+      backup_req->page_count = sqlite3_backup_pagecount(backup_req->backup);
+      break;
+    case BackupOp::Finish:
+      res = sqlite3_backup_finish(backup_req->backup);
+      break;
+  }
+
+  if (res != SQLITE_OK && !backup_req->error) {
+    backup_req->sqlite_status = res;
+    // Backup errors are reported through the destination connection
+    backup_req->error = strdup(backup_req->dest
+                               ? sqlite3_errmsg(backup_req->dest)
+                               : sqlite3_errstr(res));
+  }
+
+  if (backup_req->op == BackupOp::Finish
+      || (backup_req->op == BackupOp::Init && backup_req->error)) {
+    sqlite3_close_v2(backup_req->dest);
+    backup_req->dest = nullptr;
+  }
+}
+
+void BackupAfter(uv_work_t* req, int status) {
+  Nan::HandleScope scope;
+  BackupRequest* backup_req = static_cast<BackupRequest*>(req->data);
+  DBHandle* handle_ptr = backup_req->handle_ptr;
+  Local<Object> handle = Nan::New(backup_req->handle);
+  Local<Function> callback = Nan::New(backup_req->callback);
+
+  --handle_ptr->working_;
+
+  int argc = 1;
+  Local<Value> argv[2];
+  if (backup_req->error) {
+    argv[0] = sqlite_error(backup_req->error, backup_req->sqlite_status);
+  } else {
+    argv[0] = Nan::Null();
+    switch (backup_req->op) {
+      case BackupOp::Init: {
+        uint32_t id = ++handle_ptr->next_backup_id;
+        handle_ptr->backups[id] = make_pair(backup_req->backup,
+                                            backup_req->dest);
+        argv[argc++] = Nan::New<Number>(id);
+        break;
+      }
+      case BackupOp::Step: {
+        Local<Array> result = Nan::New<Array>(3);
+        Nan::Set(result, 0, Nan::New<Boolean>(backup_req->done)).FromJust();
+        Nan::Set(result,
+                 1,
+                 Nan::New<Number>(backup_req->remaining)).FromJust();
+        Nan::Set(result,
+                 2,
+                 Nan::New<Number>(backup_req->page_count)).FromJust();
+        argv[argc++] = result;
+        break;
+      }
+      default:
+        break;
+    }
+  }
+
+  backup_req->runInAsyncScope(handle, callback, argc, argv);
+
+  delete backup_req;
+}
+
+// Serializes a database into a newly allocated image, or replaces a database's
+// contents with an image
+class SerializeRequest : public Nan::AsyncResource {
+public:
+  SerializeRequest(Local<Object> handle_,
+                   DBHandle* handle_ptr_,
+                   Local<Value> schema_,
+                   Local<Function> callback_)
+    : Nan::AsyncResource("esqlite:SerializeRequest"),
+      handle_ptr(handle_ptr_),
+      schema(schema_),
+      data(nullptr),
+      size(0),
+      readonly(false),
+      sqlite_status(0),
+      error(nullptr) {
+    handle.Reset(handle_);
+    callback.Reset(callback_);
+    request.data = this;
+  }
+
+  ~SerializeRequest() {
+    handle.Reset();
+    callback.Reset();
+    // Only a serialized image is owned by the request
+    if (image.IsEmpty() && data)
+      sqlite3_free(data);
+    image.Reset();
+    if (error)
+      free(error);
+  }
+
+  uv_work_t request;
+
+  Nan::Persistent<Object> handle;
+  Nan::Persistent<Function> callback;
+  DBHandle* handle_ptr;
+  Nan::Utf8String schema;
+
+  // When deserializing, `image` holds the source Buffer and `data` points into
+  // it
+  Nan::Persistent<Object> image;
+  unsigned char* data;
+  sqlite3_int64 size;
+  bool readonly;
+
+  int sqlite_status;
+  char* error;
+};
+
+void SerializeWork(uv_work_t* req) {
+  SerializeRequest* ser_req = static_cast<SerializeRequest*>(req->data);
+  sqlite3* db = ser_req->handle_ptr->db_;
+
+  // The image is a copy owned by the caller. SQLITE_SERIALIZE_NOCOPY would
+  // expose the database's own memory, which changes with every write.
+  ser_req->data = sqlite3_serialize(db, *ser_req->schema, &ser_req->size, 0);
+  if (!ser_req->data) {
+    // An empty database has no image at all
+    ser_req->size = 0;
+    if (!sqlite3_db_filename(db, *ser_req->schema)) {
+      ser_req->sqlite_status = SQLITE_ERROR;
+      ser_req->error = strdup("Unknown database");
+    }
+  }
+}
+
+// Frees memory handed over to a Buffer by SQLite
+static void free_sqlite_mem(char* data, void* hint) {
+  sqlite3_free(data);
+}
+
+void SerializeAfter(uv_work_t* req, int status) {
+  Nan::HandleScope scope;
+  SerializeRequest* ser_req = static_cast<SerializeRequest*>(req->data);
+  Local<Object> handle = Nan::New(ser_req->handle);
+  Local<Function> callback = Nan::New(ser_req->callback);
+
+  --ser_req->handle_ptr->working_;
+
+  int argc = 1;
+  Local<Value> argv[2];
+  if (ser_req->error) {
+    argv[0] = sqlite_error(ser_req->error, ser_req->sqlite_status);
+  } else {
+    argv[0] = Nan::Null();
+    if (ser_req->data) {
+      // The buffer takes ownership of the image, avoiding another copy
+      argv[argc++] = Nan::NewBuffer(reinterpret_cast<char*>(ser_req->data),
+                                    static_cast<size_t>(ser_req->size),
+                                    free_sqlite_mem,
+                                    nullptr).ToLocalChecked();
+      ser_req->data = nullptr;
+    } else {
+      argv[argc++] = Nan::NewBuffer(0).ToLocalChecked();
+    }
+  }
+
+  ser_req->runInAsyncScope(handle, callback, argc, argv);
+
+  delete ser_req;
+}
+
+void DeserializeWork(uv_work_t* req) {
+  SerializeRequest* ser_req = static_cast<SerializeRequest*>(req->data);
+  sqlite3* db = ser_req->handle_ptr->db_;
+
+  unsigned char* data = ser_req->data;
+  unsigned int flags;
+  if (ser_req->readonly) {
+    // SQLite reads the Buffer in place, which is kept alive by the handle
+    flags = SQLITE_DESERIALIZE_READONLY;
+  } else {
+    // SQLite needs memory it can resize and free itself
+    data = static_cast<unsigned char*>(sqlite3_malloc64(ser_req->size));
+    if (!data && ser_req->size > 0) {
+      ser_req->sqlite_status = SQLITE_NOMEM;
+      ser_req->error = strdup(sqlite3_errstr(SQLITE_NOMEM));
+      return;
+    }
+    memcpy(data, ser_req->data, ser_req->size);
+    flags = (SQLITE_DESERIALIZE_FREEONCLOSE | SQLITE_DESERIALIZE_RESIZEABLE);
+  }
+
+  // On failure, SQLite frees the data itself when FREEONCLOSE is set
+  int res = sqlite3_deserialize(db,
+                                *ser_req->schema,
+                                data,
+                                ser_req->size,
+                                ser_req->size,
+                                flags);
+  // Reading the schema makes sure the image is actually a database
+  if (res == SQLITE_OK)
+    res = sqlite3_exec(db, "PRAGMA schema_version", nullptr, nullptr, nullptr);
+  if (res != SQLITE_OK) {
+    ser_req->sqlite_status = res;
+    ser_req->error = strdup(sqlite3_errmsg(db));
+  }
+}
+
+void DeserializeAfter(uv_work_t* req, int status) {
+  Nan::HandleScope scope;
+  SerializeRequest* ser_req = static_cast<SerializeRequest*>(req->data);
+  DBHandle* handle_ptr = ser_req->handle_ptr;
+  Local<Object> handle = Nan::New(ser_req->handle);
+  Local<Function> callback = Nan::New(ser_req->callback);
+
+  --handle_ptr->working_;
+
+  Local<Value> argv[1];
+  if (ser_req->error) {
+    argv[0] = sqlite_error(ser_req->error, ser_req->sqlite_status);
+  } else {
+    argv[0] = Nan::Null();
+    if (ser_req->readonly)
+      handle_ptr->image.Reset(Nan::New(ser_req->image));
+  }
+
+  ser_req->runInAsyncScope(handle, callback, 1, argv);
+
+  delete ser_req;
+}
+
+enum class SessionOp {
+  Create,
+  Changeset,
+  Delete,
+  Apply,
+};
+
+// Conflict types are numbered from 1 (SQLITE_CHANGESET_DATA) to 5
+// (SQLITE_CHANGESET_FOREIGN_KEY)
+#define CONFLICT_TYPES 5
+
+// Session extension operations: recording changes made on the connection into
+// changesets, and applying changesets
+class SessionRequest : public Nan::AsyncResource {
+public:
+  SessionRequest(Local<Object> handle_,
+                 DBHandle* handle_ptr_,
+                 SessionOp op_,
+                 Local<Function> callback_)
+    : Nan::AsyncResource("esqlite:SessionRequest"),
+      handle_ptr(handle_ptr_),
+      op(op_),
+      session(nullptr),
+      all_tables(false),
+      patchset(false),
+      data(nullptr),
+      size(0),
+      sqlite_status(0),
+      error(nullptr) {
+    handle.Reset(handle_);
+    callback.Reset(callback_);
+    request.data = this;
+    for (int i = 0; i < CONFLICT_TYPES; ++i) {
+      conflict_actions[i] = SQLITE_CHANGESET_ABORT;
+      conflicts[i] = 0;
+    }
+  }
+
+  ~SessionRequest() {
+    handle.Reset();
+    callback.Reset();
+    // A changeset to be applied is owned by `changeset`
+    if (changeset.IsEmpty() && data)
+      sqlite3_free(data);
+    changeset.Reset();
+    if (error)
+      free(error);
+  }
+
+  // Resolves conflicts using the (per conflict type) actions chosen up front,
+  // so that applying never has to call into JS
+  static int on_conflict(void* ctx,
+                         int type,
+                         sqlite3_changeset_iter* iter) {
+    SessionRequest* req = static_cast<SessionRequest*>(ctx);
+    if (type < 1 || type > CONFLICT_TYPES)
+      return SQLITE_CHANGESET_ABORT;
+    ++req->conflicts[type - 1];
+    return req->conflict_actions[type - 1];
+  }
+
+  uv_work_t request;
+
+  Nan::Persistent<Object> handle;
+  Nan::Persistent<Function> callback;
+  DBHandle* handle_ptr;
+  SessionOp op;
+
+  sqlite3_session* session;
+
+  // Create
+  string db_name;
+  vector<string> tables;
+  bool all_tables;
+
+  // Changeset/Apply. When applying, `data` points into `changeset`.
+  bool patchset;
+  void* data;
+  int size;
+  Nan::Persistent<Object> changeset;
+  int conflict_actions[CONFLICT_TYPES];
+  uint32_t conflicts[CONFLICT_TYPES];
+
+  int sqlite_status;
+  char* error;
+};
+
+void SessionWork(uv_work_t* req) {
+  SessionRequest* sess_req = static_cast<SessionRequest*>(req->data);
+  sqlite3* db = sess_req->handle_ptr->db_;
+
+  int res = SQLITE_OK;
+  switch (sess_req->op) {
+    case SessionOp::Create:
+      res = sqlite3session_create(db,
+                                  sess_req->db_name.c_str(),
+                                  &sess_req->session);
+      if (res != SQLITE_OK)
+        break;
+      if (sess_req->all_tables) {
+        res = sqlite3session_attach(sess_req->session, nullptr);
+      } else {
+        for (const auto& table : sess_req->tables) {
+          res = sqlite3session_attach(sess_req->session, table.c_str());
+          if (res != SQLITE_OK)
+            break;
+        }
+      }
+      if (res != SQLITE_OK) {
+        sqlite3session_delete(sess_req->session);
+        sess_req->session = nullptr;
+      }
+      break;
+    case SessionOp::Changeset:
+      if (sess_req->patchset) {
+        res = sqlite3session_patchset(sess_req->session,
+                                      &sess_req->size,
+                                      &sess_req->data);
+      } else {
+        res = sqlite3session_changeset(sess_req->session,
+                                       &sess_req->size,
+                                       &sess_req->data);
+      }
+      break;
+    case SessionOp::Delete:
+      sqlite3session_delete(sess_req->session);
+      break;
+    case SessionOp::Apply:
+      res = sqlite3changeset_apply_v2(db,
+                                      sess_req->size,
+                                      sess_req->data,
+                                      nullptr,
+                                      SessionRequest::on_conflict,
+                                      sess_req,
+                                      nullptr,
+                                      nullptr,
+                                      0);
+      break;
+  }
+
+  if (res != SQLITE_OK) {
+    sess_req->sqlite_status = res;
+    sess_req->error = strdup(res == SQLITE_NOMEM
+                             ? sqlite3_errstr(res)
+                             : sqlite3_errmsg(db));
+  }
+}
+
+void SessionAfter(uv_work_t* req, int status) {
+  Nan::HandleScope scope;
+  SessionRequest* sess_req = static_cast<SessionRequest*>(req->data);
+  DBHandle* handle_ptr = sess_req->handle_ptr;
+  Local<Object> handle = Nan::New(sess_req->handle);
+  Local<Function> callback = Nan::New(sess_req->callback);
+
+  --handle_ptr->working_;
+
+  int argc = 1;
+  Local<Value> argv[2];
+  if (sess_req->error) {
+    argv[0] = sqlite_error(sess_req->error, sess_req->sqlite_status);
+  } else {
+    argv[0] = Nan::Null();
+    switch (sess_req->op) {
+      case SessionOp::Create: {
+        uint32_t id = ++handle_ptr->next_session_id;
+        handle_ptr->sessions[id] = sess_req->session;
+        argv[argc++] = Nan::New<Number>(id);
+        break;
+      }
+      case SessionOp::Changeset:
+        if (sess_req->data) {
+          // The buffer takes ownership of the changeset
+          argv[argc++] = Nan::NewBuffer(static_cast<char*>(sess_req->data),
+                                        static_cast<size_t>(sess_req->size),
+                                        free_sqlite_mem,
+                                        nullptr).ToLocalChecked();
+          sess_req->data = nullptr;
+        } else {
+          argv[argc++] = Nan::NewBuffer(0).ToLocalChecked();
+        }
+        break;
+      case SessionOp::Apply: {
+        Local<Array> conflicts = Nan::New<Array>(CONFLICT_TYPES);
+        for (int i = 0; i < CONFLICT_TYPES; ++i) {
+          Nan::Set(conflicts,
+                   i,
+                   Nan::New<Number>(sess_req->conflicts[i])).FromJust();
+        }
+        argv[argc++] = conflicts;
+        break;
+      }
+      default:
+        break;
+    }
+  }
+
+  sess_req->runInAsyncScope(handle, callback, argc, argv);
+
+  delete sess_req;
+}
+
+// Records the snapshot of a WAL mode database seen by the connection, or starts
+// reading from a recorded snapshot. Snapshots are handed to JS as a copy of
+// SQLite's (opaque, fixed-size) snapshot structure, which makes them usable by
+// any connection to the same database.
+class SnapshotRequest : public Nan::AsyncResource {
+public:
+  SnapshotRequest(Local<Object> handle_,
+                  DBHandle* handle_ptr_,
+                  bool open_,
+                  Local<Value> schema_,
+                  Local<Function> callback_)
+    : Nan::AsyncResource("esqlite:SnapshotRequest"),
+      handle_ptr(handle_ptr_),
+      open(open_),
+      schema(schema_),
+      sqlite_status(0),
+      error(nullptr),
+      error_code(nullptr) {
+    handle.Reset(handle_);
+    callback.Reset(callback_);
+    request.data = this;
+    memset(&snapshot, 0, sizeof(snapshot));
+  }
+
+  ~SnapshotRequest() {
+    handle.Reset();
+    callback.Reset();
+    if (error)
+      free(error);
+  }
+
+  uv_work_t request;
+
+  Nan::Persistent<Object> handle;
+  Nan::Persistent<Function> callback;
+  DBHandle* handle_ptr;
+  bool open;
+  Nan::Utf8String schema;
+  sqlite3_snapshot snapshot;
+
+  int sqlite_status;
+  char* error;
+  // Replaces the SQLite error code for errors that are not SQLite's own
+  const char* error_code;
+};
+
+// Checks whether a database uses WAL mode
+static bool uses_wal(sqlite3* db, const char* schema) {
+  char* sql = sqlite3_mprintf("PRAGMA \"%w\".journal_mode", schema);
+  if (!sql)
+    return false;
+  sqlite3_stmt* stmt = nullptr;
+  bool wal = false;
+  if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) == SQLITE_OK
+      && sqlite3_step(stmt) == SQLITE_ROW) {
+    const char* mode =
+      reinterpret_cast<const char*>(sqlite3_column_text(stmt, 0));
+    wal = (mode && sqlite3_stricmp(mode, "wal") == 0);
+  }
+  sqlite3_finalize(stmt);
+  sqlite3_free(sql);
+  return wal;
+}
+
+void SnapshotWork(uv_work_t* req) {
+  SnapshotRequest* snap_req = static_cast<SnapshotRequest*>(req->data);
+  sqlite3* db = snap_req->handle_ptr->db_;
+
+  // Both operations need a transaction that has not read anything yet. The
+  // read transaction they start is left open, which keeps the snapshot
+  // available until the transaction ends.
+  bool began = false;
+  int res = SQLITE_OK;
+  if (sqlite3_get_autocommit(db)) {
+    res = sqlite3_exec(db, "BEGIN", nullptr, nullptr, nullptr);
+    began = (res == SQLITE_OK);
+  }
+
+  if (res == SQLITE_OK) {
+    if (snap_req->open) {
+      res = sqlite3_snapshot_open(db, *snap_req->schema, &snap_req->snapshot);
+    } else {
+      sqlite3_snapshot* snapshot;
+      res = sqlite3_snapshot_get(db, *snap_req->schema, &snapshot);
+      if (res == SQLITE_OK) {
+        memcpy(&snap_req->snapshot, snapshot, sizeof(sqlite3_snapshot));
+        sqlite3_snapshot_free(snapshot);
+      } else if (res == SQLITE_ERROR
+                 && sqlite3_txn_state(db, *snap_req->schema) != SQLITE_TXN_WRITE
+                 && uses_wal(db, *snap_req->schema)) {
+        // Outside of a write transaction on a WAL mode database, the only
+        // remaining reason for failing is that nothing has been written to
+        // the WAL since it was (re)created, e.g. when the database was first
+        // opened after all connections to it had been closed
+        snap_req->sqlite_status = -1;
+        snap_req->error_code = "SNAPSHOT_WAL_EMPTY";
+        snap_req->error = strdup(
+          "Cannot take a snapshot before a transaction has been written to the "
+          "WAL"
+        );
+        if (began)
+          sqlite3_exec(db, "ROLLBACK", nullptr, nullptr, nullptr);
+        return;
+      }
+    }
+  }
+
+  if (res != SQLITE_OK) {
+    snap_req->sqlite_status = res;
+    snap_req->error = strdup(sqlite3_errmsg(db));
+    if (began)
+      sqlite3_exec(db, "ROLLBACK", nullptr, nullptr, nullptr);
+  }
+}
+
+void SnapshotAfter(uv_work_t* req, int status) {
+  Nan::HandleScope scope;
+  SnapshotRequest* snap_req = static_cast<SnapshotRequest*>(req->data);
+  Local<Object> handle = Nan::New(snap_req->handle);
+  Local<Function> callback = Nan::New(snap_req->callback);
+
+  --snap_req->handle_ptr->working_;
+
+  int argc = 1;
+  Local<Value> argv[2];
+  if (snap_req->error) {
+    argv[0] = sqlite_error(snap_req->error, snap_req->sqlite_status);
+    if (snap_req->error_code) {
+      Nan::Set(
+        Nan::To<Object>(argv[0]).ToLocalChecked(),
+        Nan::New("code").ToLocalChecked(),
+        Nan::New(snap_req->error_code).ToLocalChecked()
+      ).FromJust();
+    }
+  } else {
+    argv[0] = Nan::Null();
+    if (!snap_req->open) {
+      argv[argc++] = Nan::CopyBuffer(
+        reinterpret_cast<const char*>(&snap_req->snapshot),
+        sizeof(sqlite3_snapshot)
+      ).ToLocalChecked();
+    }
+  }
+
+  snap_req->runInAsyncScope(handle, callback, argc, argv);
+
+  delete snap_req;
+}
+
+int sqlite_authorizer(void* baton, int code, const char* arg1, const char* arg2,
+                      const char* arg3, const char* arg4) {
+  AuthorizerRequest* req = static_cast<AuthorizerRequest*>(baton);
+
+  if (req->filter.size() > 0 && req->filter.count(code) == 0)
+    return req->nomatch_result;
+
+  int result;
+  uv_mutex_lock(&req->mutex);
+  req->code = code;
+  req->arg1 = arg1;
+  req->arg2 = arg2;
+  req->arg3 = arg3;
+  req->arg4 = arg4;
+  req->result = -1;
+
+  int status = uv_async_send(&req->async);
+  assert(status == 0);
+
+  while (req->result == -1)
+    uv_cond_wait(&req->cond, &req->mutex);
+  result = req->result;
+
+  uv_mutex_unlock(&req->mutex);
+  return result;
+}
+
+// Used instead of `sqlite_authorizer()` while a statement is executed on the
+// main thread, where waiting for the event loop to run the JS callback would
+// never finish
+int sqlite_authorizer_sync(void* baton, int code, const char* arg1,
+                           const char* arg2, const char* arg3,
+                           const char* arg4) {
+  AuthorizerRequest* req = static_cast<AuthorizerRequest*>(baton);
+
+  if (req->filter.size() > 0 && req->filter.count(code) == 0)
+    return req->nomatch_result;
+
+  req->code = code;
+  req->arg1 = arg1;
+  req->arg2 = arg2;
+  req->arg3 = arg3;
+  req->arg4 = arg4;
+  return req->call_js_callback(false);
+}
+
+int sqlite_authorizer_simple(void* baton, int code, const char* arg1,
+                             const char* arg2, const char* arg3,
+                             const char* arg4) {
+  AuthorizerRequest* req = static_cast<AuthorizerRequest*>(baton);
+  return (
+    req->filter.size() > 0 && req->filter.count(code) > 0
+    ? req->match_result
+    : req->nomatch_result
+  );
+}
+
+DBHandle::DBHandle(Local<Function> make_rows_fn_,
+                   Local<Function> make_obj_row_fn_,
+                   Local<Function> make_arr_row_fn_,
+                   Local<Function> status_callback_)
+  : db_(nullptr),
+    working_(0),
+    cur_req(nullptr),
+    authorizeReq(nullptr),
+    notifier(nullptr),
+    busy_initial_delay_ms(0),
+    busy_max_delay_ms(0),
+    busy_max_wait_ms(0),
+    busy_rng(static_cast<uint32_t>(uv_hrtime()) | 1),
+    next_blob_id(0),
+    next_backup_id(0),
+    next_session_id(0),
+    cipher_index(-1),
+    checkpointer(nullptr) {
+  make_rows_fn.Reset(make_rows_fn_);
+  make_obj_row_fn.Reset(make_obj_row_fn_);
+  make_arr_row_fn.Reset(make_arr_row_fn_);
+  status_callback.Reset(status_callback_);
+}
+DBHandle::~DBHandle() {
+  if (notifier) {
+    if (db_)
+      ChangeNotifier::uninstall(db_);
+    notifier->close(false);
+  }
+  if (db_) {
+    stop_checkpointer();
+    close_blobs();
+    close_backups();
+    close_sessions();
+    sqlite3_close_v2(db_);
+  }
+  image.Reset();
+  make_rows_fn.Reset();
+  make_obj_row_fn.Reset();
+  make_arr_row_fn.Reset();
+  if (authorizeReq)
+    authorizeReq->close();
+  status_callback.Reset();
+}
+
+NAN_METHOD(DBHandle::New) {
+  if (!info.IsConstructCall())
+    return Nan::ThrowError("Use `new` to create instances");
+
+  Local<Value> auth_fn = info[3];
+  Local<Value> auth_filter = info[4];
+  Local<Value> auth_match_result = info[5];
+  Local<Value> auth_nomatch_result = info[6];
+
+  DBHandle* obj = new DBHandle(
     Local<Function>::Cast(info[0]),
     Local<Function>::Cast(info[1]),
     Local<Function>::Cast(info[2]),
     Local<Function>::Cast(info[7])
   );
-  obj->Wrap(info.This());
+  obj->Wrap(info.This());
+
+  if (auth_fn->IsFunction()) {
+    obj->authorizeReq = new AuthorizerRequest(
+      sqlite_authorizer,
+      Local<Function>::Cast(auth_fn)
+    );
+    if (!auth_filter->IsUndefined()) {
+      if (!auth_filter->IsArray()) {
+        delete obj;
+        return Nan::ThrowError("Invalid authorizer filter value");
+      }
+
+      Local<Array> filter_arr = Local<Array>::Cast(auth_filter);
+      for (uint32_t i = 0; i < filter_arr->Length(); ++i) {
+        Local<Value> val = Nan::Get(filter_arr, i).ToLocalChecked();
+        if (!val->IsUint32()) {
+          delete obj;
+          return Nan::ThrowError("Invalid authorizer filter array value");
+        }
+        int32_t num_val = Nan::To<int32_t>(val).FromJust();
+        if (num_val < 0) {
+          delete obj;
+          return Nan::ThrowError("Invalid authorizer filter array value");
+        }
+        obj->authorizeReq->filter.insert(num_val);
+      }
+
+      if (auth_nomatch_result->IsTrue()) {
+        obj->authorizeReq->nomatch_result = SQLITE_OK;
+      } else if (auth_nomatch_result->IsFalse()) {
+        obj->authorizeReq->nomatch_result = SQLITE_DENY;
+      } else if (auth_nomatch_result->IsNull()) {
+        obj->authorizeReq->nomatch_result = SQLITE_IGNORE;
+      } else {
+        delete obj;
+        return Nan::ThrowError("Invalid authorizer no-match result value");
+      }
+    }
+  } else if (auth_fn->IsTrue()) {
+    obj->authorizeReq = new AuthorizerRequest(sqlite_authorizer_simple);
+    if (!auth_filter->IsUndefined()) {
+      if (!auth_filter->IsArray()) {
+        delete obj;
+        return Nan::ThrowError("Invalid authorizer filter value");
+      }
+
+      Local<Array> filter_arr = Local<Array>::Cast(auth_filter);
+      for (uint32_t i = 0; i < filter_arr->Length(); ++i) {
+        Local<Value> val = Nan::Get(filter_arr, i).ToLocalChecked();
+        if (!val->IsUint32()) {
+          delete obj;
+          return Nan::ThrowError("Invalid authorizer filter array value");
+        }
+        int32_t num_val = Nan::To<int32_t>(val).FromJust();
+        if (num_val < 0) {
+          delete obj;
+          return Nan::ThrowError("Invalid authorizer filter array value");
+        }
+        obj->authorizeReq->filter.insert(num_val);
+      }
+    }
+
+    if (auth_nomatch_result->IsTrue()) {
+      obj->authorizeReq->nomatch_result = SQLITE_OK;
+    } else if (auth_nomatch_result->IsFalse()) {
+      obj->authorizeReq->nomatch_result = SQLITE_DENY;
+    } else if (auth_nomatch_result->IsNull()) {
+      obj->authorizeReq->nomatch_result = SQLITE_IGNORE;
+    } else {
+      delete obj;
+      return Nan::ThrowError("Invalid authorizer no-match result value");
+    }
+
+    if (obj->authorizeReq->filter.size() > 0) {
+      if (auth_match_result->IsTrue()) {
+        obj->authorizeReq->match_result = SQLITE_OK;
+      } else if (auth_match_result->IsFalse()) {
+        obj->authorizeReq->match_result = SQLITE_DENY;
+      } else if (auth_match_result->IsNull()) {
+        obj->authorizeReq->match_result = SQLITE_IGNORE;
+      } else {
+        delete obj;
+        return Nan::ThrowError("Invalid authorizer match result value");
+      }
+    }
+  }
+
+  info.GetReturnValue().Set(info.This());
+}
+
+NAN_METHOD(DBHandle::Open) {
+  DBHandle* self = Nan::ObjectWrap::Unwrap<DBHandle>(info.Holder());
+
+  if (self->db_)
+    return Nan::ThrowError("Database already open, close first");
+
+  Nan::Utf8String filename(info[0]);
+  uint32_t flags = Nan::To<uint32_t>(info[1]).FromJust();
+  flags |= SQLITE_OPEN_NOMUTEX;
+
+  int cipher_index = -1;
+  if (info[2]->IsString()) {
+    Nan::Utf8String cipher_name(info[2]);
+    cipher_index = sqlite3mc_cipher_index(*cipher_name);
+    if (cipher_index < 0)
+      return Nan::ThrowError("Unsupported cipher");
+  }
+
+  int res = sqlite3_open_v2(*filename, &self->db_, flags, nullptr);
+  if (res != SQLITE_OK)
+    goto on_err;
+
+  self->cipher_index = cipher_index;
+
+  // Select the cipher used for any subsequent `PRAGMA key`
+  if (cipher_index >= 0
+      && sqlite3mc_config(self->db_, "cipher", cipher_index) != cipher_index) {
+    res = SQLITE_ERROR;
+    goto on_err;
+  }
+
+  res = sqlite3_extended_result_codes(self->db_, 1);
+  if (res != SQLITE_OK)
+    goto on_err;
+
+  // Disable dynamic loading of extensions
+  res = sqlite3_db_config(self->db_,
+                          SQLITE_DBCONFIG_ENABLE_LOAD_EXTENSION,
+                          0,
+                          nullptr);
+  if (res != SQLITE_OK)
+    goto on_err;
+
+  // Disable language features that allow ordinary SQL to deliberately corrupt
+  // the database
+  res = sqlite3_db_config(self->db_,
+                          SQLITE_DBCONFIG_DEFENSIVE,
+                          1,
+                          nullptr);
+  if (res != SQLITE_OK)
+    goto on_err;
+
+  if (self->authorizeReq) {
+    res = sqlite3_set_authorizer(
+      self->db_,
+      self->authorizeReq->sqlite_auth_callback,
+      self->authorizeReq
+    );
+    if (res != SQLITE_OK)
+      goto on_err;
+  }
+
+  return;
+
+on_err:
+  Local<Value> err = Nan::Error(sqlite3_errstr(res));
+  if (self->db_) {
+    sqlite3_close_v2(self->db_);
+    self->db_ = nullptr;
+  }
+  Nan::ThrowError(err);
+}
+
+NAN_METHOD(DBHandle::Query) {
+  DBHandle* self = Nan::ObjectWrap::Unwrap<DBHandle>(info.Holder());
+
+  if (!self->db_)
+    return Nan::ThrowError("Database not open");
+
+  if (info.Length() == 0 || info.Length() == 1) {
+    if (!self->cur_req)
+      return Nan::ThrowError("No query in progress");
+    if (self->cur_req->active)
+      return Nan::ThrowError("Query already working");
+    if (info.Length() == 1)
+      self->cur_req->max_rows = Nan::To<uint32_t>(info[0]).FromJust();
+  } else if (self->cur_req) {
+    return Nan::ThrowError("Query still in progress");
+  } else {
+    uint32_t prepare_flags = Nan::To<uint32_t>(info[1]).FromJust();
+    uint32_t query_flags = Nan::To<uint32_t>(info[2]).FromJust();
+    uint32_t max_rows = Nan::To<uint32_t>(info[4]).FromJust();
+    uint32_t timeout_ms =
+      (info[5]->IsUint32() ? Nan::To<uint32_t>(info[5]).FromJust() : 0);
+    uint32_t time_slice_ms =
+      (info[7]->IsUint32() ? Nan::To<uint32_t>(info[7]).FromJust() : 0);
+    uint64_t max_vm_steps = 0;
+    if (info[6]->IsNumber()) {
+      double val = Nan::To<double>(info[6]).FromJust();
+      if (val > 0)
+        max_vm_steps = static_cast<uint64_t>(val);
+    }
+
+    BindParamsType params_type;
+    void* params;
+    if (!parse_bind_params(info[3], query_flags, &params_type, &params))
+      return;
+
+    self->cur_req = new QueryRequest(info.Holder(),
+                                     self,
+                                     info[0],
+                                     params_type,
+                                     params,
+                                     prepare_flags,
+                                     query_flags,
+                                     max_rows,
+                                     timeout_ms,
+                                     max_vm_steps,
+                                     time_slice_ms);
+  }
+
+  ++self->working_;
+  self->cur_req->active = true;
+
+  int status = uv_queue_work(
+    uv_default_loop(),
+    &self->cur_req->request,
+    QueryWork,
+    reinterpret_cast<uv_after_work_cb>(QueryAfter)
+  );
+  assert(status == 0);
+}
 
-  if (auth_fn->IsFunction()) {
-    obj->authorizeReq = new AuthorizerRequest(
-      sqlite_authorizer,
-      Local<Function>::Cast(auth_fn)
+// batch(items, beginType, atomic, callback), where each item is
+// [ sql, queryFlags, values ]
+NAN_METHOD(DBHandle::Batch) {
+  DBHandle* self = Nan::ObjectWrap::Unwrap<DBHandle>(info.Holder());
+
+  if (!self->db_)
+    return Nan::ThrowError("Database not open");
+  if (self->cur_req)
+    return Nan::ThrowError("Query still in progress");
+  if (!info[0]->IsArray())
+    return Nan::ThrowTypeError("Items argument must be an array");
+  uint32_t begin_type = Nan::To<uint32_t>(info[1]).FromJust();
+  if (begin_type >= (sizeof(BEGIN_SQL) / sizeof(BEGIN_SQL[0])))
+    return Nan::ThrowRangeError("Invalid transaction type");
+  if (!info[3]->IsFunction())
+    return Nan::ThrowTypeError("Callback argument must be a function");
+
+  Local<Array> list = Local<Array>::Cast(info[0]);
+  BatchRequest* batch_req = new BatchRequest(
+    info.Holder(),
+    self,
+    begin_type,
+    info[2]->IsTrue(),
+    Local<Function>::Cast(info[3])
+  );
+  batch_req->items.resize(list->Length());
+  for (uint32_t i = 0; i < list->Length(); ++i) {
+    Local<Value> val = Nan::Get(list, i).ToLocalChecked();
+    if (!val->IsArray()) {
+      delete batch_req;
+      return Nan::ThrowTypeError("Invalid batch item");
+    }
+    Local<Array> js_item = Local<Array>::Cast(val);
+    BatchItem& item = batch_req->items[i];
+    Nan::Utf8String sql(Nan::Get(js_item, 0).ToLocalChecked());
+    item.sql.assign(*sql, sql.length());
+    item.query_flags =
+      Nan::To<uint32_t>(Nan::Get(js_item, 1).ToLocalChecked()).FromJust();
+    if (!parse_bind_params(Nan::Get(js_item, 2).ToLocalChecked(),
+                           item.query_flags,
+                           &item.params_type,
+                           &item.params)) {
+      delete batch_req;
+      return;
+    }
+  }
+
+  ++self->working_;
+
+  int status = uv_queue_work(
+    uv_default_loop(),
+    &batch_req->request,
+    BatchWork,
+    reinterpret_cast<uv_after_work_cb>(BatchAfter)
+  );
+  assert(status == 0);
+}
+
+// exec(sql, callback)
+NAN_METHOD(DBHandle::Exec) {
+  DBHandle* self = Nan::ObjectWrap::Unwrap<DBHandle>(info.Holder());
+
+  if (!self->db_)
+    return Nan::ThrowError("Database not open");
+  if (self->cur_req)
+    return Nan::ThrowError("Query still in progress");
+  if (!info[0]->IsString())
+    return Nan::ThrowTypeError("SQL argument must be a string");
+  if (!info[1]->IsFunction())
+    return Nan::ThrowTypeError("Callback argument must be a function");
+
+  ExecRequest* exec_req = new ExecRequest(
+    info.Holder(), self, info[0], Local<Function>::Cast(info[1])
+  );
+
+  ++self->working_;
+
+  int status = uv_queue_work(
+    uv_default_loop(),
+    &exec_req->request,
+    ExecWork,
+    reinterpret_cast<uv_after_work_cb>(ExecAfter)
+  );
+  assert(status == 0);
+}
+
+// querySync(sql, prepareFlags, queryFlags, values)
+NAN_METHOD(DBHandle::QuerySync) {
+  DBHandle* self = Nan::ObjectWrap::Unwrap<DBHandle>(info.Holder());
+
+  if (!self->db_)
+    return Nan::ThrowError("Database not open");
+  // The connection is not thread-safe, so it must not be in use by the
+  // threadpool. A paused query (e.g. a partially read statement) would also
+  // see its statement disturbed.
+  if (self->working_ || self->cur_req) {
+    return Nan::ThrowError(
+      "Cannot execute synchronously while asynchronous requests are active"
     );
-    if (!auth_filter->IsUndefined()) {
-      if (!auth_filter->IsArray()) {
-        delete obj;
-        return Nan::ThrowError("Invalid authorizer filter value");
-      }
+  }
+
+  BatchItem item;
+  Nan::Utf8String sql(info[0]);
+  item.sql.assign(*sql, sql.length());
+  item.prepare_flags = Nan::To<uint32_t>(info[1]).FromJust();
+  item.query_flags = Nan::To<uint32_t>(info[2]).FromJust();
+  if (!parse_bind_params(info[3],
+                         item.query_flags,
+                         &item.params_type,
+                         &item.params)) {
+    return;
+  }
+
+  // A JS authorizer is normally called by way of the event loop, which is
+  // blocked by this call, so call it directly instead while executing
+  AuthorizerRequest* auth_req = self->authorizeReq;
+  bool js_auth = (auth_req && !auth_req->js_callback.IsEmpty());
+  if (js_auth)
+    sqlite3_set_authorizer(self->db_, sqlite_authorizer_sync, auth_req);
+
+  Nan::TryCatch try_catch;
+  run_item(self->db_, item);
+
+  if (js_auth) {
+    sqlite3_set_authorizer(self->db_,
+                           auth_req->sqlite_auth_callback,
+                           auth_req);
+  }
+
+  if (try_catch.HasCaught()) {
+    free_item(item);
+    try_catch.ReThrow();
+    return;
+  }
+  if (item.error) {
+    Local<Value> err = sqlite_error(item.error, item.sqlite_status);
+    free_item(item);
+    return Nan::ThrowError(err);
+  }
+  Local<Value> result = item_to_js(nullptr, self, item);
+  free_item(item);
+  info.GetReturnValue().Set(result);
+}
+
+// Looks up an open blob handle by the id given to JS, throwing if it is unknown
+static sqlite3_blob* get_blob(DBHandle* self, Local<Value> id_val) {
+  auto it = self->blobs.find(Nan::To<uint32_t>(id_val).FromJust());
+  if (it == self->blobs.end()) {
+    Nan::ThrowError("Invalid blob handle");
+    return nullptr;
+  }
+  return it->second;
+}
+
+static void queue_blob_request(DBHandle* self, BlobRequest* blob_req) {
+  ++self->working_;
+
+  int status = uv_queue_work(
+    uv_default_loop(),
+    &blob_req->request,
+    BlobWork,
+    reinterpret_cast<uv_after_work_cb>(BlobAfter)
+  );
+  assert(status == 0);
+}
+
+// blobOpen(dbName, table, column, rowid, writable, callback)
+NAN_METHOD(DBHandle::BlobOpen) {
+  DBHandle* self = Nan::ObjectWrap::Unwrap<DBHandle>(info.Holder());
+
+  if (!self->db_)
+    return Nan::ThrowError("Database not open");
+  if (self->cur_req)
+    return Nan::ThrowError("Query still in progress");
+  if (!info[5]->IsFunction())
+    return Nan::ThrowTypeError("Callback argument must be a function");
+
+  sqlite3_int64 rowid;
+  if (info[3]->IsBigInt()) {
+    Local<BigInt> bi =
+      info[3]->ToBigInt(Nan::GetCurrentContext()).ToLocalChecked();
+    bool lossless;
+    rowid = bi->Int64Value(&lossless);
+    if (!lossless)
+      return Nan::ThrowRangeError("Invalid rowid");
+  } else {
+    rowid = Nan::To<int64_t>(info[3]).FromJust();
+  }
+
+  BlobRequest* blob_req = new BlobRequest(
+    info.Holder(), self, BlobOp::Open, Local<Function>::Cast(info[5])
+  );
+  Nan::Utf8String db_name(info[0]);
+  Nan::Utf8String table(info[1]);
+  Nan::Utf8String column(info[2]);
+  blob_req->db_name.assign(*db_name, db_name.length());
+  blob_req->table.assign(*table, table.length());
+  blob_req->column.assign(*column, column.length());
+  blob_req->rowid = rowid;
+  blob_req->writable = (Nan::To<bool>(info[4]).FromJust() ? 1 : 0);
+
+  queue_blob_request(self, blob_req);
+}
+
+// blobRead(id, offset, length, callback)
+NAN_METHOD(DBHandle::BlobRead) {
+  DBHandle* self = Nan::ObjectWrap::Unwrap<DBHandle>(info.Holder());
+
+  if (!self->db_)
+    return Nan::ThrowError("Database not open");
+  if (self->cur_req)
+    return Nan::ThrowError("Query still in progress");
+  if (!info[3]->IsFunction())
+    return Nan::ThrowTypeError("Callback argument must be a function");
+  sqlite3_blob* blob = get_blob(self, info[0]);
+  if (!blob)
+    return;
+
+  BlobRequest* blob_req = new BlobRequest(
+    info.Holder(), self, BlobOp::Read, Local<Function>::Cast(info[3])
+  );
+  blob_req->blob = blob;
+  blob_req->offset = Nan::To<int32_t>(info[1]).FromJust();
+  blob_req->length = Nan::To<int32_t>(info[2]).FromJust();
+
+  queue_blob_request(self, blob_req);
+}
+
+// blobWrite(id, offset, buffer, callback)
+NAN_METHOD(DBHandle::BlobWrite) {
+  DBHandle* self = Nan::ObjectWrap::Unwrap<DBHandle>(info.Holder());
+
+  if (!self->db_)
+    return Nan::ThrowError("Database not open");
+  if (self->cur_req)
+    return Nan::ThrowError("Query still in progress");
+  if (!Buffer::HasInstance(info[2]))
+    return Nan::ThrowTypeError("Data argument must be a Buffer");
+  if (!info[3]->IsFunction())
+    return Nan::ThrowTypeError("Callback argument must be a function");
+  sqlite3_blob* blob = get_blob(self, info[0]);
+  if (!blob)
+    return;
+
+  Local<Object> buffer = Nan::To<Object>(info[2]).ToLocalChecked();
+  BlobRequest* blob_req = new BlobRequest(
+    info.Holder(), self, BlobOp::Write, Local<Function>::Cast(info[3])
+  );
+  blob_req->blob = blob;
+  blob_req->offset = Nan::To<int32_t>(info[1]).FromJust();
+  // The buffer is kept alive until the write has finished
+  blob_req->buffer.Reset(buffer);
+  blob_req->data = Buffer::Data(buffer);
+  blob_req->length = static_cast<int>(Buffer::Length(buffer));
+
+  queue_blob_request(self, blob_req);
+}
+
+// blobClose(id, callback)
+NAN_METHOD(DBHandle::BlobClose) {
+  DBHandle* self = Nan::ObjectWrap::Unwrap<DBHandle>(info.Holder());
+
+  if (!self->db_)
+    return Nan::ThrowError("Database not open");
+  if (self->cur_req)
+    return Nan::ThrowError("Query still in progress");
+  if (!info[1]->IsFunction())
+    return Nan::ThrowTypeError("Callback argument must be a function");
+  sqlite3_blob* blob = get_blob(self, info[0]);
+  if (!blob)
+    return;
+  self->blobs.erase(Nan::To<uint32_t>(info[0]).FromJust());
+
+  BlobRequest* blob_req = new BlobRequest(
+    info.Holder(), self, BlobOp::Close, Local<Function>::Cast(info[1])
+  );
+  blob_req->blob = blob;
+
+  queue_blob_request(self, blob_req);
+}
+
+static void queue_backup_request(DBHandle* self, BackupRequest* backup_req) {
+  ++self->working_;
+
+  int status = uv_queue_work(
+    uv_default_loop(),
+    &backup_req->request,
+    BackupWork,
+    reinterpret_cast<uv_after_work_cb>(BackupAfter)
+  );
+  assert(status == 0);
+}
+
+// Looks up a backup in progress by the id given to JS, throwing if it is
+// unknown
+static bool get_backup(DBHandle* self,
+                       Local<Value> id_val,
+                       pair<sqlite3_backup*, sqlite3*>* backup) {
+  auto it = self->backups.find(Nan::To<uint32_t>(id_val).FromJust());
+  if (it == self->backups.end()) {
+    Nan::ThrowError("Invalid backup handle");
+    return false;
+  }
+  *backup = it->second;
+  return true;
+}
+
+// backupInit(destPath, dbName, cipher, key, callback)
+NAN_METHOD(DBHandle::BackupInit) {
+  DBHandle* self = Nan::ObjectWrap::Unwrap<DBHandle>(info.Holder());
+
+  if (!self->db_)
+    return Nan::ThrowError("Database not open");
+  if (self->cur_req)
+    return Nan::ThrowError("Query still in progress");
+  if (!info[4]->IsFunction())
+    return Nan::ThrowTypeError("Callback argument must be a function");
+
+  BackupRequest* backup_req = new BackupRequest(
+    info.Holder(), self, BackupOp::Init, Local<Function>::Cast(info[4])
+  );
+  Nan::Utf8String dest_path(info[0]);
+  Nan::Utf8String db_name(info[1]);
+  Nan::Utf8String cipher(info[2]);
+  backup_req->dest_path.assign(*dest_path, dest_path.length());
+  backup_req->db_name.assign(*db_name, db_name.length());
+  backup_req->cipher.assign(*cipher, cipher.length());
+  if (Buffer::HasInstance(info[3])) {
+    backup_req->key.assign(Buffer::Data(info[3]), Buffer::Length(info[3]));
+  }
+
+  queue_backup_request(self, backup_req);
+}
+
+// backupStep(id, pages, callback)
+NAN_METHOD(DBHandle::BackupStep) {
+  DBHandle* self = Nan::ObjectWrap::Unwrap<DBHandle>(info.Holder());
+
+  if (!self->db_)
+    return Nan::ThrowError("Database not open");
+  if (self->cur_req)
+    return Nan::ThrowError("Query still in progress");
+  if (!info[2]->IsFunction())
+    return Nan::ThrowTypeError("Callback argument must be a function");
+  pair<sqlite3_backup*, sqlite3*> backup;
+  if (!get_backup(self, info[0], &backup))
+    return;
+
+  BackupRequest* backup_req = new BackupRequest(
+    info.Holder(), self, BackupOp::Step, Local<Function>::Cast(info[2])
+  );
+  backup_req->backup = backup.first;
+  backup_req->dest = backup.second;
+  backup_req->pages = Nan::To<int32_t>(info[1]).FromJust();
+
+  queue_backup_request(self, backup_req);
+}
+
+// backupFinish(id, callback)
+NAN_METHOD(DBHandle::BackupFinish) {
+  DBHandle* self = Nan::ObjectWrap::Unwrap<DBHandle>(info.Holder());
+
+  if (!self->db_)
+    return Nan::ThrowError("Database not open");
+  if (self->cur_req)
+    return Nan::ThrowError("Query still in progress");
+  if (!info[1]->IsFunction())
+    return Nan::ThrowTypeError("Callback argument must be a function");
+  pair<sqlite3_backup*, sqlite3*> backup;
+  if (!get_backup(self, info[0], &backup))
+    return;
+  self->backups.erase(Nan::To<uint32_t>(info[0]).FromJust());
+
+  BackupRequest* backup_req = new BackupRequest(
+    info.Holder(), self, BackupOp::Finish, Local<Function>::Cast(info[1])
+  );
+  backup_req->backup = backup.first;
+  backup_req->dest = backup.second;
+
+  queue_backup_request(self, backup_req);
+}
+
+// serialize(schema, callback)
+NAN_METHOD(DBHandle::Serialize) {
+  DBHandle* self = Nan::ObjectWrap::Unwrap<DBHandle>(info.Holder());
+
+  if (!self->db_)
+    return Nan::ThrowError("Database not open");
+  if (self->cur_req)
+    return Nan::ThrowError("Query still in progress");
+  if (!info[1]->IsFunction())
+    return Nan::ThrowTypeError("Callback argument must be a function");
+
+  SerializeRequest* ser_req = new SerializeRequest(
+    info.Holder(), self, info[0], Local<Function>::Cast(info[1])
+  );
+
+  ++self->working_;
+
+  int status = uv_queue_work(
+    uv_default_loop(),
+    &ser_req->request,
+    SerializeWork,
+    reinterpret_cast<uv_after_work_cb>(SerializeAfter)
+  );
+  assert(status == 0);
+}
+
+// deserialize(schema, buffer, readonly, callback)
+NAN_METHOD(DBHandle::Deserialize) {
+  DBHandle* self = Nan::ObjectWrap::Unwrap<DBHandle>(info.Holder());
+
+  if (!self->db_)
+    return Nan::ThrowError("Database not open");
+  if (self->cur_req)
+    return Nan::ThrowError("Query still in progress");
+  if (!Buffer::HasInstance(info[1]))
+    return Nan::ThrowTypeError("Image argument must be a Buffer");
+  if (!info[3]->IsFunction())
+    return Nan::ThrowTypeError("Callback argument must be a function");
+
+  Local<Object> buffer = Nan::To<Object>(info[1]).ToLocalChecked();
+  SerializeRequest* ser_req = new SerializeRequest(
+    info.Holder(), self, info[0], Local<Function>::Cast(info[3])
+  );
+  ser_req->image.Reset(buffer);
+  ser_req->data = reinterpret_cast<unsigned char*>(Buffer::Data(buffer));
+  ser_req->size = static_cast<sqlite3_int64>(Buffer::Length(buffer));
+  ser_req->readonly = Nan::To<bool>(info[2]).FromJust();
+
+  ++self->working_;
+
+  int status = uv_queue_work(
+    uv_default_loop(),
+    &ser_req->request,
+    DeserializeWork,
+    reinterpret_cast<uv_after_work_cb>(DeserializeAfter)
+  );
+  assert(status == 0);
+}
+
+// startCheckpointer(key, passivePages, restartPages, truncatePages,
+//                   busyTimeoutMs)
+NAN_METHOD(DBHandle::StartCheckpointer) {
+  DBHandle* self = Nan::ObjectWrap::Unwrap<DBHandle>(info.Holder());
+
+  if (!self->db_)
+    return Nan::ThrowError("Database not open");
+  if (self->checkpointer)
+    return Nan::ThrowError("Checkpointer already started");
+
+  const char* path = sqlite3_db_filename(self->db_, "main");
+  if (!path || !*path)
+    return Nan::ThrowError("Checkpointer requires a database file");
+
+  string key;
+  if (Buffer::HasInstance(info[0]))
+    key.assign(Buffer::Data(info[0]), Buffer::Length(info[0]));
+
+  Checkpointer* checkpointer = new Checkpointer(
+    path,
+    self->cipher_index,
+    key,
+    Nan::To<int32_t>(info[1]).FromJust(),
+    Nan::To<int32_t>(info[2]).FromJust(),
+    Nan::To<int32_t>(info[3]).FromJust(),
+    Nan::To<int32_t>(info[4]).FromJust()
+  );
+  if (checkpointer->start() != 0) {
+    delete checkpointer;
+    return Nan::ThrowError("Unable to start checkpointer thread");
+  }
+  self->checkpointer = checkpointer;
 
-      Local<Array> filter_arr = Local<Array>::Cast(auth_filter);
-      for (uint32_t i = 0; i < filter_arr->Length(); ++i) {
-        Local<Value> val = Nan::Get(filter_arr, i).ToLocalChecked();
-        if (!val->IsUint32()) {
-          delete obj;
-          return Nan::ThrowError("Invalid authorizer filter array value");
-        }
-        int32_t num_val = Nan::To<int32_t>(val).FromJust();
-        if (num_val < 0) {
-          delete obj;
-          return Nan::ThrowError("Invalid authorizer filter array value");
-        }
-        obj->authorizeReq->filter.insert(num_val);
-      }
+  // Commits no longer checkpoint by themselves. Note that this also replaces
+  // any existing WAL hook.
+  sqlite3_wal_autocheckpoint(self->db_, 0);
+  sqlite3_wal_hook(self->db_, Checkpointer::wal_hook, checkpointer);
+}
 
-      if (auth_nomatch_result->IsTrue()) {
-        obj->authorizeReq->nomatch_result = SQLITE_OK;
-      } else if (auth_nomatch_result->IsFalse()) {
-        obj->authorizeReq->nomatch_result = SQLITE_DENY;
-      } else if (auth_nomatch_result->IsNull()) {
-        obj->authorizeReq->nomatch_result = SQLITE_IGNORE;
-      } else {
-        delete obj;
-        return Nan::ThrowError("Invalid authorizer no-match result value");
-      }
-    }
-  } else if (auth_fn->IsTrue()) {
-    obj->authorizeReq = new AuthorizerRequest(sqlite_authorizer_simple);
-    if (!auth_filter->IsUndefined()) {
-      if (!auth_filter->IsArray()) {
-        delete obj;
-        return Nan::ThrowError("Invalid authorizer filter value");
-      }
+NAN_METHOD(DBHandle::CheckpointStats) {
+  DBHandle* self = Nan::ObjectWrap::Unwrap<DBHandle>(info.Holder());
 
-      Local<Array> filter_arr = Local<Array>::Cast(auth_filter);
-      for (uint32_t i = 0; i < filter_arr->Length(); ++i) {
-        Local<Value> val = Nan::Get(filter_arr, i).ToLocalChecked();
-        if (!val->IsUint32()) {
-          delete obj;
-          return Nan::ThrowError("Invalid authorizer filter array value");
-        }
-        int32_t num_val = Nan::To<int32_t>(val).FromJust();
-        if (num_val < 0) {
-          delete obj;
-          return Nan::ThrowError("Invalid authorizer filter array value");
-        }
-        obj->authorizeReq->filter.insert(num_val);
-      }
-    }
+  if (!self->checkpointer)
+    return info.GetReturnValue().Set(Nan::Null());
+  info.GetReturnValue().Set(self->checkpointer->stats());
+}
 
-    if (auth_nomatch_result->IsTrue()) {
-      obj->authorizeReq->nomatch_result = SQLITE_OK;
-    } else if (auth_nomatch_result->IsFalse()) {
-      obj->authorizeReq->nomatch_result = SQLITE_DENY;
-    } else if (auth_nomatch_result->IsNull()) {
-      obj->authorizeReq->nomatch_result = SQLITE_IGNORE;
+// setChangeListener(callback)
+NAN_METHOD(DBHandle::SetChangeListener) {
+  DBHandle* self = Nan::ObjectWrap::Unwrap<DBHandle>(info.Holder());
+
+  if (!self->db_)
+    return Nan::ThrowError("Database not open");
+  // The hooks must not be changed while the connection is in use by the
+  // threadpool
+  if (self->working_)
+    return Nan::ThrowError("Cannot change listener while requests are active");
+
+  if (info[0]->IsFunction()) {
+    if (self->notifier) {
+      // Keep the notifier so that changes made by an open transaction are not
+      // lost
+      self->notifier->js_callback.Reset(Local<Function>::Cast(info[0]));
     } else {
-      delete obj;
-      return Nan::ThrowError("Invalid authorizer no-match result value");
+      self->notifier = new ChangeNotifier(Local<Function>::Cast(info[0]));
+      self->notifier->install(self->db_);
     }
+  } else if (self->notifier) {
+    ChangeNotifier::uninstall(self->db_);
+    self->notifier->close(true);
+    self->notifier = nullptr;
+  }
+}
 
-    if (obj->authorizeReq->filter.size() > 0) {
-      if (auth_match_result->IsTrue()) {
-        obj->authorizeReq->match_result = SQLITE_OK;
-      } else if (auth_match_result->IsFalse()) {
-        obj->authorizeReq->match_result = SQLITE_DENY;
-      } else if (auth_match_result->IsNull()) {
-        obj->authorizeReq->match_result = SQLITE_IGNORE;
-      } else {
-        delete obj;
-        return Nan::ThrowError("Invalid authorizer match result value");
-      }
+static void queue_session_request(DBHandle* self, SessionRequest* sess_req) {
+  ++self->working_;
+
+  int status = uv_queue_work(
+    uv_default_loop(),
+    &sess_req->request,
+    SessionWork,
+    reinterpret_cast<uv_after_work_cb>(SessionAfter)
+  );
+  assert(status == 0);
+}
+
+// Looks up a session by the id given to JS, throwing if it is unknown
+static sqlite3_session* get_session(DBHandle* self, Local<Value> id_val) {
+  auto it = self->sessions.find(Nan::To<uint32_t>(id_val).FromJust());
+  if (it == self->sessions.end()) {
+    Nan::ThrowError("Invalid session handle");
+    return nullptr;
+  }
+  return it->second;
+}
+
+// sessionCreate(dbName, tables, callback)
+NAN_METHOD(DBHandle::SessionCreate) {
+  DBHandle* self = Nan::ObjectWrap::Unwrap<DBHandle>(info.Holder());
+
+  if (!self->db_)
+    return Nan::ThrowError("Database not open");
+  if (self->cur_req)
+    return Nan::ThrowError("Query still in progress");
+  if (!info[2]->IsFunction())
+    return Nan::ThrowTypeError("Callback argument must be a function");
+
+  SessionRequest* sess_req = new SessionRequest(
+    info.Holder(), self, SessionOp::Create, Local<Function>::Cast(info[2])
+  );
+  Nan::Utf8String db_name(info[0]);
+  sess_req->db_name.assign(*db_name, db_name.length());
+  if (info[1]->IsArray()) {
+    Local<Array> tables = Local<Array>::Cast(info[1]);
+    for (uint32_t i = 0; i < tables->Length(); ++i) {
+      Nan::Utf8String table(Nan::Get(tables, i).ToLocalChecked());
+      sess_req->tables.emplace_back(*table, table.length());
     }
+  } else {
+    sess_req->all_tables = true;
   }
 
-  info.GetReturnValue().Set(info.This());
+  queue_session_request(self, sess_req);
 }
 
-NAN_METHOD(DBHandle::Open) {
+// sessionChangeset(id, patchset, callback)
+NAN_METHOD(DBHandle::SessionChangeset) {
   DBHandle* self = Nan::ObjectWrap::Unwrap<DBHandle>(info.Holder());
 
-  if (self->db_)
-    return Nan::ThrowError("Database already open, close first");
+  if (!self->db_)
+    return Nan::ThrowError("Database not open");
+  if (self->cur_req)
+    return Nan::ThrowError("Query still in progress");
+  if (!info[2]->IsFunction())
+    return Nan::ThrowTypeError("Callback argument must be a function");
+  sqlite3_session* session = get_session(self, info[0]);
+  if (!session)
+    return;
 
-  Nan::Utf8String filename(info[0]);
-  uint32_t flags = Nan::To<uint32_t>(info[1]).FromJust();
-  flags |= SQLITE_OPEN_NOMUTEX;
+  SessionRequest* sess_req = new SessionRequest(
+    info.Holder(), self, SessionOp::Changeset, Local<Function>::Cast(info[2])
+  );
+  sess_req->session = session;
+  sess_req->patchset = Nan::To<bool>(info[1]).FromJust();
 
-  int res = sqlite3_open_v2(*filename, &self->db_, flags, nullptr);
-  if (res != SQLITE_OK)
-    goto on_err;
+  queue_session_request(self, sess_req);
+}
 
-  res = sqlite3_extended_result_codes(self->db_, 1);
-  if (res != SQLITE_OK)
-    goto on_err;
+// sessionDelete(id, callback)
+NAN_METHOD(DBHandle::SessionDelete) {
+  DBHandle* self = Nan::ObjectWrap::Unwrap<DBHandle>(info.Holder());
 
-  // Disable dynamic loading of extensions
-  res = sqlite3_db_config(self->db_,
-                          SQLITE_DBCONFIG_ENABLE_LOAD_EXTENSION,
-                          0,
-                          nullptr);
-  if (res != SQLITE_OK)
-    goto on_err;
+  if (!self->db_)
+    return Nan::ThrowError("Database not open");
+  if (self->cur_req)
+    return Nan::ThrowError("Query still in progress");
+  if (!info[1]->IsFunction())
+    return Nan::ThrowTypeError("Callback argument must be a function");
+  sqlite3_session* session = get_session(self, info[0]);
+  if (!session)
+    return;
+  self->sessions.erase(Nan::To<uint32_t>(info[0]).FromJust());
 
-  // Disable language features that allow ordinary SQL to deliberately corrupt
-  // the database
-  res = sqlite3_db_config(self->db_,
-                          SQLITE_DBCONFIG_DEFENSIVE,
-                          1,
-                          nullptr);
-  if (res != SQLITE_OK)
-    goto on_err;
+  SessionRequest* sess_req = new SessionRequest(
+    info.Holder(), self, SessionOp::Delete, Local<Function>::Cast(info[1])
+  );
+  sess_req->session = session;
 
-  if (self->authorizeReq) {
-    res = sqlite3_set_authorizer(
-      self->db_,
-      self->authorizeReq->sqlite_auth_callback,
-      self->authorizeReq
-    );
-    if (res != SQLITE_OK)
-      goto on_err;
-  }
+  queue_session_request(self, sess_req);
+}
 
-  return;
+// applyChangeset(buffer, conflictActions, callback)
+NAN_METHOD(DBHandle::ApplyChangeset) {
+  DBHandle* self = Nan::ObjectWrap::Unwrap<DBHandle>(info.Holder());
 
-on_err:
-  Local<Value> err = Nan::Error(sqlite3_errstr(res));
-  if (self->db_) {
-    sqlite3_close_v2(self->db_);
-    self->db_ = nullptr;
+  if (!self->db_)
+    return Nan::ThrowError("Database not open");
+  if (self->cur_req)
+    return Nan::ThrowError("Query still in progress");
+  if (!Buffer::HasInstance(info[0]))
+    return Nan::ThrowTypeError("Changeset argument must be a Buffer");
+  if (!info[1]->IsArray())
+    return Nan::ThrowTypeError("Conflict actions argument must be an array");
+  if (!info[2]->IsFunction())
+    return Nan::ThrowTypeError("Callback argument must be a function");
+  if (Buffer::Length(info[0]) > INT_MAX)
+    return Nan::ThrowRangeError("Changeset too large");
+
+  Local<Object> buffer = Nan::To<Object>(info[0]).ToLocalChecked();
+  SessionRequest* sess_req = new SessionRequest(
+    info.Holder(), self, SessionOp::Apply, Local<Function>::Cast(info[2])
+  );
+  // The buffer is kept alive until the changeset has been applied
+  sess_req->changeset.Reset(buffer);
+  sess_req->data = Buffer::Data(buffer);
+  sess_req->size = static_cast<int>(Buffer::Length(buffer));
+  Local<Array> actions = Local<Array>::Cast(info[1]);
+  for (int i = 0; i < CONFLICT_TYPES; ++i) {
+    sess_req->conflict_actions[i] =
+      Nan::To<int32_t>(Nan::Get(actions, i).ToLocalChecked()).FromJust();
   }
-  Nan::ThrowError(err);
+
+  queue_session_request(self, sess_req);
 }
 
-NAN_METHOD(DBHandle::Query) {
+// snapshotGet(schema, callback)
+NAN_METHOD(DBHandle::SnapshotGet) {
   DBHandle* self = Nan::ObjectWrap::Unwrap<DBHandle>(info.Holder());
 
   if (!self->db_)
     return Nan::ThrowError("Database not open");
-
-  if (info.Length() == 0 || info.Length() == 1) {
-    if (!self->cur_req)
-      return Nan::ThrowError("No query in progress");
-    if (self->cur_req->active)
-      return Nan::ThrowError("Query already working");
-    if (info.Length() == 1)
-      self->cur_req->max_rows = Nan::To<uint32_t>(info[0]).FromJust();
-  } else if (self->cur_req) {
+  if (self->cur_req)
     return Nan::ThrowError("Query still in progress");
-  } else {
-    uint32_t prepare_flags = Nan::To<uint32_t>(info[1]).FromJust();
-    uint32_t query_flags = Nan::To<uint32_t>(info[2]).FromJust();
-    uint32_t max_rows = Nan::To<uint32_t>(info[4]).FromJust();
+  if (!info[1]->IsFunction())
+    return Nan::ThrowTypeError("Callback argument must be a function");
 
-    BindParamsType params_type;
-    void* params;
-    if (info[3]->IsArray()) {
-      Local<Array> param_list = Local<Array>::Cast(info[3]);
-      if (query_flags & QueryFlag::NamedParams) {
-        // [ key1, val1, key2, val2, ... ]
-        params_type = BindParamsType::Named;
-        NamedParamsMap* map = new NamedParamsMap();
-        for (uint32_t i = 0; i < param_list->Length(); i += 2) {
-          BindValue bv;
-          Local<Value> js_key = Nan::Get(param_list, i).ToLocalChecked();
-          Nan::Utf8String key_str(js_key);
-          Local<Value> js_val = Nan::Get(param_list, i + 1).ToLocalChecked();
-          if (!set_bind_value(bv, js_val)) {
-            delete map;
-            string msg = "Unsupported value for bind parameter \"";
-            msg += *key_str;
-            msg += "\": ";
-            Nan::Utf8String val_str(js_val);
-            msg += *val_str;
-            return Nan::ThrowError(Nan::New(msg).ToLocalChecked());
-          }
-          map->emplace(make_pair(string(*key_str, key_str.length()), bv));
-        }
-        params = map;
-      } else {
-        // [ val1, val2, .... ]
-        params_type = BindParamsType::Numeric;
-        vector<BindValue>* bind_values =
-          new vector<BindValue>(param_list->Length());
-        for (uint32_t i = 0; i < param_list->Length(); ++i) {
-          Local<Value> js_val = Nan::Get(param_list, i).ToLocalChecked();
-          if (!set_bind_value(bind_values->at(i), js_val)) {
-            delete bind_values;
-            string msg = "Unsupported value for bind parameter at position ";
-            msg += to_string(i);
-            msg += ": ";
-            Nan::Utf8String val_str(js_val);
-            msg += *val_str;
-            return Nan::ThrowError(Nan::New(msg).ToLocalChecked());
-          }
-        }
-        params = bind_values;
-      }
-    } else {
-      params_type = BindParamsType::None;
-      params = nullptr;
-    }
+  SnapshotRequest* snap_req = new SnapshotRequest(
+    info.Holder(), self, false, info[0], Local<Function>::Cast(info[1])
+  );
 
-    self->cur_req = new QueryRequest(info.Holder(),
-                                     self,
-                                     info[0],
-                                     params_type,
-                                     params,
-                                     prepare_flags,
-                                     query_flags,
-                                     max_rows);
+  ++self->working_;
+
+  int status = uv_queue_work(
+    uv_default_loop(),
+    &snap_req->request,
+    SnapshotWork,
+    reinterpret_cast<uv_after_work_cb>(SnapshotAfter)
+  );
+  assert(status == 0);
+}
+
+// snapshotOpen(schema, snapshot, callback)
+NAN_METHOD(DBHandle::SnapshotOpen) {
+  DBHandle* self = Nan::ObjectWrap::Unwrap<DBHandle>(info.Holder());
+
+  if (!self->db_)
+    return Nan::ThrowError("Database not open");
+  if (self->cur_req)
+    return Nan::ThrowError("Query still in progress");
+  if (!Buffer::HasInstance(info[1])
+      || Buffer::Length(info[1]) != sizeof(sqlite3_snapshot)) {
+    return Nan::ThrowTypeError("Invalid snapshot");
   }
+  if (!info[2]->IsFunction())
+    return Nan::ThrowTypeError("Callback argument must be a function");
+
+  SnapshotRequest* snap_req = new SnapshotRequest(
+    info.Holder(), self, true, info[0], Local<Function>::Cast(info[2])
+  );
+  memcpy(&snap_req->snapshot,
+         Buffer::Data(info[1]),
+         sizeof(sqlite3_snapshot));
 
   ++self->working_;
-  self->cur_req->active = true;
 
   int status = uv_queue_work(
     uv_default_loop(),
-    &self->cur_req->request,
-    QueryWork,
-    reinterpret_cast<uv_after_work_cb>(QueryAfter)
+    &snap_req->request,
+    SnapshotWork,
+    reinterpret_cast<uv_after_work_cb>(SnapshotAfter)
   );
   assert(status == 0);
 }
@@ -1357,20 +4667,33 @@ NAN_METHOD(DBHandle::Interrupt) {
   if (!self->db_)
     return Nan::ThrowError("Database not open");
 
-  Local<Function> callback = Local<Function>::Cast(info[0]);
+  // Work that is queued on the threadpool but not running a statement yet would
+  // not be affected by `sqlite3_interrupt()`, so also flag the query itself.
+  // The flag is set first so that work that starts in the meantime sees it.
+  QueryRequest* req = self->cur_req;
+  if (req && self->working_)
+    req->cancelled = true;
+
+  // `sqlite3_interrupt()` is safe to call from any thread, so call it directly
+  // instead of queueing it behind the (possibly saturated) threadpool
+  sqlite3_interrupt(self->db_);
+
+  // A query waiting to retry after SQLITE_BUSY has no running statement, so
+  // fail it right away instead
+  if (req && req->retry_timer) {
+    req->retry_interrupted = true;
+    uv_timer_stop(req->retry_timer);
+    busy_retry_cb(req->retry_timer);
+  }
+}
 
-  ++self->working_;
-  InterruptRequest* intr_req = new InterruptRequest(info.Holder(),
-                                                    self,
-                                                    callback);
+// busyRetry(initialDelayMs, maxDelayMs, maxWaitMs)
+NAN_METHOD(DBHandle::BusyRetry) {
+  DBHandle* self = Nan::ObjectWrap::Unwrap<DBHandle>(info.Holder());
 
-  int status = uv_queue_work(
-    uv_default_loop(),
-    &intr_req->request,
-    InterruptWork,
-    reinterpret_cast<uv_after_work_cb>(InterruptAfter)
-  );
-  assert(status == 0);
+  self->busy_initial_delay_ms = Nan::To<uint32_t>(info[0]).FromJust();
+  self->busy_max_delay_ms = Nan::To<uint32_t>(info[1]).FromJust();
+  self->busy_max_wait_ms = Nan::To<uint32_t>(info[2]).FromJust();
 }
 
 NAN_METHOD(DBHandle::Abort) {
@@ -1424,9 +4747,24 @@ NAN_METHOD(DBHandle::Close) {
   if (self->working_)
     return Nan::ThrowError("Cannot close database with active requests");
 
+  // Open blob and backup handles would otherwise keep the connection alive as
+  // a zombie
+  self->close_blobs();
+  self->close_backups();
+  self->close_sessions();
+  // Stopping the checkpointer first lets this connection checkpoint (and
+  // remove) the WAL when closing, as it is the last connection
+  self->stop_checkpointer();
+  if (self->notifier)
+    ChangeNotifier::uninstall(self->db_);
   int res = sqlite3_close_v2(self->db_);
   if (res != SQLITE_OK)
     return Nan::ThrowError(sqlite3_errstr(res));
+  if (self->notifier) {
+    self->notifier->close(true);
+    self->notifier = nullptr;
+  }
+  self->image.Reset();
   if (self->authorizeReq) {
     self->authorizeReq->close();
     self->authorizeReq = nullptr;
@@ -1449,8 +4787,162 @@ NAN_METHOD(Version) {
   info.GetReturnValue().Set(Nan::New(ver_str).ToLocalChecked());
 }
 
+#ifdef ESQLITE_BENCHMARKS
+// Micro-benchmarks for the per-value hot paths. These run their loops directly
+// on the calling thread without involving the event loop or the query queue,
+// so the results reflect only the binding's own per-value overhead.
+
+// Values are staged in batches to keep memory usage bounded for large values
+// and so that handles can be released regularly
+#define BENCH_BATCH_SIZE 1024
+
+// benchBind(values, iterations) => [ [setNs, bindNs], ... ]
+NAN_METHOD(BenchBind) {
+  if (!info[0]->IsArray())
+    return Nan::ThrowTypeError("Values argument must be an array");
+  Local<Array> values = Local<Array>::Cast(info[0]);
+  uint32_t iterations = Nan::To<uint32_t>(info[1]).FromJust();
+  if (iterations == 0)
+    return Nan::ThrowRangeError("Iterations must be greater than zero");
+
+  sqlite3* db;
+  int res = sqlite3_open_v2(":memory:",
+                            &db,
+                            SQLITE_OPEN_READWRITE | SQLITE_OPEN_NOMUTEX,
+                            nullptr);
+  if (res != SQLITE_OK) {
+    sqlite3_close_v2(db);
+    return Nan::ThrowError(sqlite3_errstr(res));
+  }
+  sqlite3_stmt* stmt;
+  res = sqlite3_prepare_v3(db, "SELECT ?", -1, 0, &stmt, nullptr);
+  if (res != SQLITE_OK) {
+    sqlite3_close_v2(db);
+    return Nan::ThrowError(sqlite3_errstr(res));
+  }
+
+  vector<BindValue> bvs(BENCH_BATCH_SIZE);
+  Local<Array> results = Nan::New<Array>(values->Length());
+  for (uint32_t i = 0; i < values->Length(); ++i) {
+    Local<Value> val = Nan::Get(values, i).ToLocalChecked();
+    uint64_t set_ns = 0;
+    uint64_t bind_ns = 0;
+    uint32_t remaining = iterations;
+    while (remaining) {
+      Nan::HandleScope scope;
+      uint32_t count = min(remaining, static_cast<uint32_t>(BENCH_BATCH_SIZE));
+
+      uint64_t start = uv_hrtime();
+      for (uint32_t n = 0; n < count; ++n) {
+        if (!set_bind_value(bvs[n], val)) {
+          for (uint32_t c = 0; c < n; ++c)
+            bind_value_cleanup(bvs[c]);
+          sqlite3_finalize(stmt);
+          sqlite3_close_v2(db);
+          return Nan::ThrowError("Unsupported bind value");
+        }
+      }
+      set_ns += (uv_hrtime() - start);
+
+      start = uv_hrtime();
+      for (uint32_t n = 0; n < count; ++n)
+        bind_value(stmt, 1, bvs[n], &res);
+      bind_ns += (uv_hrtime() - start);
+
+      sqlite3_clear_bindings(stmt);
+      for (uint32_t n = 0; n < count; ++n)
+        bind_value_cleanup(bvs[n]);
+      remaining -= count;
+    }
+
+    Local<Array> result = Nan::New<Array>(2);
+    Nan::Set(result, 0, Nan::New<Number>(
+      static_cast<double>(set_ns) / iterations
+    )).FromJust();
+    Nan::Set(result, 1, Nan::New<Number>(
+      static_cast<double>(bind_ns) / iterations
+    )).FromJust();
+    Nan::Set(results, i, result).FromJust();
+  }
+
+  sqlite3_finalize(stmt);
+  sqlite3_close_v2(db);
+  info.GetReturnValue().Set(results);
+}
+
+// benchMaterialize(type, length, iterations) => nanoseconds per value
+//   `type` is one of: 0 = null, 1 = string, 2 = blob
+NAN_METHOD(BenchMaterialize) {
+  uint32_t type = Nan::To<uint32_t>(info[0]).FromJust();
+  uint32_t len = Nan::To<uint32_t>(info[1]).FromJust();
+  uint32_t iterations = Nan::To<uint32_t>(info[2]).FromJust();
+  if (type > 2)
+    return Nan::ThrowRangeError("Invalid value type");
+  if (iterations == 0)
+    return Nan::ThrowRangeError("Iterations must be greater than zero");
+
+  char* src = static_cast<char*>(malloc(len ? len : 1));
+  assert(src != nullptr);
+  memset(src, 'x', len);
+
+  // Values are staged just as `QueryWork()` would leave them so that only the
+  // conversion itself is timed
+  vector<RowValue> batch(BENCH_BATCH_SIZE);
+  uint64_t total_ns = 0;
+  uint32_t remaining = iterations;
+  while (remaining) {
+    Nan::HandleScope scope;
+    uint32_t count = min(remaining, static_cast<uint32_t>(BENCH_BATCH_SIZE));
+    for (uint32_t n = 0; n < count; ++n) {
+      RowValue& rv = batch[n];
+      if (type == 0) {
+        rv.type = ValueType::Null;
+      } else if (len == 0) {
+        rv.type = (type == 1 ? ValueType::StringEmpty : ValueType::BlobEmpty);
+      } else {
+        rv.type = (type == 1 ? ValueType::String : ValueType::Blob);
+        rv.len = len;
+        rv.val = malloc(len);
+        assert(rv.val != nullptr);
+        memcpy(rv.val, src, len);
+      }
+    }
+
+    uint64_t start = uv_hrtime();
+    for (uint32_t n = 0; n < count; ++n)
+      row_value_to_js(batch[n]);
+    total_ns += (uv_hrtime() - start);
+
+    remaining -= count;
+  }
 
+  free(src);
+  info.GetReturnValue().Set(
+    Nan::New<Number>(static_cast<double>(total_ns) / iterations)
+  );
+}
+#endif
 
+// Whether the CPU provides AES instructions, which the AES-based AEGIS cipher
+// relies on for its performance
+NAN_METHOD(AESHardwareSupported) {
+  bool supported = false;
+#if defined(__x86_64__) || defined(__i386__)
+  unsigned int eax, ebx, ecx, edx;
+  if (__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+    supported = ((ecx & bit_AES) != 0);
+#elif defined(_M_X64) || defined(_M_IX86)
+  int regs[4];
+  __cpuid(regs, 1);
+  supported = ((regs[2] & (1 << 25)) != 0);
+#elif defined(__aarch64__) && defined(__APPLE__)
+  // All 64-bit Apple ARM CPUs implement the ARMv8 Cryptography Extensions
+  supported = true;
+#elif defined(__aarch64__) && defined(__linux__)
+  supported = ((getauxval(AT_HWCAP) & HWCAP_AES) != 0);
+#endif
+  info.GetReturnValue().Set(Nan::New(supported));
+}
 
 NAN_MODULE_INIT(init) {
   static bool is_initialized = false;
@@ -1467,9 +4959,37 @@ NAN_MODULE_INIT(init) {
 
   Nan::SetPrototypeMethod(tpl, "open", DBHandle::Open);
   Nan::SetPrototypeMethod(tpl, "query", DBHandle::Query);
+  Nan::SetPrototypeMethod(tpl, "batch", DBHandle::Batch);
+  Nan::SetPrototypeMethod(tpl, "exec", DBHandle::Exec);
+  Nan::SetPrototypeMethod(tpl, "querySync", DBHandle::QuerySync);
+  Nan::SetPrototypeMethod(tpl, "blobOpen", DBHandle::BlobOpen);
+  Nan::SetPrototypeMethod(tpl, "blobRead", DBHandle::BlobRead);
+  Nan::SetPrototypeMethod(tpl, "blobWrite", DBHandle::BlobWrite);
+  Nan::SetPrototypeMethod(tpl, "blobClose", DBHandle::BlobClose);
+  Nan::SetPrototypeMethod(tpl, "backupInit", DBHandle::BackupInit);
+  Nan::SetPrototypeMethod(tpl, "backupStep", DBHandle::BackupStep);
+  Nan::SetPrototypeMethod(tpl, "backupFinish", DBHandle::BackupFinish);
+  Nan::SetPrototypeMethod(tpl, "serialize", DBHandle::Serialize);
+  Nan::SetPrototypeMethod(tpl, "deserialize", DBHandle::Deserialize);
+  Nan::SetPrototypeMethod(tpl,
+                          "startCheckpointer",
+                          DBHandle::StartCheckpointer);
+  Nan::SetPrototypeMethod(tpl, "checkpointStats", DBHandle::CheckpointStats);
+  Nan::SetPrototypeMethod(tpl,
+                          "setChangeListener",
+                          DBHandle::SetChangeListener);
+  Nan::SetPrototypeMethod(tpl, "sessionCreate", DBHandle::SessionCreate);
+  Nan::SetPrototypeMethod(tpl,
+                          "sessionChangeset",
+                          DBHandle::SessionChangeset);
+  Nan::SetPrototypeMethod(tpl, "sessionDelete", DBHandle::SessionDelete);
+  Nan::SetPrototypeMethod(tpl, "applyChangeset", DBHandle::ApplyChangeset);
+  Nan::SetPrototypeMethod(tpl, "snapshotGet", DBHandle::SnapshotGet);
+  Nan::SetPrototypeMethod(tpl, "snapshotOpen", DBHandle::SnapshotOpen);
   Nan::SetPrototypeMethod(tpl, "autoCommitEnabled", DBHandle::AutoCommit);
   Nan::SetPrototypeMethod(tpl, "limit", DBHandle::Limit);
   Nan::SetPrototypeMethod(tpl, "interrupt", DBHandle::Interrupt);
+  Nan::SetPrototypeMethod(tpl, "busyRetry", DBHandle::BusyRetry);
   Nan::SetPrototypeMethod(tpl, "abort", DBHandle::Abort);
   Nan::SetPrototypeMethod(tpl, "close", DBHandle::Close);
 
@@ -1479,6 +4999,11 @@ NAN_MODULE_INIT(init) {
   Nan::Set(target, Nan::New("DBHandle").ToLocalChecked(), ctor);
 
   Nan::Export(target, "version", Version);
+  Nan::Export(target, "aesHardwareSupported", AESHardwareSupported);
+#ifdef ESQLITE_BENCHMARKS
+  Nan::Export(target, "benchBind", BenchBind);
+  Nan::Export(target, "benchMaterialize", BenchMaterialize);
+#endif
 }
 
 NAN_MODULE_WORKER_ENABLED(esqlite3, init)
@@ -1,9 +1,15 @@
 'use strict';
 
 const assert = require('assert');
+const { mkdirSync, unlinkSync } = require('fs');
 const { join } = require('path');
 
-const { Database, OPEN_FLAGS } = require(join(__dirname, '..', 'lib'));
+const {
+  ACTION_CODES,
+  Database,
+  OPEN_FLAGS,
+  ShardedDatabase,
+} = require(join(__dirname, '..', 'lib'));
 const { test } = require(join(__dirname, 'common.js'));
 
 let supportsAsyncDispose = false;
@@ -561,6 +567,1038 @@ test(async () => {
   db.close();
 });
 
+test(async () => {
+  const db = new Database(':memory:');
+  db.open();
+  const infinite = `
+    WITH RECURSIVE c(x) AS (SELECT 1 UNION ALL SELECT x + 1 FROM c)
+    SELECT count(*) FROM c
+  `;
+
+  await assert.rejects(
+    db.queryAsync(infinite, { timeoutMs: 50 }).execute(),
+    { code: 'ESQLITE_TIMEOUT' }
+  );
+  await assert.rejects(
+    db.queryAsync(infinite, { maxVmSteps: 100000 }).execute(),
+    { code: 'ESQLITE_VM_STEP_LIMIT' }
+  );
+
+  // Queries within their limits are unaffected
+  assert.deepStrictEqual(
+    await db.queryAsync(
+      'SELECT count(*) AS n FROM generate_series(1,100)',
+      { timeoutMs: 10000, maxVmSteps: 1000000 }
+    ).execute(),
+    [ { n: '100' } ]
+  );
+
+  // Remaining statements are skipped once a limit is hit
+  const iter = db.queryMultiAsync(`${infinite}; SELECT 1`, { timeoutMs: 50 });
+  const { value: stmt } = await iter.next();
+  await assert.rejects(stmt.execute(), { code: 'ESQLITE_TIMEOUT' });
+  assert.deepStrictEqual(await iter.next(), { done: true });
+
+  assert.throws(
+    () => db.queryAsync('SELECT 1', { timeoutMs: 0 }),
+    /invalid timeout/i
+  );
+  assert.throws(
+    () => db.queryAsync('SELECT 1', { maxVmSteps: 1.5 }),
+    /invalid VM step limit/i
+  );
+  db.close();
+});
+
+test(async () => {
+  const db = new Database(':memory:');
+  db.open();
+  const sql = 'SELECT value FROM generate_series(1,200000)';
+
+  // Time slicing must not change the results, regardless of chunking
+  const rows = await db.queryAsync(sql, { timeSliceMs: 1 }).execute();
+  assert.strictEqual(rows.length, 200000);
+  assert.strictEqual(rows[0].value, '1');
+  assert.strictEqual(rows[199999].value, '200000');
+
+  let count = 0;
+  let last = 0;
+  const stmt = db.queryAsync(sql, { timeSliceMs: 1, rowsAsArray: true });
+  for await (const chunk of stmt.iterate(30000)) {
+    assert(chunk.length <= 30000);
+    for (const [ value ] of chunk) {
+      assert.strictEqual(+value, ++last);
+      ++count;
+    }
+  }
+  assert.strictEqual(count, 200000);
+
+  assert.throws(
+    () => db.queryAsync('SELECT 1', { timeSliceMs: -1 }),
+    /invalid time slice/i
+  );
+  db.close();
+});
+
+test(async () => {
+  const db = new Database(':memory:');
+  db.open({ groupCommit: { windowMs: 5, maxBatch: 3 } });
+  assert.throws(
+    () => db.open({ groupCommit: { maxBatch: 0 } }),
+    /invalid groupCommit\.maxBatch/i
+  );
+  assert.throws(() => db.write(1), /invalid sql/i);
+
+  await db.queryAsync(
+    'CREATE TABLE t (id INTEGER PRIMARY KEY, name TEXT UNIQUE)'
+  ).execute();
+  const results = await Promise.allSettled([
+    db.write('INSERT INTO t (name) VALUES (?)', [ 'a' ]),
+    db.write('INSERT INTO t (name) VALUES (:name)', { name: 'b' }),
+    // Fails, but must not affect the other writes in the same transaction
+    db.write('INSERT INTO t (name) VALUES (?)', [ 'a' ]),
+    // Starts a second batch since `maxBatch` was reached
+    db.write('INSERT INTO t (name) VALUES (?)', [ 'c' ]),
+    db.write('UPDATE t SET name = name || name'),
+  ]);
+  assert.deepStrictEqual(
+    results.map((r) => r.status),
+    [ 'fulfilled', 'fulfilled', 'rejected', 'fulfilled', 'fulfilled' ]
+  );
+  assert.strictEqual(results[2].reason.code, 'SQLITE_CONSTRAINT_UNIQUE');
+  assert.deepStrictEqual(
+    results.filter((r) => r.status === 'fulfilled').map((r) => r.value),
+    [
+      { changes: 1, lastInsertRowid: 1, totalChanges: 1 },
+      { changes: 1, lastInsertRowid: 2, totalChanges: 2 },
+      { changes: 1, lastInsertRowid: 3, totalChanges: 3 },
+      { changes: 3, lastInsertRowid: 3, totalChanges: 6 },
+    ]
+  );
+  assert.strictEqual(db.autoCommitEnabled(), true);
+
+  // Writes are not folded into a transaction that may still be rolled back
+  await db.exec('BEGIN');
+  await assert.rejects(
+    db.write('INSERT INTO t (name) VALUES (?)', [ 'x' ]),
+    { code: 'TRANSACTION_OPEN' }
+  );
+  await db.exec('ROLLBACK');
+  assert.deepStrictEqual(
+    db.querySync('SELECT count(*) AS n FROM t WHERE name = ?', [ 'x' ]),
+    [ { n: '0' } ]
+  );
+
+  const pending = db.write('INSERT INTO t (name) VALUES (?)', [ 'd' ]);
+  db.close();
+  await assert.rejects(pending, /database closed/i);
+});
+
+test(async () => {
+  const db = new Database(':memory:');
+  db.open();
+  assert.throws(() => db.transaction('SELECT 1'), /invalid statements/i);
+  assert.throws(
+    () => db.transaction([ 'SELECT 1' ], { mode: 'nested' }),
+    /invalid transaction mode/i
+  );
+  assert.throws(() => db.transaction([ { sql: 1 } ]), /index 0/i);
+
+  const results = await db.transaction([
+    'CREATE TABLE t (id INTEGER PRIMARY KEY, name TEXT UNIQUE)',
+    { sql: 'INSERT INTO t (name) VALUES (?)', params: [ 'a' ] },
+    { sql: 'INSERT INTO t (name) VALUES (:name)', params: { name: 'b' } },
+    'SELECT name FROM t ORDER BY id',
+  ], { mode: 'immediate' });
+  assert.deepStrictEqual(
+    results,
+    [ [], [], [], [ { name: 'a' }, { name: 'b' } ] ]
+  );
+
+  // A failing statement rolls back everything
+  await assert.rejects(db.transaction([
+    { sql: 'INSERT INTO t (name) VALUES (?)', params: [ 'c' ] },
+    { sql: 'INSERT INTO t (name) VALUES (?)', params: [ 'a' ] },
+  ]), { code: 'SQLITE_CONSTRAINT_UNIQUE', index: 1 });
+  assert.strictEqual(db.autoCommitEnabled(), true);
+
+  // Nested within an explicit transaction
+  await db.queryAsync('BEGIN').execute();
+  await assert.rejects(db.transaction([
+    { sql: 'INSERT INTO t (name) VALUES (?)', params: [ 'd' ] },
+    'SELECT * FROM missing',
+  ]), { index: 1 });
+  await db.transaction([
+    { sql: 'INSERT INTO t (name) VALUES (?)', params: [ 'e' ] },
+  ]);
+  assert.strictEqual(db.autoCommitEnabled(), false);
+  await db.queryAsync('COMMIT').execute();
+
+  const [ rows ] = await db.transaction(
+    [ 'SELECT name FROM t ORDER BY id' ],
+    { rowsAsArray: true }
+  );
+  assert.deepStrictEqual(rows, [ [ 'a' ], [ 'b' ], [ 'e' ] ]);
+  db.close();
+});
+
+test(async () => {
+  const db = new Database(':memory:');
+  db.open();
+  assert.throws(() => db.exec(1), /invalid sql/i);
+
+  let script = 'CREATE TABLE t (id INTEGER PRIMARY KEY, v INT);\n';
+  for (let i = 0; i < 1000; ++i)
+    script += `INSERT INTO t (v) VALUES (${i}); -- row ${i}\n`;
+  script += 'SELECT * FROM t;';
+  assert.strictEqual(await db.exec(script), undefined);
+  const [ { n } ] =
+    await db.queryAsync('SELECT count(*) AS n FROM t').execute();
+  assert.strictEqual(n, '1000');
+
+  // Execution stops at the first error, which carries its offset
+  const bad = 'INSERT INTO t (v) VALUES (1);\nINSERT INTO t (v) VALUS (2);';
+  await assert.rejects(db.exec(bad), (err) => {
+    assert.strictEqual(err.code, 'SQLITE_ERROR');
+    assert.strictEqual(err.offset, bad.indexOf('VALUS'));
+    return true;
+  });
+  const [ { m } ] =
+    await db.queryAsync('SELECT count(*) AS m FROM t').execute();
+  assert.strictEqual(m, '1001');
+  db.close();
+});
+
+test(async () => {
+  const db = new Database(':memory:');
+  db.open();
+  await db.exec('CREATE TABLE t (id INTEGER PRIMARY KEY, v INT)');
+
+  assert.deepStrictEqual(
+    await db.run('INSERT INTO t (v) VALUES (?), (?)', [ 1, 2 ]),
+    { changes: 2, lastInsertRowid: 2, totalChanges: 2 }
+  );
+  // Row IDs beyond the safe integer range are returned as BigInt
+  const big = 2n ** 62n;
+  assert.deepStrictEqual(
+    await db.run('INSERT INTO t (id, v) VALUES (:id, 3)', {
+      values: { id: big },
+    }),
+    { changes: 1, lastInsertRowid: big, totalChanges: 3 }
+  );
+  // Rows are discarded and read-only statements report no changes
+  assert.deepStrictEqual(
+    await db.run('SELECT * FROM t'),
+    { changes: 0, lastInsertRowid: big, totalChanges: 3 }
+  );
+  // Neither do statements that are not INSERT, UPDATE or DELETE, even though
+  // SQLite keeps reporting the previous statement's count for those
+  assert.deepStrictEqual(
+    await db.run('CREATE INDEX t_v ON t (v)'),
+    { changes: 0, lastInsertRowid: big, totalChanges: 3 }
+  );
+  assert.deepStrictEqual(
+    await db.write('DROP INDEX t_v'),
+    { changes: 0, lastInsertRowid: big, totalChanges: 3 }
+  );
+  await assert.rejects(db.run('INSERT INTO missing VALUES (1)'), /missing/);
+
+  const stmt = db.queryAsync('UPDATE t SET v = v + 1 WHERE v < 3');
+  await stmt.execute();
+  assert.strictEqual(stmt.changes, 2);
+  assert.strictEqual(stmt.lastInsertRowid, big);
+
+  await new Promise((resolve, reject) => {
+    db.query('DELETE FROM t WHERE v = 2', (err, rows, metrics) => {
+      try {
+        assert.ifError(err);
+        assert.strictEqual(metrics.changes, 1);
+        assert.strictEqual(metrics.totalChanges, 6);
+      } catch (ex) {
+        return reject(ex);
+      }
+      resolve();
+    });
+  });
+  db.close();
+});
+
+test(async () => {
+  const db = new Database(':memory:');
+  db.open();
+  await db.exec(`
+    CREATE TABLE t (id INTEGER PRIMARY KEY, name TEXT);
+    INSERT INTO t (name) VALUES ('a'), ('b'), ('c');
+  `);
+
+  assert.deepStrictEqual(
+    await db.get('SELECT * FROM t WHERE id > ? ORDER BY id', [ 1 ]),
+    { id: '2', name: 'b' }
+  );
+  assert.deepStrictEqual(
+    await db.get('SELECT name, id FROM t', { rowsAsArray: true }),
+    [ 'a', '1' ]
+  );
+  assert.strictEqual(await db.get('SELECT * FROM t WHERE id = 0'), undefined);
+  assert.strictEqual(await db.get('DELETE FROM t WHERE id = 0'), undefined);
+
+  assert.deepStrictEqual(
+    await db.pluck('SELECT name, id FROM t ORDER BY id DESC'),
+    [ 'c', 'b', 'a' ]
+  );
+  assert.deepStrictEqual(await db.pluck('SELECT * FROM t WHERE id = 0'), []);
+  await assert.rejects(db.pluck('SELECT * FROM missing'), /missing/);
+  db.close();
+});
+
+test(async () => {
+  const db = new Database(':memory:');
+  db.open();
+  assert.deepStrictEqual(
+    db.querySync('CREATE TABLE t (id INTEGER PRIMARY KEY, name TEXT)'),
+    []
+  );
+  db.querySync('INSERT INTO t (name) VALUES (?), (?)', [ 'a', 'b' ]);
+
+  assert.deepStrictEqual(
+    db.querySync('SELECT * FROM t ORDER BY id'),
+    [ { id: '1', name: 'a' }, { id: '2', name: 'b' } ]
+  );
+  assert.deepStrictEqual(
+    db.getSync('SELECT name FROM t WHERE id = :id', { values: { id: 2 } }),
+    { name: 'b' }
+  );
+  assert.deepStrictEqual(
+    db.getSync('SELECT * FROM t', { rowsAsArray: true }),
+    [ '1', 'a' ]
+  );
+  assert.strictEqual(db.getSync('SELECT * FROM t WHERE id = 0'), undefined);
+  assert.throws(() => db.querySync('SELECT * FROM missing'), /missing/);
+
+  // Refused while the connection may be in use by the threadpool
+  const pending = db.get('SELECT count(*) AS n FROM t');
+  assert.throws(
+    () => db.querySync('SELECT 1'),
+    /asynchronous requests are active/
+  );
+  assert.deepStrictEqual(await pending, { n: '2' });
+  assert.deepStrictEqual(db.getSync('SELECT count(*) AS n FROM t'), { n: '2' });
+  db.close();
+});
+
+test(async () => {
+  // A JS authorizer is called directly (without going through the event loop)
+  // when executing synchronously
+  const calls = [];
+  let throwError = false;
+  const db = new Database(':memory:', (code, table) => {
+    if (throwError)
+      throw new Error('authorizer failure');
+    calls.push(table);
+    return (code !== ACTION_CODES.READ || table !== 'secret');
+  });
+  db.open();
+  db.querySync('CREATE TABLE t (id INTEGER PRIMARY KEY)');
+  db.querySync('CREATE TABLE secret (id INTEGER PRIMARY KEY)');
+  db.querySync('INSERT INTO t VALUES (1)');
+  assert.deepStrictEqual(db.getSync('SELECT id FROM t'), { id: '1' });
+  assert(calls.includes('t'));
+  assert.throws(() => db.getSync('SELECT id FROM secret'), /not authorized/);
+
+  throwError = true;
+  assert.throws(() => db.getSync('SELECT id FROM t'), /authorizer failure/);
+  throwError = false;
+
+  // The asynchronous path still works afterwards
+  assert.deepStrictEqual(await db.get('SELECT id FROM t'), { id: '1' });
+  await assert.rejects(db.get('SELECT id FROM secret'), /not authorized/);
+  db.close();
+});
+
+test(async () => {
+  const db = new Database(':memory:');
+  db.open();
+  const data = Buffer.alloc(200000);
+  for (let i = 0; i < data.length; ++i)
+    data[i] = (i % 251);
+  await db.exec('CREATE TABLE files (id INTEGER PRIMARY KEY, data BLOB)');
+  await db.run('INSERT INTO files (data) VALUES (?)', [ data ]);
+  await db.run('INSERT INTO files (data) VALUES (zeroblob(10))');
+
+  const blob = await db.openBlob('files', 'data', 1);
+  assert.strictEqual(blob.size, data.length);
+  assert.deepStrictEqual(await blob.read(1000, 10), data.slice(1000, 1010));
+  assert.deepStrictEqual(await blob.read(data.length - 2, 10),
+                         data.slice(-2));
+  await assert.rejects(blob.write(0, Buffer.from('x')), /not writable/);
+
+  const chunks = [];
+  const stream = blob.createReadStream({ start: 100, end: 150099 });
+  for await (const chunk of stream)
+    chunks.push(chunk);
+  assert(chunks.length > 1);
+  assert.deepStrictEqual(Buffer.concat(chunks), data.slice(100, 150100));
+  // The stream closed the blob once it ended
+  await assert.rejects(blob.read(0, 1), /Blob is closed/);
+
+  const wblob = await db.openBlob('files', 'data', 2n, { write: true });
+  const ws = wblob.createWriteStream({ start: 2 });
+  await new Promise((resolve, reject) => {
+    ws.on('error', reject).on('finish', resolve);
+    ws.write(Buffer.from('abc'));
+    ws.end(Buffer.from('de'));
+  });
+  assert.deepStrictEqual(
+    await db.get('SELECT hex(data) AS h FROM files WHERE id = 2'),
+    { h: '00006162636465000000' }
+  );
+
+  const wblob2 = await db.openBlob('files', 'data', 2, { write: true });
+  await assert.rejects(wblob2.write(8, Buffer.from('xyz')));
+  await wblob2.close();
+
+  await assert.rejects(db.openBlob('files', 'data', 3), /no such rowid/);
+  db.close();
+});
+
+test(async () => {
+  const basePath = join(__dirname, 'tmp');
+  const srcPath = join(basePath, 'backup-src.db');
+  const destPath = join(basePath, 'backup-dest.db');
+  const cleanup = () => {
+    for (const path of [ srcPath, destPath ]) {
+      try {
+        unlinkSync(path);
+      } catch (ex) {
+        if (ex.code !== 'ENOENT')
+          throw ex;
+      }
+    }
+  };
+  try {
+    mkdirSync(basePath);
+  } catch (ex) {
+    if (ex.code !== 'EEXIST')
+      throw ex;
+  }
+  cleanup();
+
+  try {
+    {
+      const db = new Database(':memory:');
+      db.open();
+      await db.exec(`
+        PRAGMA page_size = 1024;
+        CREATE TABLE t (id INTEGER PRIMARY KEY, data BLOB);
+        WITH RECURSIVE n(i) AS (SELECT 1 UNION ALL SELECT i + 1 FROM n
+                                WHERE i < 100)
+        INSERT INTO t (data) SELECT randomblob(1000) FROM n;
+      `);
+      const progress = [];
+      const backup = db.backup(destPath, {
+        pagesPerStep: 10,
+        progress: (info) => progress.push(info),
+      });
+      // Queries are not held up until the backup has finished
+      const [ result, row ] =
+        await Promise.all([ backup, db.get('SELECT count(*) AS n FROM t') ]);
+      assert.deepStrictEqual(row, { n: '100' });
+      assert(result.pageCount > 100);
+      assert(progress.length > 10);
+      assert.deepStrictEqual(progress[progress.length - 1],
+                             { remaining: 0, pageCount: result.pageCount });
+      db.close();
+
+      const copy = new Database(destPath);
+      copy.open();
+      assert.deepStrictEqual(
+        await copy.get('SELECT count(*) AS n FROM t'),
+        { n: '100' }
+      );
+      copy.close();
+    }
+
+    {
+      // Encrypted destination
+      cleanup();
+      const db = new Database(srcPath);
+      db.open();
+      await db.exec(`
+        PRAGMA key = 'foobarbaz';
+        CREATE TABLE t (name TEXT);
+        INSERT INTO t VALUES ('a'), ('b');
+      `);
+      await db.backup(destPath, { key: 'bazbarfoo', pauseMs: 1 });
+      db.close();
+
+      const copy = new Database(destPath);
+      copy.open();
+      await assert.rejects(copy.get('SELECT count(*) AS n FROM t'));
+      copy.close();
+
+      const keyed = new Database(destPath);
+      keyed.open();
+      await keyed.exec(`PRAGMA key = 'bazbarfoo'`);
+      assert.deepStrictEqual(
+        await keyed.pluck('SELECT name FROM t ORDER BY name'),
+        [ 'a', 'b' ]
+      );
+      keyed.close();
+    }
+  } finally {
+    cleanup();
+  }
+});
+
+test(async () => {
+  const db = new Database(':memory:');
+  db.open();
+  assert.strictEqual((await db.serialize()).length, 0);
+  await db.exec(`
+    CREATE TABLE t (id INTEGER PRIMARY KEY, name TEXT);
+    INSERT INTO t (name) VALUES ('a'), ('b');
+  `);
+  const image = await db.serialize('main');
+  assert(image.length > 0);
+  assert.strictEqual(image.toString('latin1', 0, 15), 'SQLite format 3');
+  await assert.rejects(db.serialize('missing'), /Unknown database/);
+  db.close();
+
+  const copy = await Database.fromBuffer(image);
+  await copy.run(`INSERT INTO t (name) VALUES ('c')`);
+  assert.deepStrictEqual(await copy.pluck('SELECT name FROM t ORDER BY id'),
+                         [ 'a', 'b', 'c' ]);
+  copy.close();
+
+  const ro = await Database.fromBuffer(image, { readonly: true });
+  assert.deepStrictEqual(await ro.pluck('SELECT name FROM t ORDER BY id'),
+                         [ 'a', 'b' ]);
+  await assert.rejects(ro.run(`INSERT INTO t (name) VALUES ('c')`),
+                       /readonly/);
+  ro.close();
+
+  await assert.rejects(Database.fromBuffer(Buffer.alloc(4096, 'x')),
+                       /not a database/);
+});
+
+test(async () => {
+  const basePath = join(__dirname, 'tmp');
+  const dbPath = join(basePath, 'checkpointer.db');
+  const cleanup = () => {
+    for (const suffix of [ '', '-wal', '-shm' ]) {
+      try {
+        unlinkSync(`${dbPath}${suffix}`);
+      } catch (ex) {
+        if (ex.code !== 'ENOENT')
+          throw ex;
+      }
+    }
+  };
+  try {
+    mkdirSync(basePath);
+  } catch (ex) {
+    if (ex.code !== 'EEXIST')
+      throw ex;
+  }
+  cleanup();
+
+  try {
+    {
+      const db = new Database(':memory:');
+      assert.throws(() => db.open({ checkpointer: true }), /database file/);
+      db.open();
+      assert.strictEqual(db.checkpointStats(), null);
+      db.close();
+    }
+
+    const db = new Database(dbPath);
+    db.open({ checkpointer: { passivePages: 10 } });
+    await db.exec(`
+      PRAGMA journal_mode = WAL;
+      CREATE TABLE t (data BLOB);
+    `);
+    for (let i = 0; i < 20; ++i)
+      await db.run('INSERT INTO t VALUES (randomblob(4000))');
+
+    let stats;
+    for (let i = 0; i < 100; ++i) {
+      stats = db.checkpointStats();
+      if (stats.framesBackfilled > 0)
+        break;
+      await new Promise((resolve) => setTimeout(resolve, 10));
+    }
+    assert(stats.walPages > 0);
+    assert(stats.checkpoints > 0);
+    assert(stats.framesBackfilled > 0);
+    assert.strictEqual(stats.errors, 0);
+    assert(stats.maxDurationMs >= stats.lastDurationMs);
+    db.close();
+  } finally {
+    cleanup();
+  }
+});
+
+test(async () => {
+  const db = new Database(':memory:');
+  db.open();
+  const batches = [];
+  await db.setChangeListener((changes) => batches.push(changes));
+  await db.exec(`
+    CREATE TABLE t (id INTEGER PRIMARY KEY, name TEXT);
+    INSERT INTO t (name) VALUES ('a'), ('b');
+  `);
+  await db.transaction([
+    `UPDATE t SET name = 'c' WHERE id = 1`,
+    'DELETE FROM t WHERE id = 2',
+  ]);
+  await db.exec(`
+    BEGIN;
+    INSERT INTO t (name) VALUES ('dropped');
+    ROLLBACK;
+  `);
+  await db.setChangeListener(null);
+  await db.run(`INSERT INTO t (name) VALUES ('unseen')`);
+  // Let any (unexpected) notification arrive
+  await new Promise((resolve) => setTimeout(resolve, 10));
+
+  assert.deepStrictEqual(batches, [
+    [
+      { op: 'insert', db: 'main', table: 't', rowid: 1 },
+      { op: 'insert', db: 'main', table: 't', rowid: 2 },
+    ],
+    [
+      { op: 'update', db: 'main', table: 't', rowid: 1 },
+      { op: 'delete', db: 'main', table: 't', rowid: 2 },
+    ],
+  ]);
+  db.close();
+});
+
+test(async () => {
+  const db = new Database(':memory:');
+  db.open({ groupCommit: { windowMs: 5, maxBatch: 3 } });
+  await db.exec('CREATE TABLE t (id INTEGER PRIMARY KEY, name TEXT UNIQUE)');
+  const batches = [];
+  await db.setChangeListener((changes) => batches.push(changes));
+
+  // The failing write inserts a row before hitting the constraint, which is
+  // undone along with the rest of that write when its savepoint is rolled back
+  const results = await Promise.allSettled([
+    db.write(`INSERT INTO t (name) VALUES ('a')`),
+    db.write(`INSERT INTO t (name) VALUES ('x'), ('a')`),
+    db.write(`INSERT INTO t (name) VALUES ('b')`),
+  ]);
+  assert.deepStrictEqual(
+    results.map((r) => r.status),
+    [ 'fulfilled', 'rejected', 'fulfilled' ]
+  );
+
+  // Changes undone within a transaction that still commits are dropped
+  await db.exec(`
+    BEGIN;
+    INSERT INTO t (name) VALUES ('c');
+    SAVEPOINT s;
+    INSERT INTO t (name) VALUES ('y');
+    ROLLBACK TO s;
+  `);
+  await assert.rejects(
+    db.exec(`INSERT INTO t (name) VALUES ('z'), ('a')`),
+    /UNIQUE constraint failed/
+  );
+  await db.exec('COMMIT');
+  await new Promise((resolve) => setTimeout(resolve, 10));
+
+  assert.deepStrictEqual(batches, [
+    [
+      { op: 'insert', db: 'main', table: 't', rowid: 1 },
+      { op: 'insert', db: 'main', table: 't', rowid: 2 },
+    ],
+    [
+      { op: 'insert', db: 'main', table: 't', rowid: 3 },
+    ],
+  ]);
+  assert.deepStrictEqual(
+    db.querySync('SELECT id, name FROM t ORDER BY id'),
+    [ { id: '1', name: 'a' }, { id: '2', name: 'b' }, { id: '3', name: 'c' } ]
+  );
+  db.close();
+});
+
+test(async () => {
+  const schema = `
+    CREATE TABLE t (id INTEGER PRIMARY KEY, name TEXT);
+    INSERT INTO t VALUES (1, 'a'), (2, 'b'), (3, 'c');
+  `;
+  const src = new Database(':memory:');
+  src.open();
+  await src.exec(schema);
+  const replica = new Database(':memory:');
+  replica.open();
+  await replica.exec(schema);
+
+  const session = await src.createSession([ 't' ]);
+  await src.exec(`
+    INSERT INTO t VALUES (4, 'd');
+    UPDATE t SET name = 'bb' WHERE id = 2;
+    DELETE FROM t WHERE id = 3;
+  `);
+  const changeset = await session.changeset();
+  assert(changeset.length > 0);
+  assert((await session.patchset()).length <= changeset.length);
+  await session.close();
+  await assert.rejects(session.changeset(), /Session is closed/);
+
+  assert.deepStrictEqual(await replica.applyChangeset(changeset), {
+    conflicts: {
+      data: 0, notFound: 0, conflict: 0, constraint: 0, foreignKey: 0,
+    },
+  });
+  const rows = [
+    { id: '1', name: 'a' }, { id: '2', name: 'bb' }, { id: '4', name: 'd' },
+  ];
+  assert.deepStrictEqual(
+    replica.querySync('SELECT * FROM t ORDER BY id'),
+    rows
+  );
+
+  // Applying it again conflicts on every change
+  await assert.rejects(replica.applyChangeset(changeset),
+                       { code: 'SQLITE_ABORT' });
+  const result = await replica.applyChangeset(changeset, {
+    onConflict: 'replace',
+  });
+  assert.strictEqual(result.conflicts.conflict, 1);
+  assert.strictEqual(result.conflicts.notFound, 1);
+  assert.strictEqual(result.conflicts.data, 1);
+  assert.deepStrictEqual(
+    replica.querySync('SELECT * FROM t ORDER BY id'),
+    rows
+  );
+  assert.throws(
+    () => replica.applyChangeset(changeset, {
+      onConflict: { notFound: 'replace' },
+    }),
+    /onConflict.notFound/
+  );
+
+  src.close();
+  replica.close();
+});
+
+test(async () => {
+  const basePath = join(__dirname, 'tmp');
+  const dbPath = join(basePath, 'snapshot.db');
+  const cleanup = () => {
+    for (const suffix of [ '', '-wal', '-shm' ]) {
+      try {
+        unlinkSync(`${dbPath}${suffix}`);
+      } catch (ex) {
+        if (ex.code !== 'ENOENT')
+          throw ex;
+      }
+    }
+  };
+  try {
+    mkdirSync(basePath);
+  } catch (ex) {
+    if (ex.code !== 'EEXIST')
+      throw ex;
+  }
+  cleanup();
+
+  try {
+    const writer = new Database(dbPath);
+    writer.open();
+    await writer.exec(`
+      PRAGMA journal_mode = WAL;
+      CREATE TABLE t (id INTEGER PRIMARY KEY);
+      INSERT INTO t VALUES (1), (2);
+    `);
+    const reader = new Database(dbPath);
+    reader.open();
+    const count = (db) => db.getSync('SELECT count(*) AS n FROM t').n;
+
+    const snapshot = await writer.snapshot();
+    assert(Buffer.isBuffer(snapshot));
+    assert.strictEqual(writer.autoCommitEnabled(), false);
+    assert.strictEqual(count(writer), '2');
+
+    const other = new Database(dbPath);
+    other.open();
+    await other.run('INSERT INTO t VALUES (3)');
+    other.close();
+
+    await reader.openSnapshot(snapshot);
+    assert.strictEqual(count(reader), '2');
+    await reader.run('COMMIT');
+    assert.strictEqual(count(reader), '3');
+    await writer.run('COMMIT');
+
+    assert.throws(() => reader.openSnapshot('foo'), /Invalid snapshot/);
+    await assert.rejects(reader.openSnapshot(Buffer.alloc(1)),
+                         /Invalid snapshot/);
+    assert.strictEqual(reader.autoCommitEnabled(), true);
+
+    writer.close();
+    reader.close();
+
+    // Closing the last connection removes the WAL, after which no snapshot
+    // can be taken until something is written to it again
+    const reopened = new Database(dbPath);
+    reopened.open();
+    assert.strictEqual(count(reopened), '3');
+    await assert.rejects(reopened.snapshot(), { code: 'SNAPSHOT_WAL_EMPTY' });
+    assert.strictEqual(reopened.autoCommitEnabled(), true);
+    await reopened.run('INSERT INTO t VALUES (4)');
+    assert(Buffer.isBuffer(await reopened.snapshot()));
+    await reopened.run('COMMIT');
+    reopened.close();
+  } finally {
+    cleanup();
+  }
+});
+
+test(async () => {
+  const basePath = join(__dirname, 'tmp');
+  const dbPath = join(basePath, 'parallel.db');
+  const cleanup = () => {
+    for (const suffix of [ '', '-wal', '-shm' ]) {
+      try {
+        unlinkSync(`${dbPath}${suffix}`);
+      } catch (ex) {
+        if (ex.code !== 'ENOENT')
+          throw ex;
+      }
+    }
+  };
+  try {
+    mkdirSync(basePath);
+  } catch (ex) {
+    if (ex.code !== 'EEXIST')
+      throw ex;
+  }
+  cleanup();
+
+  try {
+    const db = new Database(dbPath);
+    db.open();
+    await db.exec(`
+      PRAGMA journal_mode = WAL;
+      CREATE TABLE t (id INTEGER PRIMARY KEY, grp INT, val INT);
+      INSERT INTO t SELECT value, value % 3, value FROM generate_series(1, 100);
+    `);
+
+    const rows = await db.parallelQuery(
+      'SELECT id FROM t WHERE id >= :start AND id < :end AND val > :min',
+      { table: 't', partitionBy: 'id', workers: 3, values: { min: 90 } }
+    );
+    assert.deepStrictEqual(rows.map((row) => row.id),
+                           [ 91, 92, 93, 94, 95, 96, 97, 98, 99, 100 ]
+                             .map(String));
+
+    const groups = await db.parallelQuery(`
+      SELECT grp, count(*) AS n, sum(val) AS total, min(val) AS lo,
+             max(val) AS hi
+      FROM t
+      WHERE rowid >= :start AND rowid < :end
+      GROUP BY grp
+      ORDER BY grp
+    `, {
+      table: 't',
+      workers: 4,
+      combine: { n: 'count', total: 'sum', lo: 'min', hi: 'max' },
+    });
+    assert.deepStrictEqual(groups, [
+      { grp: '0', n: '33', total: '1683', lo: '3', hi: '99' },
+      { grp: '1', n: '34', total: '1717', lo: '1', hi: '100' },
+      { grp: '2', n: '33', total: '1650', lo: '2', hi: '98' },
+    ]);
+    assert.strictEqual(db.autoCommitEnabled(), true);
+
+    // Queries queued meanwhile are not run inside the snapshot's transaction
+    const pending = db.parallelQuery(
+      'SELECT count(*) AS n FROM t WHERE id >= :start AND id < :end',
+      { table: 't', workers: 2, combine: { n: 'count' } }
+    );
+    const insert = db.run('INSERT INTO t VALUES (101, 2, 101)');
+    assert.deepStrictEqual(await pending, [ { n: '100' } ]);
+    assert.strictEqual((await insert).changes, 1);
+    assert.strictEqual(db.autoCommitEnabled(), true);
+    await db.exec('BEGIN');
+    await db.exec('ROLLBACK');
+
+    // A failing partition does not prevent the readers from being closed
+    await assert.rejects(db.parallelQuery(`
+      SELECT CASE WHEN :start > 50 THEN abs(-9223372036854775807 - 1) END AS x
+      FROM t
+      WHERE id >= :start AND id < :end
+    `, { table: 't', workers: 4 }), /integer overflow/);
+
+    assert.throws(() => db.parallelQuery('SELECT * FROM t', { table: 't' }),
+                  /:start and :end/);
+    assert.throws(() => db.parallelQuery('SELECT :start, :end', {}),
+                  /Invalid table/);
+    assert.throws(
+      () => db.parallelQuery('SELECT :start, :end', {
+        table: 't',
+        combine: { n: 'avg' },
+      }),
+      /combine.n/
+    );
+
+    db.close();
+
+    // Nothing has been written to the WAL after reopening the database, so
+    // the readers are synchronized by holding the write lock instead
+    const reopened = new Database(dbPath);
+    reopened.open();
+    await assert.rejects(reopened.snapshot(), { code: 'SNAPSHOT_WAL_EMPTY' });
+    assert.deepStrictEqual(
+      await reopened.parallelQuery(
+        'SELECT count(*) AS n FROM t WHERE id >= :start AND id < :end',
+        { table: 't', workers: 3, combine: { n: 'count' } }
+      ),
+      [ { n: '101' } ]
+    );
+    assert.strictEqual(reopened.autoCommitEnabled(), true);
+    await reopened.run('INSERT INTO t VALUES (102, 0, 102)');
+    reopened.close();
+  } finally {
+    cleanup();
+  }
+});
+
+test(async () => {
+  assert.throws(() => new ShardedDatabase([]), /Invalid paths/);
+
+  const db = new ShardedDatabase([ ':memory:', ':memory:', ':memory:' ]);
+  db.open();
+  await db.exec('CREATE TABLE events (id INTEGER PRIMARY KEY, ts INT)');
+
+  for (let id = 1; id <= 30; ++id) {
+    await db.write(id, 'INSERT INTO events VALUES (?, ?)', [ id, 100 - id ]);
+    assert.strictEqual(
+      db.shardFor(id).querySync('SELECT ts FROM events WHERE id = ?', [ id ])
+        .length,
+      1
+    );
+  }
+  const counts = db.shards.map(
+    (shard) => +shard.getSync('SELECT count(*) AS n FROM events').n
+  );
+  assert.strictEqual(counts.reduce((a, b) => a + b), 30);
+  assert(counts.every((n) => n > 0));
+
+  const rows = await db.query(
+    'SELECT id, ts FROM events ORDER BY ts DESC LIMIT 5',
+    { orderBy: { column: 'ts', desc: true }, limit: 5 }
+  );
+  assert.deepStrictEqual(rows.map((row) => row.id),
+                         [ '1', '2', '3', '4', '5' ]);
+
+  const all = await db.query('SELECT id FROM events ORDER BY id',
+                             { orderBy: 'id' });
+  assert.deepStrictEqual(
+    all.map((row) => +row.id),
+    Array.from({ length: 30 }, (_, i) => i + 1)
+  );
+
+  assert.deepStrictEqual(
+    await db.get('SELECT id FROM events WHERE ts = ?', [ 90 ]),
+    { id: '10' }
+  );
+  assert.strictEqual(
+    (await db.run(7, 'DELETE FROM events WHERE id = ?', [ 7 ])).changes,
+    1
+  );
+  assert.throws(() => db.shardFor(null), /Invalid key/);
+
+  db.close();
+});
+
+if (typeof AbortController === 'function') {
+  test(async () => {
+    const db = new Database(':memory:');
+    db.open();
+
+    // Already aborted
+    let ac = new AbortController();
+    ac.abort();
+    await assert.rejects(
+      db.queryAsync('SELECT 1', { signal: ac.signal }).execute(),
+      { name: 'AbortError', code: 'ABORT_ERR' }
+    );
+
+    // Aborted while queued
+    ac = new AbortController();
+    const stmt = db.queryAsync('SELECT * FROM generate_series(1,10)');
+    const stmt2 = db.queryAsync(
+      'SELECT * FROM generate_series(1,10)',
+      { signal: ac.signal }
+    );
+    const promise = stmt2.execute();
+    ac.abort();
+    await assert.rejects(promise, { code: 'ABORT_ERR' });
+    assert.strictEqual((await stmt.execute()).length, 10);
+
+    // Aborted while executing
+    ac = new AbortController();
+    const stmt3 = db.queryAsync(`
+      WITH RECURSIVE c(x) AS (SELECT 1 UNION ALL SELECT x + 1 FROM c)
+      SELECT count(*) FROM c
+    `, { signal: ac.signal });
+    setTimeout(() => ac.abort(), 50);
+    await assert.rejects(stmt3.execute(), { code: 'ABORT_ERR' });
+
+    // The connection is still usable afterwards
+    assert.deepStrictEqual(
+      await db.queryAsync('SELECT 1 AS n').execute(),
+      [ { n: '1' } ]
+    );
+
+    assert.throws(
+      () => db.queryAsync('SELECT 1', { signal: {} }),
+      /invalid signal/i
+    );
+    db.close();
+  });
+
+  test(async () => {
+    // Aborted after being handed to the threadpool, but before any statement
+    // started running because all threads are busy
+    const blockers = [];
+    const poolSize = (+process.env.UV_THREADPOOL_SIZE || 4);
+    for (let i = 0; i < poolSize; ++i) {
+      const blocker = new Database(':memory:');
+      blocker.open();
+      blockers.push(blocker);
+    }
+    const db = new Database(':memory:');
+    db.open();
+    await db.exec('CREATE TABLE t (id INTEGER PRIMARY KEY)');
+
+    const busy = blockers.map((blocker) => blocker.get(`
+      WITH RECURSIVE c(x) AS (SELECT 1 UNION ALL SELECT x + 1 FROM c
+                              WHERE x < 3000000)
+      SELECT count(*) AS n FROM c
+    `));
+    const ac = new AbortController();
+    const write = db.run('INSERT INTO t VALUES (1)', { signal: ac.signal });
+    ac.abort();
+    await assert.rejects(write, { code: 'ABORT_ERR' });
+    await Promise.all(busy);
+
+    // The write never ran
+    assert.deepStrictEqual(await db.get('SELECT count(*) AS n FROM t'),
+                           { n: '0' });
+    for (const blocker of blockers)
+      blocker.close();
+    db.close();
+  });
+} else {
+  console.log('Skipped AbortSignal tests');
+}
+
 if (supportsAsyncDispose) {
   test(new Function('assert,Database', `
     return async () => {
@@ -6,6 +6,7 @@ const { join } = require('path');
 
 const {
   ACTION_CODES,
+  AES_HARDWARE,
   Database,
   version,
 } = require(join(__dirname, '..', 'lib'));
@@ -965,3 +966,260 @@ test(async () => {
     } catch {}
   }
 });
+
+test(async () => {
+  const db = new Database(':memory:');
+  assert.throws(() => db.open({ cipher: 'rc4' }), /invalid cipher/i);
+  assert.throws(() => db.open(undefined, { cipher: 1 }), /invalid cipher/i);
+  if (!AES_HARDWARE) {
+    assert.throws(() => db.open({ cipher: 'aegis' }), /AES hardware/i);
+    return;
+  }
+
+  const basePath = join(__dirname, 'tmp');
+  const dbPath = join(basePath, 'encrypted-aegis.db');
+  try {
+    mkdirSync(basePath);
+  } catch (ex) {
+    if (ex.code !== 'EEXIST')
+      throw ex;
+  }
+  try {
+    unlinkSync(dbPath);
+  } catch (ex) {
+    if (ex.code !== 'ENOENT')
+      throw ex;
+  }
+
+  const query = (db, sql) => new Promise((resolve, reject) => {
+    db.query(sql, { single: false }, (err, rows) => {
+      if (Array.isArray(err))
+        err = err.find((e) => !!e);
+      if (err)
+        reject(err);
+      else
+        resolve(rows);
+    });
+  });
+
+  try {
+    {
+      // Create a database encrypted with the cipher selected at open time
+      const db = new Database(dbPath);
+      db.open({ cipher: 'aegis' });
+      await query(db, `PRAGMA key = 'foobarbaz'`);
+      await query(db, `
+        CREATE TABLE data (name TEXT);
+        INSERT INTO data (name) VALUES ('Foo');
+      `);
+      db.close();
+    }
+
+    {
+      // Re-opening with the default cipher should fail
+      const db = new Database(dbPath);
+      db.open();
+      await query(db, `PRAGMA key = 'foobarbaz'`);
+      await assert.rejects(() => query(db, 'SELECT * FROM data'));
+      db.close();
+    }
+
+    {
+      // Re-opening with the same cipher and key should succeed
+      const db = new Database(dbPath);
+      db.open({ cipher: 'aegis' });
+      await query(db, `PRAGMA key = 'foobarbaz'`);
+      assert.deepStrictEqual(
+        await query(db, 'SELECT * FROM data'),
+        [ { name: 'Foo' } ]
+      );
+      db.close();
+    }
+  } finally {
+    try {
+      unlinkSync(dbPath);
+    } catch {}
+    try {
+      rmdirSync(basePath);
+    } catch {}
+  }
+});
+
+if (typeof AbortController === 'function') {
+  test(() => new Promise((resolve, reject) => {
+    const db = new Database(':memory:');
+    db.open();
+    const ac = new AbortController();
+    const ac2 = new AbortController();
+    db.query(`
+      WITH RECURSIVE c(x) AS (SELECT 1 UNION ALL SELECT x + 1 FROM c)
+      SELECT count(*) FROM c;
+      SELECT 1;
+    `, { single: false, signal: ac.signal }, (err, rows) => {
+      try {
+        assert.strictEqual(err.code, 'ABORT_ERR');
+        assert(!rows);
+      } catch (ex) {
+        return reject(ex);
+      }
+    });
+    db.query('SELECT 1', { signal: ac2.signal }, (err, rows) => {
+      try {
+        assert.strictEqual(err.code, 'ABORT_ERR');
+        assert(!rows);
+      } catch (ex) {
+        return reject(ex);
+      }
+    });
+    db.query('SELECT 2 AS n', (err, rows) => {
+      try {
+        assert.ifError(err);
+        assert.deepStrictEqual(rows, [ { n: '2' } ]);
+        db.close();
+      } catch (ex) {
+        return reject(ex);
+      }
+      resolve();
+    });
+    ac2.abort();
+    setTimeout(() => ac.abort(), 50);
+  }));
+}
+
+test(async () => {
+  const basePath = join(__dirname, 'tmp');
+  const dbPath = join(basePath, 'busy.db');
+  try {
+    mkdirSync(basePath);
+  } catch (ex) {
+    if (ex.code !== 'EEXIST')
+      throw ex;
+  }
+  try {
+    unlinkSync(dbPath);
+  } catch (ex) {
+    if (ex.code !== 'ENOENT')
+      throw ex;
+  }
+
+  const query = (db, sql) => new Promise((resolve, reject) => {
+    db.query(sql, (err, rows, metrics) => {
+      if (err)
+        reject(err);
+      else
+        resolve({ rows, metrics });
+    });
+  });
+
+  const writer = new Database(dbPath);
+  const noRetry = new Database(dbPath);
+  const retry = new Database(dbPath);
+  const shortRetry = new Database(dbPath);
+  try {
+    writer.open();
+    noRetry.open();
+    retry.open({ busyRetry: { initialDelayMs: 5, maxDelayMs: 20 } });
+    shortRetry.open({ busyRetry: { maxWaitMs: 30 } });
+    assert.throws(
+      () => new Database(dbPath).open({ busyRetry: { maxWaitMs: -1 } }),
+      /invalid busyRetry.maxWaitMs/i
+    );
+
+    await query(writer, 'CREATE TABLE data (id INTEGER PRIMARY KEY)');
+    await query(writer, 'BEGIN IMMEDIATE');
+
+    await assert.rejects(
+      () => query(noRetry, 'INSERT INTO data VALUES (1)'),
+      { code: 'SQLITE_BUSY' }
+    );
+    await assert.rejects(
+      () => query(shortRetry, 'INSERT INTO data VALUES (1)'),
+      { code: 'SQLITE_BUSY' }
+    );
+
+    // The lock is released while the statement is waiting to be retried
+    setTimeout(() => writer.query('COMMIT'), 100);
+    const { metrics } = await query(retry, 'INSERT INTO data VALUES (1)');
+    assert(metrics.busyRetries > 0);
+    assert(metrics.busyWaitMs > 0);
+
+    // The same goes for the transactions started by `write()`,
+    // `transaction()` and `exec()`
+    await query(writer, 'BEGIN IMMEDIATE');
+    await assert.rejects(noRetry.write('INSERT INTO data VALUES (2)'),
+                         { code: 'SQLITE_BUSY' });
+    await query(writer, 'COMMIT');
+    const writes = [
+      () => retry.write('INSERT INTO data VALUES (2)'),
+      () => retry.transaction([ 'INSERT INTO data VALUES (3)' ],
+                              { mode: 'immediate' }),
+      () => retry.exec('BEGIN IMMEDIATE; INSERT INTO data VALUES (4); COMMIT'),
+    ];
+    for (const write of writes) {
+      await query(writer, 'BEGIN IMMEDIATE');
+      setTimeout(() => writer.query('COMMIT'), 50);
+      await write();
+    }
+
+    const { rows } = await query(noRetry, 'SELECT * FROM data');
+    assert.deepStrictEqual(
+      rows,
+      [ { id: '1' }, { id: '2' }, { id: '3' }, { id: '4' } ]
+    );
+  } finally {
+    for (const db of [ writer, noRetry, retry, shortRetry ])
+      db.close();
+    try {
+      unlinkSync(dbPath);
+    } catch {}
+    try {
+      rmdirSync(basePath);
+    } catch {}
+  }
+});
+
+test(() => new Promise((resolve, reject) => {
+  const db = new Database(':memory:');
+  db.open({ priorityAgingMs: 0 });
+  const order = [];
+  const done = (name) => (err) => {
+    if (err)
+      return reject(err);
+    order.push(name);
+  };
+  // The first query starts executing right away, the rest are queued
+  db.query('SELECT 1', done('first'));
+  db.query('SELECT 1', { priority: 'low' }, done('low'));
+  db.query('SELECT 1', done('normal'));
+  db.query('SELECT 1', { priority: 'high' }, done('high1'));
+  db.query('SELECT 1', { priority: 'high' }, done('high2'));
+  try {
+    const stats = db.queueStats();
+    assert.strictEqual(stats.high.depth, 2);
+    assert.strictEqual(stats.normal.depth, 1);
+    assert.strictEqual(stats.low.depth, 1);
+    assert.throws(
+      () => db.query('SELECT 1', { priority: 'urgent' }),
+      /invalid priority/i
+    );
+  } catch (ex) {
+    return reject(ex);
+  }
+  db.query('SELECT 1', { priority: 'low' }, (err) => {
+    try {
+      assert.ifError(err);
+      assert.deepStrictEqual(
+        order,
+        [ 'first', 'high1', 'high2', 'normal', 'low' ]
+      );
+      const stats = db.queueStats();
+      assert.strictEqual(stats.low.depth, 0);
+      assert.strictEqual(stats.low.served, 2);
+      assert.strictEqual(stats.high.served, 2);
+      db.close();
+    } catch (ex) {
+      return reject(ex);
+    }
+    resolve();
+  });
+}));